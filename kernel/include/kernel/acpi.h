@@ -0,0 +1,45 @@
+#ifndef WALU_ACPI_H
+#define WALU_ACPI_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define ACPI_MAX_CPUS 16
+#define ACPI_MAX_IOAPICS 4
+#define ACPI_MAX_OVERRIDES 16
+
+/* MPS INTI flags from an interrupt source override. */
+#define ACPI_POLARITY_MASK  0x3U
+#define ACPI_POLARITY_LOW   0x3U
+#define ACPI_TRIGGER_MASK   0xCU
+#define ACPI_TRIGGER_LEVEL  0xCU
+
+typedef struct {
+    uint8_t id;
+    uint32_t address;
+    uint32_t gsi_base;
+} acpi_ioapic_t;
+
+typedef struct {
+    uint8_t source_irq;
+    uint32_t gsi;
+    uint16_t flags;
+} acpi_irq_override_t;
+
+typedef struct {
+    bool present;
+    bool has_8259;
+    uint64_t lapic_addr;
+    uint32_t cpu_count;
+    uint32_t cpu_apic_ids[ACPI_MAX_CPUS];
+    uint32_t ioapic_count;
+    acpi_ioapic_t ioapics[ACPI_MAX_IOAPICS];
+    uint32_t override_count;
+    acpi_irq_override_t overrides[ACPI_MAX_OVERRIDES];
+} acpi_madt_info_t;
+
+bool acpi_init(uint32_t multiboot_info_addr);
+const void *acpi_find_table(const char *signature);
+const acpi_madt_info_t *acpi_madt(void);
+
+#endif
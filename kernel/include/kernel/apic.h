@@ -0,0 +1,31 @@
+#ifndef WALU_APIC_H
+#define WALU_APIC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define APIC_SPURIOUS_VECTOR 0xFF
+
+/* ICR low-word delivery modes; all asserted, edge-triggered. */
+#define APIC_IPI_FIXED 0x4000U
+#define APIC_IPI_INIT 0x4500U
+#define APIC_IPI_STARTUP 0x4600U
+
+bool apic_init(void);
+bool apic_enabled(void);
+bool apic_x2apic(void);
+uint32_t lapic_id(void);
+void lapic_eoi(void);
+void apic_init_ap(void);
+void lapic_send_ipi(uint32_t dest_apic_id, uint32_t icr_low);
+bool ioapic_route_irq(uint8_t isa_irq, uint8_t vector, uint32_t dest_apic_id);
+bool ioapic_mask_irq(uint8_t isa_irq);
+
+bool lapic_has_tsc_deadline(void);
+void lapic_timer_setup(uint8_t vector, bool tsc_deadline);
+void lapic_timer_oneshot(uint32_t count);
+uint32_t lapic_timer_current(void);
+void lapic_timer_deadline(uint64_t tsc);
+void lapic_timer_stop(void);
+
+#endif
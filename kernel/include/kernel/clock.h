@@ -0,0 +1,28 @@
+#ifndef WALU_CLOCK_H
+#define WALU_CLOCK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef enum {
+    CLOCK_SOURCE_TSC = 0,
+    CLOCK_SOURCE_HPET,
+} clock_source_t;
+
+typedef struct {
+    clock_source_t source;
+    uint64_t tsc_hz;
+    uint64_t source_hz;
+    bool tsc_invariant;
+    bool calibrated_by_hpet;
+} clock_info_t;
+
+void clock_init(void);
+uint64_t clock_monotonic_ns(void);
+uint64_t clock_cycles_to_ns(uint64_t cycles);
+uint64_t clock_ns_to_cycles(uint64_t ns);
+uint64_t clock_tsc_hz(void);
+void clock_info(clock_info_t *out);
+const char *clock_source_name(clock_source_t source);
+
+#endif
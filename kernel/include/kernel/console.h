@@ -12,5 +12,10 @@ void console_backspace(void);
 void console_write(const char *s);
 void console_write_hex(uint64_t value);
 void console_write_dec(uint64_t value);
+/* TSC cycles for one full framebuffer repaint; 0 on the VGA text backend. */
+uint64_t console_redraw_cycles(void);
+/* COM1 only, bypassing the screen: machine-readable dumps for host tooling. */
+void console_serial_write(const char *s);
+void console_serial_write_dec(uint64_t value);
 
 #endif
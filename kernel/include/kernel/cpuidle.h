@@ -0,0 +1,37 @@
+#ifndef WALU_CPUIDLE_H
+#define WALU_CPUIDLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* HLT plus up to seven MWAIT C-states (C1..C7). */
+#define CPUIDLE_MAX_STATES 8U
+
+typedef struct {
+    const char *name;
+    bool mwait;
+    /* MWAIT EAX hint: C-state minus one in bits 7:4, sub-state in bits 3:0. */
+    uint32_t hint;
+    /* Sub-states CPUID leaf 5 reports for this C-state. */
+    uint32_t substates;
+} cpuidle_state_t;
+
+typedef struct {
+    uint64_t entries[CPUIDLE_MAX_STATES];
+    uint64_t residency_ns[CPUIDLE_MAX_STATES];
+    /* Wakeups with a known cause time: a timer deadline or a remote kick. */
+    uint64_t timed_wakeups;
+    uint64_t latency_sum_ns;
+    uint64_t latency_max_ns;
+} cpuidle_cpu_info_t;
+
+void cpuidle_init(void);
+void cpuidle_enter(uint64_t wake_tsc);
+void cpuidle_kick(unsigned int cpu);
+unsigned int cpuidle_state_count(void);
+bool cpuidle_state_info(unsigned int index, cpuidle_state_t *out);
+unsigned int cpuidle_selected(void);
+bool cpuidle_select(unsigned int index);
+bool cpuidle_cpu_info(unsigned int cpu, cpuidle_cpu_info_t *out);
+
+#endif
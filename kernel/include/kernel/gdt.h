@@ -0,0 +1,28 @@
+#ifndef WALU_GDT_H
+#define WALU_GDT_H
+
+#include <stdint.h>
+
+#define GDT_KERNEL_CODE 0x08U
+#define GDT_KERNEL_DATA 0x10U
+#define GDT_TSS 0x18U
+
+typedef struct {
+    uint32_t reserved0;
+    uint64_t rsp[3];
+    uint64_t reserved1;
+    uint64_t ist[7];
+    uint64_t reserved2;
+    uint16_t reserved3;
+    uint16_t iomap_base;
+} __attribute__((packed)) tss_t;
+
+/* Null, kernel code, kernel data, then the two-slot TSS descriptor. */
+typedef struct {
+    uint64_t entries[5];
+    tss_t tss;
+} __attribute__((aligned(16))) cpu_gdt_t;
+
+void gdt_load_cpu(cpu_gdt_t *gdt, uint64_t rsp0);
+
+#endif
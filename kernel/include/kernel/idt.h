@@ -2,5 +2,6 @@
 #define WALU_IDT_H
 
 void idt_init(void);
+void idt_load(void);
 
 #endif
@@ -29,6 +29,38 @@ static inline void hlt(void) {
     __asm__ volatile ("hlt");
 }
 
+/* sti only takes effect after the next instruction, so no IRQ can slip in before hlt. */
+static inline void sti_hlt(void) {
+    __asm__ volatile ("sti; hlt" : : : "memory");
+}
+
+static inline void cpu_relax(void) {
+    __asm__ volatile ("pause" : : : "memory");
+}
+
+#ifdef WALU_HOST
+/* Host unit tests run in ring 3, where cli/sti fault. */
+static inline uint64_t irq_save(void) {
+    return 0;
+}
+
+static inline void irq_restore(uint64_t flags) {
+    (void)flags;
+}
+#else
+static inline uint64_t irq_save(void) {
+    uint64_t flags;
+    __asm__ volatile ("pushfq; pop %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+static inline void irq_restore(uint64_t flags) {
+    if (flags & (1ULL << 9)) {
+        sti();
+    }
+}
+#endif
+
 static inline void lidt(void *idtr) {
     __asm__ volatile ("lidt %0" : : "m"(*(const uint8_t (*)[10])idtr));
 }
@@ -39,8 +71,59 @@ static inline uint64_t read_cr2(void) {
     return value;
 }
 
+static inline void cpuid(uint32_t leaf, uint32_t subleaf,
+                         uint32_t *a, uint32_t *b, uint32_t *c, uint32_t *d) {
+    __asm__ volatile ("cpuid" : "=a"(*a), "=b"(*b), "=c"(*c), "=d"(*d) : "a"(leaf), "c"(subleaf));
+}
+
+static inline uint64_t rdmsr(uint32_t msr) {
+    uint32_t lo;
+    uint32_t hi;
+    __asm__ volatile ("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t value) {
+    __asm__ volatile ("wrmsr" : : "c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)));
+}
+
+static inline uint64_t rdtsc(void) {
+    uint32_t lo;
+    uint32_t hi;
+    __asm__ volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline uint64_t read_cr3(void) {
+    uint64_t value;
+    __asm__ volatile ("mov %%cr3, %0" : "=r"(value));
+    return value;
+}
+
+static inline void write_cr3(uint64_t value) {
+    __asm__ volatile ("mov %0, %%cr3" : : "r"(value) : "memory");
+}
+
+static inline uint64_t read_cr4(void) {
+    uint64_t value;
+    __asm__ volatile ("mov %%cr4, %0" : "=r"(value));
+    return value;
+}
+
+static inline void write_cr4(uint64_t value) {
+    __asm__ volatile ("mov %0, %%cr4" : : "r"(value) : "memory");
+}
+
 static inline void invlpg(void *addr) {
     __asm__ volatile ("invlpg (%0)" : : "r"(addr) : "memory");
 }
 
+static inline void invpcid(uint64_t type, uint64_t pcid, uint64_t addr) {
+    struct {
+        uint64_t pcid;
+        uint64_t addr;
+    } desc = { pcid, addr };
+    __asm__ volatile ("invpcid %0, %1" : : "m"(desc), "r"(type) : "memory");
+}
+
 #endif
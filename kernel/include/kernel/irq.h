@@ -0,0 +1,35 @@
+#ifndef WALU_IRQ_H
+#define WALU_IRQ_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* ISA lines 0-15 plus the remaining pins of a standard 24-pin IOAPIC. */
+#define IRQ_LINES 24U
+#define IRQ_VECTOR_BASE 0x20U
+#define IRQ_MAX_ACTIONS 32U
+/* Handler time histogram: bucket b counts [2^b, 2^(b+1)) TSC cycles. */
+#define IRQ_HIST_BUCKETS 32U
+
+/* Returns true when the device behind ctx raised the interrupt. */
+typedef bool (*irq_handler_t)(void *ctx);
+
+typedef struct {
+    uint32_t handlers;
+    uint64_t count;
+    uint64_t spurious;
+    uint64_t cycles_total;
+    uint64_t cycles_min;
+    uint64_t cycles_max;
+    uint64_t hist[IRQ_HIST_BUCKETS];
+} irq_stats_t;
+
+bool irq_register(uint8_t line, irq_handler_t handler, void *ctx);
+bool irq_unregister(uint8_t line, irq_handler_t handler, void *ctx);
+void irq_dispatch(uint8_t line);
+void irq_eoi(uint8_t line);
+bool irq_stats(uint8_t line, irq_stats_t *out);
+void irq_note_spurious_vector(void);
+uint64_t irq_spurious_vectors(void);
+
+#endif
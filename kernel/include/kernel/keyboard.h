@@ -2,8 +2,11 @@
 #define WALU_KEYBOARD_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+#include <kernel/waitqueue.h>
+
 typedef enum {
     KEY_NONE = 0,
     KEY_ESC,
@@ -135,11 +138,16 @@ typedef struct {
 
 void keyboard_init(void);
 void keyboard_on_irq(void);
+void keyboard_test_inject_scancode(uint8_t scancode);
 bool keyboard_pop_char(char *out);
+size_t keyboard_read(char *buf, size_t len);
+bool keyboard_has_input(void);
+wait_queue_t *keyboard_wait_queue(void);
 bool keyboard_pop_event(key_event_t *out);
 uint8_t keyboard_modifiers(void);
 uint8_t keyboard_locks(void);
 uint64_t keyboard_rx_scancodes(void);
+uint64_t keyboard_dropped_scancodes(void);
 uint64_t keyboard_dropped_bytes(void);
 uint64_t keyboard_dropped_events(void);
 
@@ -0,0 +1,44 @@
+#ifndef WALU_KTIMER_H
+#define WALU_KTIMER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Wheel resolution; a timer never fires early, and at most this late plus softirq latency. */
+#define KTIMER_TICK_NS 1000000ULL
+#define KTIMER_LEVEL_BITS 6U
+#define KTIMER_SLOTS (1U << KTIMER_LEVEL_BITS)
+/* Four levels cover 64^4 ticks (about 4.6 hours); longer timers are re-filed on the way. */
+#define KTIMER_LEVELS 4U
+
+typedef void (*ktimer_fn)(void *arg);
+
+/* Embedded by the owner; the wheel never allocates. */
+typedef struct ktimer {
+    struct ktimer *next;
+    struct ktimer **pprev;
+    uint64_t expires;
+    ktimer_fn fn;
+    void *arg;
+    uint16_t slot;
+    volatile bool pending;
+} ktimer_t;
+
+typedef struct {
+    uint64_t pending;
+    uint64_t armed;
+    uint64_t fired;
+    uint64_t cancelled;
+    uint64_t cascaded;
+} ktimer_stats_t;
+
+void ktimer_init(void);
+void ktimer_setup(ktimer_t *timer, ktimer_fn fn, void *arg);
+bool ktimer_arm(ktimer_t *timer, uint64_t delay_ns);
+bool ktimer_cancel(ktimer_t *timer);
+bool ktimer_pending(const ktimer_t *timer);
+void ktimer_run(void);
+uint64_t ktimer_next_deadline_ns(void);
+void ktimer_stats(ktimer_stats_t *out);
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef WALU_LOCK_H
+#define WALU_LOCK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define LOCK_MAX_TRACKED 128
+
+typedef enum {
+    LOCK_KIND_SPIN = 0,
+    LOCK_KIND_TICKET,
+    LOCK_KIND_MCS,
+} lock_kind_t;
+
+/*
+ * Contention profile kept inside every lock. Counters are only written by
+ * the holder, so they need no atomics; readers get a racy snapshot.
+ */
+typedef struct {
+    const char *name;
+    lock_kind_t kind;
+    uint64_t acquisitions;
+    uint64_t contended;
+    uint64_t spin_cycles;
+    uint64_t hold_max;
+    uint64_t hold_start;
+} lock_stats_t;
+
+/* Test-and-test-and-set; cheapest when the lock is rarely fought over. */
+typedef struct {
+    volatile uint32_t locked;
+    lock_stats_t stats;
+} spinlock_t;
+
+/* FIFO: waiters are served in arrival order, but all spin on one line. */
+typedef struct {
+    volatile uint32_t next;
+    volatile uint32_t owner;
+    lock_stats_t stats;
+} ticketlock_t;
+
+/*
+ * Queue lock: every waiter spins on its own node, so a contended handoff
+ * touches one remote cache line instead of all of them. The node lives on
+ * the caller's stack for the duration of the critical section.
+ */
+typedef struct mcs_node {
+    struct mcs_node *volatile next;
+    volatile bool locked;
+} mcs_node_t;
+
+typedef struct {
+    mcs_node_t *volatile tail;
+    lock_stats_t stats;
+} mcslock_t;
+
+typedef struct {
+    const char *name;
+    lock_kind_t kind;
+    uint64_t acquisitions;
+    uint64_t contended;
+    uint64_t spin_cycles;
+    uint64_t hold_max_cycles;
+} lock_info_t;
+
+void spin_init(spinlock_t *lock, const char *name);
+void spin_lock(spinlock_t *lock);
+bool spin_trylock(spinlock_t *lock);
+void spin_unlock(spinlock_t *lock);
+uint64_t spin_lock_irqsave(spinlock_t *lock);
+void spin_unlock_irqrestore(spinlock_t *lock, uint64_t flags);
+
+void ticket_init(ticketlock_t *lock, const char *name);
+void ticket_lock(ticketlock_t *lock);
+bool ticket_trylock(ticketlock_t *lock);
+void ticket_unlock(ticketlock_t *lock);
+uint64_t ticket_lock_irqsave(ticketlock_t *lock);
+void ticket_unlock_irqrestore(ticketlock_t *lock, uint64_t flags);
+
+void mcs_init(mcslock_t *lock, const char *name);
+void mcs_lock(mcslock_t *lock, mcs_node_t *node);
+bool mcs_trylock(mcslock_t *lock, mcs_node_t *node);
+void mcs_unlock(mcslock_t *lock, mcs_node_t *node);
+uint64_t mcs_lock_irqsave(mcslock_t *lock, mcs_node_t *node);
+void mcs_unlock_irqrestore(mcslock_t *lock, mcs_node_t *node, uint64_t flags);
+
+bool lock_info(size_t index, lock_info_t *out);
+size_t lock_untracked(void);
+const char *lock_kind_name(lock_kind_t kind);
+
+#endif
@@ -8,8 +8,12 @@
 #define MULTIBOOT_TAG_TYPE_END 0
 #define MULTIBOOT_TAG_TYPE_MMAP 6
 #define MULTIBOOT_TAG_TYPE_FRAMEBUFFER 8
+#define MULTIBOOT_TAG_TYPE_ACPI_OLD 14
+#define MULTIBOOT_TAG_TYPE_ACPI_NEW 15
 
 #define MULTIBOOT_MEMORY_AVAILABLE 1
+#define MULTIBOOT_MEMORY_ACPI_RECLAIMABLE 3
+#define MULTIBOOT_MEMORY_NVS 4
 
 #define MULTIBOOT_FRAMEBUFFER_TYPE_INDEXED 0
 #define MULTIBOOT_FRAMEBUFFER_TYPE_RGB 1
@@ -56,4 +60,11 @@ struct multiboot_tag_framebuffer_rgb {
     uint8_t framebuffer_blue_mask_size;
 } __attribute__((packed));
 
+/* Copy of the ACPI RSDP (v1 for ACPI_OLD, v2+ for ACPI_NEW). */
+struct multiboot_tag_acpi {
+    uint32_t type;
+    uint32_t size;
+    uint8_t rsdp[];
+} __attribute__((packed));
+
 #endif
@@ -1,10 +1,14 @@
 #ifndef WALU_PIT_H
 #define WALU_PIT_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
-void pit_init(uint32_t frequency_hz);
-void pit_on_tick(void);
-uint64_t pit_ticks(void);
+#define PIT_FREQUENCY_HZ 1193182U
+
+void pit_oneshot(uint16_t count);
+void pit_stop(void);
+void pit_delay_start(uint16_t count);
+bool pit_delay_done(void);
 
 #endif
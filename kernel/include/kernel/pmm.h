@@ -5,12 +5,75 @@
 #include <stddef.h>
 #include <stdint.h>
 
+/* Largest buddy order: 2^10 frames (4 MiB). Order 9 is one 2 MiB page. */
+#define PMM_MAX_ORDER 10
+#define PMM_ORDER_2M 9
+
+/* Allocation latency histogram: bucket b counts [2^b, 2^(b+1)) TSC cycles. */
+#define PMM_LATENCY_BUCKETS 32
+
+typedef enum {
+    PMM_ZONE_DMA = 0,
+    PMM_ZONE_DMA32,
+    PMM_ZONE_NORMAL,
+    PMM_ZONE_COUNT
+} pmm_zone_id_t;
+
+typedef struct {
+    uint64_t base;
+    uint64_t length;
+} pmm_region_t;
+
+typedef struct {
+    const char *name;
+    uint64_t base;
+    uint64_t end;
+    uint64_t managed_kib;
+    uint64_t free_kib;
+} pmm_zone_info_t;
+
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t refills;
+    uint64_t drains;
+    uint64_t cached_frames;
+    uint64_t zero_hits;
+    uint64_t zero_misses;
+    uint64_t zeroed_frames;
+} pmm_cache_stats_t;
+
+typedef struct {
+    uint64_t allocs;
+    uint64_t alloc_failures;
+    uint64_t frees;
+    uint64_t free_blocks[PMM_MAX_ORDER + 1];
+    uint32_t unusable_permille[PMM_MAX_ORDER + 1];
+    uint64_t latency_hist[PMM_LATENCY_BUCKETS];
+    uint64_t latency_p50;
+    uint64_t latency_p99;
+    uint64_t latency_max;
+} pmm_stats_t;
+
 void pmm_init(uint32_t multiboot_info_addr);
+void pmm_init_regions(const pmm_region_t *regions, size_t count);
 uint64_t pmm_alloc_frame(void);
+uint64_t pmm_alloc_pages(unsigned int order);
+uint64_t pmm_alloc_pages_low(unsigned int order, uint64_t max_phys_addr);
+void pmm_free_pages(uint64_t phys_addr, unsigned int order);
 uint64_t pmm_alloc_frame_low(uint64_t max_phys_addr);
 void pmm_free_frame(uint64_t phys_addr);
 uint64_t pmm_total_kib(void);
 uint64_t pmm_used_kib(void);
 uint64_t pmm_free_kib(void);
+uint64_t pmm_free_blocks(unsigned int order);
+uint64_t pmm_invalid_ops(void);
+uint64_t pmm_metadata_kib(void);
+bool pmm_zone_info(unsigned int zone, pmm_zone_info_t *out);
+void pmm_cache_drain(void);
+uint64_t pmm_alloc_zeroed_frame(void);
+bool pmm_zero_pool_refill(unsigned int budget);
+void pmm_stats(pmm_stats_t *out);
+void pmm_cache_stats(pmm_cache_stats_t *out);
 
 #endif
@@ -5,6 +5,8 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <kernel/waitqueue.h>
+
 void pty_init(void);
 int pty_alloc(void);
 size_t pty_master_write(int pty_id, const uint8_t *buf, size_t len);
@@ -12,6 +14,10 @@ size_t pty_master_read(int pty_id, uint8_t *buf, size_t len);
 size_t pty_slave_write(int pty_id, const uint8_t *buf, size_t len);
 size_t pty_slave_read(int pty_id, uint8_t *buf, size_t len);
 bool pty_is_valid(int pty_id);
+bool pty_slave_readable(int pty_id);
+bool pty_master_readable(int pty_id);
+wait_queue_t *pty_slave_wait_queue(int pty_id);
+wait_queue_t *pty_master_wait_queue(int pty_id);
 uint64_t pty_dropped_bytes(void);
 uint64_t pty_invalid_ops(void);
 
@@ -0,0 +1,81 @@
+#ifndef WALU_RING_H
+#define WALU_RING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Single-producer/single-consumer ring. `head` and `tail` run freely and
+ * are masked on use, so all capacity slots are usable. The producer
+ * publishes `head` with release after writing slots and reads `tail` with
+ * acquire; the consumer does the mirror image, so an IRQ or another CPU
+ * can produce while a thread consumes without a lock.
+ */
+typedef struct {
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    uint32_t mask;
+    uint32_t elem_size;
+    uint8_t *data;
+} ring_t;
+
+void ring_init(ring_t *ring, void *data, size_t elem_size, unsigned int order);
+size_t ring_push_n(ring_t *ring, const void *src, size_t count);
+size_t ring_pop_n(ring_t *ring, void *dst, size_t count);
+size_t ring_count(const ring_t *ring);
+size_t ring_space(const ring_t *ring);
+
+/*
+ * Declare `name_t` holding 2^order elements of `type`, with typed wrappers.
+ * Single-element push/pop index directly; the _n variants copy in at most
+ * two memcpy segments.
+ */
+#define RING_DEFINE(name, type, order)                                                  \
+    typedef struct {                                                                    \
+        ring_t ring;                                                                    \
+        type slots[1U << (order)];                                                      \
+    } name##_t;                                                                         \
+                                                                                        \
+    static inline void name##_init(name##_t *r) {                                       \
+        ring_init(&r->ring, r->slots, sizeof(type), (order));                           \
+    }                                                                                   \
+                                                                                        \
+    static inline bool name##_push(name##_t *r, type value) {                           \
+        uint32_t head = r->ring.head;                                                   \
+        if (head - __atomic_load_n(&r->ring.tail, __ATOMIC_ACQUIRE) > r->ring.mask) {   \
+            return false;                                                               \
+        }                                                                               \
+        r->slots[head & r->ring.mask] = value;                                          \
+        __atomic_store_n(&r->ring.head, head + 1U, __ATOMIC_RELEASE);                   \
+        return true;                                                                    \
+    }                                                                                   \
+                                                                                        \
+    static inline bool name##_pop(name##_t *r, type *out) {                             \
+        uint32_t tail = r->ring.tail;                                                   \
+        if (__atomic_load_n(&r->ring.head, __ATOMIC_ACQUIRE) == tail) {                 \
+            return false;                                                               \
+        }                                                                               \
+        *out = r->slots[tail & r->ring.mask];                                           \
+        __atomic_store_n(&r->ring.tail, tail + 1U, __ATOMIC_RELEASE);                   \
+        return true;                                                                    \
+    }                                                                                   \
+                                                                                        \
+    static inline size_t name##_push_n(name##_t *r, const type *src, size_t count) {    \
+        return ring_push_n(&r->ring, src, count);                                       \
+    }                                                                                   \
+                                                                                        \
+    static inline size_t name##_pop_n(name##_t *r, type *dst, size_t count) {           \
+        return ring_pop_n(&r->ring, dst, count);                                        \
+    }                                                                                   \
+                                                                                        \
+    static inline size_t name##_count(const name##_t *r) {                              \
+        return ring_count(&r->ring);                                                    \
+    }                                                                                   \
+                                                                                        \
+    static inline bool name##_empty(const name##_t *r) {                                \
+        return __atomic_load_n(&r->ring.head, __ATOMIC_ACQUIRE) ==                      \
+               __atomic_load_n(&r->ring.tail, __ATOMIC_ACQUIRE);                        \
+    }
+
+#endif
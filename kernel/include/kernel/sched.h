@@ -0,0 +1,69 @@
+#ifndef WALU_SCHED_H
+#define WALU_SCHED_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SCHED_MAX_THREADS 64U
+#define SCHED_STACK_ORDER 2U
+/* Round-robin slice for threads sharing a CPU. */
+#define SCHED_SLICE_NS 10000000ULL
+/* Reschedule/steal kick between CPUs. */
+#define SCHED_IPI_VECTOR 0xF0U
+#define SCHED_CPU_ANY (-1)
+
+typedef struct thread thread_t;
+typedef void (*thread_fn)(void *arg);
+
+typedef enum {
+    THREAD_READY = 0,
+    THREAD_RUNNING,
+    THREAD_BLOCKED,
+    THREAD_DEAD,
+} thread_state_t;
+
+typedef struct {
+    uint32_t id;
+    const char *name;
+    thread_state_t state;
+    uint32_t cpu;
+    int32_t affinity;
+    uint64_t cpu_ns;
+    uint64_t switches;
+    uint64_t preemptions;
+} sched_thread_info_t;
+
+typedef struct {
+    const char *current;
+    uint32_t ready;
+    uint32_t ready_max;
+    /* Ready-queue length summed at every scheduler tick, for the average. */
+    uint64_t ready_sum;
+    uint64_t samples;
+    uint64_t switches;
+    uint64_t preemptions;
+    uint64_t steals;
+    uint64_t idle_ns;
+} sched_cpu_info_t;
+
+void sched_init(void);
+void sched_init_cpu(void);
+thread_t *thread_create(const char *name, thread_fn fn, void *arg, int affinity);
+void thread_exit(void);
+thread_t *sched_current(void);
+void sched_yield(void);
+void sched_block(void);
+void sched_prepare_block(void);
+void sched_cancel_block(void);
+void sched_wake(thread_t *thread);
+bool sched_has_work(void);
+bool sched_needs_tick(void);
+void sched_tick(void);
+void sched_irq_exit(void);
+void sched_idle(void);
+bool sched_thread_info(size_t index, sched_thread_info_t *out);
+bool sched_cpu_info(unsigned int cpu, sched_cpu_info_t *out);
+const char *sched_state_name(thread_state_t state);
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef WALU_SLAB_H
+#define WALU_SLAB_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct kmem_cache kmem_cache_t;
+
+/* Runs once per object when its slab is created, not on every allocation. */
+typedef void (*kmem_ctor_t)(void *obj);
+
+typedef struct {
+    const char *name;
+    uint64_t object_size;
+    uint64_t active_objects;
+    uint64_t total_objects;
+    uint64_t slabs;
+    uint64_t mag_hits;
+    uint64_t mag_misses;
+} kmem_cache_info_t;
+
+void slab_init(void);
+kmem_cache_t *kmem_cache_create(const char *name, size_t size, size_t align, kmem_ctor_t ctor);
+void *kmem_cache_alloc(kmem_cache_t *cache);
+void kmem_cache_free(kmem_cache_t *cache, void *obj);
+void kmem_cache_shrink(kmem_cache_t *cache);
+bool kmem_cache_info(size_t index, kmem_cache_info_t *out);
+
+void *kmalloc(size_t size);
+void *kzalloc(size_t size);
+void kfree(void *ptr);
+uint64_t slab_invalid_ops(void);
+
+#endif
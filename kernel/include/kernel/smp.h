@@ -0,0 +1,33 @@
+#ifndef WALU_SMP_H
+#define WALU_SMP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <kernel/gdt.h>
+
+#define SMP_MAX_CPUS 16U
+#define SMP_STACK_ORDER 2U
+
+/* Per-CPU data area; GS base points at it and self sits at %gs:0. */
+typedef struct cpu {
+    struct cpu *self;
+    uint32_t id;
+    uint32_t apic_id;
+    volatile bool online;
+    uint64_t stack_top;
+    /* Softirqs raised on this CPU run on it too, on IRQ exit or when idle. */
+    volatile uint32_t softirq_pending;
+    bool softirq_running;
+    cpu_gdt_t gdt;
+} cpu_t;
+
+void smp_init_bsp(void);
+unsigned int smp_boot_aps(void);
+unsigned int smp_cpu_id(void);
+cpu_t *smp_this_cpu(void);
+cpu_t *smp_cpu(unsigned int id);
+unsigned int smp_online_cpus(void);
+unsigned int smp_possible_cpus(void);
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef WALU_SOFTIRQ_H
+#define WALU_SOFTIRQ_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Deferred interrupt work: raised from a top half, run later with interrupts enabled. */
+typedef enum {
+    SOFTIRQ_KEYBOARD = 0,
+    SOFTIRQ_TIMER,
+    SOFTIRQ_MAX = 8
+} softirq_nr_t;
+
+typedef void (*softirq_fn)(void);
+
+typedef struct {
+    const char *name;
+    uint64_t raised;
+    uint64_t runs;
+    uint64_t cycles_total;
+    uint64_t cycles_max;
+} softirq_stats_t;
+
+bool softirq_register(softirq_nr_t nr, const char *name, softirq_fn fn);
+void softirq_raise(softirq_nr_t nr);
+bool softirq_pending(void);
+bool softirq_active(void);
+void softirq_run(void);
+bool softirq_stats(softirq_nr_t nr, softirq_stats_t *out);
+
+#endif
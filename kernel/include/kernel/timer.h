@@ -0,0 +1,37 @@
+#ifndef WALU_TIMER_H
+#define WALU_TIMER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Tick rate while the CPU is busy; ticks stop while it idles. */
+#define TIMER_HZ 100U
+#define TIMER_VECTOR 0x20U
+
+typedef enum {
+    TIMER_MODE_PIT_ONESHOT = 0,
+    TIMER_MODE_LAPIC_ONESHOT,
+    TIMER_MODE_TSC_DEADLINE,
+} timer_mode_t;
+
+typedef struct {
+    timer_mode_t mode;
+    uint64_t tsc_hz;
+    uint64_t interrupts;
+    uint64_t ticks;
+    uint64_t idle_entries;
+    uint64_t ticks_suppressed;
+    /* Interrupts that found timer wheel work due. */
+    uint64_t events;
+} timer_stats_t;
+
+void timer_init(void);
+void timer_idle_enter(void);
+void timer_idle_exit(void);
+void timer_reprogram(void);
+uint64_t timer_deadline_tsc(void);
+uint64_t timer_ticks(void);
+void timer_stats(timer_stats_t *out);
+const char *timer_mode_name(timer_mode_t mode);
+
+#endif
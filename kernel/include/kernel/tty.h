@@ -8,6 +8,7 @@
 void tty_init(void);
 void tty_poll_input(void);
 bool tty_pop_char(char *out);
+void tty_wait_input(void);
 void tty_set_canonical(bool enabled);
 void tty_set_echo(bool enabled);
 uint64_t tty_rx_bytes(void);
@@ -12,6 +12,7 @@ typedef struct {
     bool present;
     bool mapped;
     uint64_t phys_addr;
+    uint64_t virt_addr;
     uint64_t size_bytes;
     uint32_t width;
     uint32_t height;
@@ -28,6 +29,7 @@ typedef struct {
 
 void video_probe_multiboot(uint32_t multiboot_info_addr);
 bool video_map_framebuffer(void);
+bool video_set_framebuffer_cache(uint64_t cache);
 const video_framebuffer_info_t *video_framebuffer_info(void);
 
 #endif
@@ -2,13 +2,70 @@
 #define WALU_VMM_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #define VMM_FLAG_WRITABLE (1ULL << 1)
 #define VMM_FLAG_USER     (1ULL << 2)
 #define VMM_FLAG_NX       (1ULL << 63)
 
-void vmm_init(void);
+/* Caching type of a mapping; write-back unless one of these is set. */
+#define VMM_CACHE_WB      (0ULL << 8)
+#define VMM_CACHE_WC      (1ULL << 8)
+#define VMM_CACHE_UC      (2ULL << 8)
+#define VMM_CACHE_WT      (3ULL << 8)
+#define VMM_CACHE_MASK    (3ULL << 8)
+
+/* Kernel image (top 2 GiB), direct map of all RAM, and device windows. */
+#define VMM_KERNEL_BASE     0xFFFFFFFF80000000ULL
+#define VMM_DIRECT_MAP_BASE 0xFFFF800000000000ULL
+#define VMM_MMIO_BASE       0xFFFFFF0000000000ULL
+/* Lazy regions: backed one zeroed page at a time from the page-fault handler. */
+#define VMM_VMALLOC_BASE    0xFFFFC00000000000ULL
+#define VMM_VMALLOC_SIZE    0x0000010000000000ULL
+
+/* IPI asking another CPU to drop the TLB entries of a finished batch. */
+#define VMM_SHOOTDOWN_VECTOR 0xF1U
+
+typedef struct {
+    const char *name;
+    uint64_t base;
+    uint64_t size;
+    uint64_t resident_kib;
+    uint64_t minor_faults;
+} vmm_region_info_t;
+
+typedef struct {
+    uint64_t page_flushes;
+    uint64_t full_flushes;
+    uint64_t batches;
+    uint64_t deferred;
+    uint64_t shootdowns;
+    bool pcid;
+    bool invpcid;
+} vmm_tlb_stats_t;
+
+void vmm_init(uint32_t multiboot_info_addr);
+void vmm_init_cpu(void);
+uint64_t vmm_kernel_pml4(void);
 bool vmm_map_2m(uint64_t virt_addr, uint64_t phys_addr, uint64_t flags);
+bool vmm_map_4k(uint64_t virt_addr, uint64_t phys_addr, uint64_t flags);
+bool vmm_unmap(uint64_t virt_addr, uint64_t size);
+bool vmm_protect(uint64_t virt_addr, uint64_t size, uint64_t flags);
+bool vmm_virt_to_phys(uint64_t virt_addr, uint64_t *out_phys);
+uint64_t vmm_map_mmio(uint64_t phys_addr, uint64_t size, uint64_t flags);
+uint64_t vmm_table_kib(void);
+void *vmm_phys_to_virt(uint64_t phys_addr);
+uint64_t vmm_direct_to_phys(const void *virt_addr);
+uint64_t vmm_direct_map_limit(void);
+bool vmm_is_direct_mapped(uint64_t phys_addr, uint64_t size);
+uint64_t vmm_region_create(const char *name, uint64_t size, uint64_t flags);
+bool vmm_region_destroy(uint64_t base);
+bool vmm_region_info(size_t index, vmm_region_info_t *out);
+bool vmm_handle_fault(uint64_t fault_addr, uint64_t error_code);
+void vmm_flush_begin(void);
+void vmm_flush_end(void);
+void vmm_tlb_stats(vmm_tlb_stats_t *out);
+void vmm_shootdown_irq(void);
 
 #endif
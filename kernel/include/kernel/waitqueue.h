@@ -0,0 +1,40 @@
+#ifndef WALU_WAITQUEUE_H
+#define WALU_WAITQUEUE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <kernel/lock.h>
+#include <kernel/sched.h>
+
+/* Lives on the sleeper's stack; one per queue it sleeps on. */
+typedef struct wait_entry {
+    struct wait_entry *next;
+    struct wait_entry **pprev;
+    thread_t *thread;
+} wait_entry_t;
+
+typedef struct {
+    spinlock_t lock;
+    wait_entry_t *head;
+    uint64_t sleeps;
+    uint64_t wakeups;
+} wait_queue_t;
+
+/*
+ * Sleeping on one or more queues, with interrupts off throughout:
+ *
+ *     sched_prepare_block();
+ *     wait_queue_add(wq, &entry);
+ *     if (condition) sched_cancel_block(); else sched_block();
+ *     wait_queue_remove(wq, &entry);
+ *
+ * Producers publish their data first and then call wake_up_all().
+ */
+void wait_queue_init(wait_queue_t *wq, const char *name);
+void wait_queue_add(wait_queue_t *wq, wait_entry_t *entry);
+void wait_queue_remove(wait_queue_t *wq, wait_entry_t *entry);
+size_t wake_up_all(wait_queue_t *wq);
+
+#endif
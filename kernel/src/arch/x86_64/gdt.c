@@ -0,0 +1,51 @@
+#include <kernel/gdt.h>
+#include <kernel/string.h>
+
+#define GDT_CODE64 0x00AF9A000000FFFFULL
+#define GDT_DATA64 0x00AF92000000FFFFULL
+#define TSS_TYPE_AVAILABLE 0x89ULL
+
+struct gdtr {
+    uint16_t limit;
+    uint64_t base;
+} __attribute__((packed));
+
+/* Fill and load this CPU's GDT, reload every segment register, then load the TSS. */
+void gdt_load_cpu(cpu_gdt_t *gdt, uint64_t rsp0) {
+    uint64_t tss_base = (uint64_t)(uintptr_t)&gdt->tss;
+    uint64_t tss_limit = sizeof(gdt->tss) - 1;
+    struct gdtr gdtr = {
+        .limit = (uint16_t)(sizeof(gdt->entries) - 1),
+        .base = (uint64_t)(uintptr_t)gdt->entries,
+    };
+
+    memset(&gdt->tss, 0, sizeof(gdt->tss));
+    gdt->tss.rsp[0] = rsp0;
+    gdt->tss.iomap_base = (uint16_t)sizeof(gdt->tss);
+
+    gdt->entries[0] = 0;
+    gdt->entries[1] = GDT_CODE64;
+    gdt->entries[2] = GDT_DATA64;
+    gdt->entries[3] = (tss_limit & 0xFFFFULL) | ((tss_base & 0xFFFFFFULL) << 16) |
+                      (TSS_TYPE_AVAILABLE << 40) | (((tss_limit >> 16) & 0xFULL) << 48) |
+                      (((tss_base >> 24) & 0xFFULL) << 56);
+    gdt->entries[4] = tss_base >> 32;
+
+    __asm__ volatile (
+        "lgdt %0\n\t"
+        "pushq %1\n\t"
+        "leaq 1f(%%rip), %%rax\n\t"
+        "pushq %%rax\n\t"
+        "lretq\n"
+        "1:\n\t"
+        "movw %w2, %%ax\n\t"
+        "movw %%ax, %%ds\n\t"
+        "movw %%ax, %%es\n\t"
+        "movw %%ax, %%ss\n\t"
+        "movw %%ax, %%fs\n\t"
+        "movw %%ax, %%gs\n\t"
+        "ltr %w3"
+        :
+        : "m"(gdtr), "i"((uint64_t)GDT_KERNEL_CODE), "r"(GDT_KERNEL_DATA), "r"(GDT_TSS)
+        : "rax", "memory");
+}
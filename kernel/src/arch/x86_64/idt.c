@@ -1,10 +1,11 @@
+#include <kernel/apic.h>
 #include <kernel/console.h>
 #include <kernel/idt.h>
 #include <kernel/io.h>
-#include <kernel/keyboard.h>
-#include <kernel/pic.h>
-#include <kernel/pit.h>
+#include <kernel/irq.h>
+#include <kernel/sched.h>
 #include <kernel/string.h>
+#include <kernel/vmm.h>
 
 struct idt_entry {
     uint16_t offset_low;
@@ -88,7 +89,6 @@ DEFINE_ISR_ERR(10)
 DEFINE_ISR_ERR(11)
 DEFINE_ISR_ERR(12)
 DEFINE_ISR_ERR(13)
-DEFINE_ISR_ERR(14)
 DEFINE_ISR_NOERR(15)
 DEFINE_ISR_NOERR(16)
 DEFINE_ISR_ERR(17)
@@ -107,21 +107,75 @@ DEFINE_ISR_ERR(29)
 DEFINE_ISR_ERR(30)
 DEFINE_ISR_NOERR(31)
 
-__attribute__((interrupt)) static void irq_timer(struct interrupt_frame *frame) {
+/* Page faults in lazy regions are demand-filled; everything else is fatal. */
+__attribute__((interrupt)) static void isr_14(struct interrupt_frame *frame, uint64_t error_code) {
     (void)frame;
-    pit_on_tick();
-    pic_send_eoi(0);
+    if (!vmm_handle_fault(read_cr2(), error_code)) {
+        panic_exception(14, error_code, 1);
+    }
 }
 
-__attribute__((interrupt)) static void irq_keyboard(struct interrupt_frame *frame) {
+/* Hardware lines enter irq_dispatch() with their line number; it runs handlers and EOIs. */
+#define DEFINE_IRQ(n) \
+    __attribute__((interrupt)) static void irq_##n(struct interrupt_frame *frame) { \
+        (void)frame; \
+        irq_dispatch((n)); \
+    }
+
+DEFINE_IRQ(0)
+DEFINE_IRQ(1)
+DEFINE_IRQ(2)
+DEFINE_IRQ(3)
+DEFINE_IRQ(4)
+DEFINE_IRQ(5)
+DEFINE_IRQ(6)
+DEFINE_IRQ(7)
+DEFINE_IRQ(8)
+DEFINE_IRQ(9)
+DEFINE_IRQ(10)
+DEFINE_IRQ(11)
+DEFINE_IRQ(12)
+DEFINE_IRQ(13)
+DEFINE_IRQ(14)
+DEFINE_IRQ(15)
+DEFINE_IRQ(16)
+DEFINE_IRQ(17)
+DEFINE_IRQ(18)
+DEFINE_IRQ(19)
+DEFINE_IRQ(20)
+DEFINE_IRQ(21)
+DEFINE_IRQ(22)
+DEFINE_IRQ(23)
+
+static void (*const irq_stubs[IRQ_LINES])(struct interrupt_frame *) = {
+    irq_0, irq_1, irq_2, irq_3, irq_4, irq_5, irq_6, irq_7,
+    irq_8, irq_9, irq_10, irq_11, irq_12, irq_13, irq_14, irq_15,
+    irq_16, irq_17, irq_18, irq_19, irq_20, irq_21, irq_22, irq_23,
+};
+
+__attribute__((interrupt)) static void irq_default(struct interrupt_frame *frame) {
     (void)frame;
-    keyboard_on_irq();
-    pic_send_eoi(1);
+    irq_eoi(7);
 }
 
-__attribute__((interrupt)) static void irq_default(struct interrupt_frame *frame) {
+/* The local APIC does not set an in-service bit for spurious vectors: no EOI. */
+__attribute__((interrupt)) static void irq_spurious(struct interrupt_frame *frame) {
     (void)frame;
-    pic_send_eoi(7);
+    irq_note_spurious_vector();
+}
+
+/* Reschedule/steal kick from another CPU; the work happens on the way out. */
+__attribute__((interrupt)) static void irq_sched_ipi(struct interrupt_frame *frame) {
+    (void)frame;
+    lapic_eoi();
+    sched_irq_exit();
+}
+
+/* Another CPU changed kernel mappings and waits for this one to drop them. */
+__attribute__((interrupt)) static void irq_tlb_shootdown(struct interrupt_frame *frame) {
+    (void)frame;
+    vmm_shootdown_irq();
+    lapic_eoi();
 }
 
 void idt_init(void) {
@@ -164,9 +218,18 @@ void idt_init(void) {
     idt_set_gate(30, isr_30, 0x8E);
     idt_set_gate(31, isr_31, 0x8E);
 
-    idt_set_gate(32, irq_timer, 0x8E);
-    idt_set_gate(33, irq_keyboard, 0x8E);
+    for (uint8_t line = 0; line < IRQ_LINES; line++) {
+        idt_set_gate((uint8_t)(IRQ_VECTOR_BASE + line), (void *)irq_stubs[line], 0x8E);
+    }
+    idt_set_gate(SCHED_IPI_VECTOR, irq_sched_ipi, 0x8E);
+    idt_set_gate(VMM_SHOOTDOWN_VECTOR, irq_tlb_shootdown, 0x8E);
+    idt_set_gate(APIC_SPURIOUS_VECTOR, irq_spurious, 0x8E);
+
+    idt_load();
+}
 
+/* Every CPU shares the one table. */
+void idt_load(void) {
     struct idtr idtr = {
         .limit = (uint16_t)(sizeof(idt) - 1),
         .base = (uint64_t)(uintptr_t)idt,
@@ -0,0 +1,267 @@
+#include <kernel/acpi.h>
+#include <kernel/multiboot2.h>
+#include <kernel/string.h>
+#include <kernel/vmm.h>
+
+#define RSDP_SCAN_START 0xE0000ULL
+#define RSDP_SCAN_END   0x100000ULL
+#define EBDA_SEGMENT_PTR 0x40EULL
+
+#define MADT_PCAT_COMPAT (1U << 0)
+#define MADT_LAPIC_ENABLED (1U << 0)
+#define MADT_LAPIC_ONLINE_CAPABLE (1U << 1)
+
+#define MADT_TYPE_LAPIC 0
+#define MADT_TYPE_IOAPIC 1
+#define MADT_TYPE_OVERRIDE 2
+#define MADT_TYPE_LAPIC_ADDRESS 5
+#define MADT_TYPE_X2APIC 9
+
+typedef struct {
+    char signature[8];
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision;
+    uint32_t rsdt_address;
+    uint32_t length;
+    uint64_t xsdt_address;
+    uint8_t extended_checksum;
+    uint8_t reserved[3];
+} __attribute__((packed)) acpi_rsdp_t;
+
+typedef struct {
+    char signature[4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed)) acpi_sdt_header_t;
+
+typedef struct {
+    acpi_sdt_header_t header;
+    uint32_t lapic_address;
+    uint32_t flags;
+} __attribute__((packed)) acpi_madt_t;
+
+typedef struct {
+    uint8_t type;
+    uint8_t length;
+} __attribute__((packed)) madt_entry_t;
+
+static const acpi_sdt_header_t *root_table = 0;
+static bool root_is_xsdt = false;
+static acpi_madt_info_t madt_info;
+
+/*
+ * Tables usually sit inside the direct map; firmware that parks them in
+ * reserved memory, which the direct map leaves out, gets a window instead.
+ */
+static const void *map_phys(uint64_t phys_addr, uint64_t size) {
+    if (vmm_is_direct_mapped(phys_addr, size)) {
+        return vmm_phys_to_virt(phys_addr);
+    }
+    return (const void *)(uintptr_t)vmm_map_mmio(phys_addr, size, VMM_FLAG_NX);
+}
+
+static bool checksum_ok(const void *data, uint64_t size) {
+    const uint8_t *bytes = data;
+    uint8_t sum = 0;
+
+    for (uint64_t i = 0; i < size; i++) {
+        sum = (uint8_t)(sum + bytes[i]);
+    }
+    return sum == 0;
+}
+
+static const acpi_sdt_header_t *map_table(uint64_t phys_addr) {
+    const acpi_sdt_header_t *header = map_phys(phys_addr, sizeof(*header));
+
+    if (!header || header->length < sizeof(*header)) {
+        return 0;
+    }
+    header = map_phys(phys_addr, header->length);
+    if (!header || !checksum_ok(header, header->length)) {
+        return 0;
+    }
+    return header;
+}
+
+static const acpi_rsdp_t *rsdp_valid(const acpi_rsdp_t *rsdp) {
+    if (memcmp(rsdp->signature, "RSD PTR ", 8) != 0 || !checksum_ok(rsdp, 20)) {
+        return 0;
+    }
+    if (rsdp->revision >= 2 &&
+        (rsdp->length < sizeof(acpi_rsdp_t) || !checksum_ok(rsdp, rsdp->length))) {
+        return 0;
+    }
+    return rsdp;
+}
+
+static const acpi_rsdp_t *scan_rsdp(uint64_t start, uint64_t end) {
+    for (uint64_t phys = start; phys + sizeof(acpi_rsdp_t) <= end; phys += 16) {
+        const acpi_rsdp_t *rsdp = rsdp_valid(vmm_phys_to_virt(phys));
+        if (rsdp) {
+            return rsdp;
+        }
+    }
+    return 0;
+}
+
+static const acpi_rsdp_t *find_rsdp(uint32_t multiboot_info_addr) {
+    const acpi_rsdp_t *rsdp_v1 = 0;
+    uint64_t ebda;
+
+    if (multiboot_info_addr != 0) {
+        uint8_t *mb = (uint8_t *)vmm_phys_to_virt(multiboot_info_addr);
+        uint32_t mb_total_size = *(uint32_t *)mb;
+        struct multiboot_tag *tag = (struct multiboot_tag *)(mb + 8);
+
+        while ((uint8_t *)tag < (mb + mb_total_size) && tag->type != MULTIBOOT_TAG_TYPE_END) {
+            if (tag->size < sizeof(struct multiboot_tag)) {
+                break;
+            }
+            if ((tag->type == MULTIBOOT_TAG_TYPE_ACPI_NEW || tag->type == MULTIBOOT_TAG_TYPE_ACPI_OLD) &&
+                tag->size >= sizeof(struct multiboot_tag) + 20) {
+                const acpi_rsdp_t *rsdp = rsdp_valid((const acpi_rsdp_t *)((struct multiboot_tag_acpi *)tag)->rsdp);
+                if (rsdp && tag->type == MULTIBOOT_TAG_TYPE_ACPI_NEW) {
+                    return rsdp;
+                }
+                if (rsdp) {
+                    rsdp_v1 = rsdp;
+                }
+            }
+            tag = (struct multiboot_tag *)((uint8_t *)tag + ((tag->size + 7U) & ~7U));
+        }
+        if (rsdp_v1) {
+            return rsdp_v1;
+        }
+    }
+
+    /* Legacy BIOS locations: first KiB of the EBDA, then the BIOS ROM area. */
+    ebda = (uint64_t)*(volatile uint16_t *)vmm_phys_to_virt(EBDA_SEGMENT_PTR) << 4;
+    if (ebda >= 0x80000ULL && ebda < RSDP_SCAN_START) {
+        const acpi_rsdp_t *rsdp = scan_rsdp(ebda, ebda + 1024);
+        if (rsdp) {
+            return rsdp;
+        }
+    }
+    return scan_rsdp(RSDP_SCAN_START, RSDP_SCAN_END);
+}
+
+static void parse_madt(const acpi_madt_t *madt) {
+    const uint8_t *entry = (const uint8_t *)(madt + 1);
+    const uint8_t *end = (const uint8_t *)madt + madt->header.length;
+
+    madt_info.present = true;
+    madt_info.has_8259 = (madt->flags & MADT_PCAT_COMPAT) != 0;
+    madt_info.lapic_addr = madt->lapic_address;
+
+    while (entry + sizeof(madt_entry_t) <= end) {
+        const madt_entry_t *header = (const madt_entry_t *)entry;
+        if (header->length < sizeof(madt_entry_t) || entry + header->length > end) {
+            break;
+        }
+
+        switch (header->type) {
+        case MADT_TYPE_LAPIC:
+            if (header->length >= 8) {
+                uint32_t flags = *(const uint32_t *)(entry + 4);
+                if ((flags & (MADT_LAPIC_ENABLED | MADT_LAPIC_ONLINE_CAPABLE)) != 0 &&
+                    madt_info.cpu_count < ACPI_MAX_CPUS) {
+                    madt_info.cpu_apic_ids[madt_info.cpu_count++] = entry[3];
+                }
+            }
+            break;
+        case MADT_TYPE_X2APIC:
+            if (header->length >= 16) {
+                uint32_t apic_id = *(const uint32_t *)(entry + 4);
+                uint32_t flags = *(const uint32_t *)(entry + 8);
+                if ((flags & (MADT_LAPIC_ENABLED | MADT_LAPIC_ONLINE_CAPABLE)) != 0 &&
+                    madt_info.cpu_count < ACPI_MAX_CPUS) {
+                    madt_info.cpu_apic_ids[madt_info.cpu_count++] = apic_id;
+                }
+            }
+            break;
+        case MADT_TYPE_IOAPIC:
+            if (header->length >= 12 && madt_info.ioapic_count < ACPI_MAX_IOAPICS) {
+                acpi_ioapic_t *ioapic = &madt_info.ioapics[madt_info.ioapic_count++];
+                ioapic->id = entry[2];
+                ioapic->address = *(const uint32_t *)(entry + 4);
+                ioapic->gsi_base = *(const uint32_t *)(entry + 8);
+            }
+            break;
+        case MADT_TYPE_OVERRIDE:
+            if (header->length >= 10 && madt_info.override_count < ACPI_MAX_OVERRIDES) {
+                acpi_irq_override_t *iso = &madt_info.overrides[madt_info.override_count++];
+                iso->source_irq = entry[3];
+                iso->gsi = *(const uint32_t *)(entry + 4);
+                iso->flags = *(const uint16_t *)(entry + 8);
+            }
+            break;
+        case MADT_TYPE_LAPIC_ADDRESS:
+            if (header->length >= 12) {
+                madt_info.lapic_addr = *(const uint64_t *)(entry + 4);
+            }
+            break;
+        default:
+            break;
+        }
+        entry += header->length;
+    }
+}
+
+/* Locate the RSDP and root table, then cache the MADT. False without ACPI. */
+bool acpi_init(uint32_t multiboot_info_addr) {
+    const acpi_rsdp_t *rsdp = find_rsdp(multiboot_info_addr);
+    const acpi_madt_t *madt;
+
+    memset(&madt_info, 0, sizeof(madt_info));
+    root_table = 0;
+    if (!rsdp) {
+        return false;
+    }
+
+    root_is_xsdt = rsdp->revision >= 2 && rsdp->xsdt_address != 0;
+    root_table = map_table(root_is_xsdt ? rsdp->xsdt_address : rsdp->rsdt_address);
+    if (!root_table) {
+        return false;
+    }
+
+    madt = acpi_find_table("APIC");
+    if (madt && madt->header.length >= sizeof(*madt)) {
+        parse_madt(madt);
+    }
+    return true;
+}
+
+const void *acpi_find_table(const char *signature) {
+    uint32_t entry_size;
+    uint32_t count;
+    const uint8_t *entries;
+
+    if (!root_table) {
+        return 0;
+    }
+
+    entry_size = root_is_xsdt ? 8U : 4U;
+    count = (root_table->length - (uint32_t)sizeof(acpi_sdt_header_t)) / entry_size;
+    entries = (const uint8_t *)(root_table + 1);
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint64_t phys = root_is_xsdt ? *(const uint64_t *)(entries + i * 8U)
+                                     : *(const uint32_t *)(entries + i * 4U);
+        const acpi_sdt_header_t *header = map_phys(phys, sizeof(*header));
+        if (header && memcmp(header->signature, signature, 4) == 0) {
+            return map_table(phys);
+        }
+    }
+    return 0;
+}
+
+const acpi_madt_info_t *acpi_madt(void) {
+    return madt_info.present ? &madt_info : 0;
+}
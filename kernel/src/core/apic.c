@@ -0,0 +1,308 @@
+#include <kernel/acpi.h>
+#include <kernel/apic.h>
+#include <kernel/io.h>
+#include <kernel/vmm.h>
+
+#define MSR_APIC_BASE 0x1BU
+#define APIC_BASE_ENABLE (1ULL << 11)
+#define APIC_BASE_X2APIC (1ULL << 10)
+#define APIC_BASE_ADDR_MASK 0x000FFFFFFFFFF000ULL
+#define MSR_X2APIC_BASE 0x800U
+
+#define LAPIC_ID 0x020U
+#define LAPIC_TPR 0x080U
+#define LAPIC_EOI 0x0B0U
+#define LAPIC_SVR 0x0F0U
+#define LAPIC_LVT_TIMER 0x320U
+#define LAPIC_LVT_LINT0 0x350U
+#define LAPIC_LVT_LINT1 0x360U
+#define LAPIC_LVT_ERROR 0x370U
+#define LAPIC_ESR 0x280U
+#define LAPIC_ICR_LOW 0x300U
+#define LAPIC_ICR_HIGH 0x310U
+#define LAPIC_TIMER_INITIAL 0x380U
+#define LAPIC_TIMER_CURRENT 0x390U
+#define LAPIC_TIMER_DIVIDE 0x3E0U
+
+#define LAPIC_TIMER_DIV16 0x3U
+#define LAPIC_LVT_TSC_DEADLINE (2U << 17)
+#define MSR_TSC_DEADLINE 0x6E0U
+
+#define LAPIC_SVR_ENABLE (1U << 8)
+#define LAPIC_LVT_MASKED (1U << 16)
+#define LAPIC_LVT_NMI (4U << 8)
+#define LAPIC_ICR_PENDING (1U << 12)
+#define MSR_X2APIC_ICR 0x830U
+
+#define IOAPIC_REGSEL 0x00U
+#define IOAPIC_WINDOW 0x10U
+#define IOAPIC_REG_VERSION 0x01U
+#define IOAPIC_REG_REDIR 0x10U
+
+#define IOAPIC_REDIR_ACTIVE_LOW (1ULL << 13)
+#define IOAPIC_REDIR_LEVEL (1ULL << 15)
+#define IOAPIC_REDIR_MASKED (1ULL << 16)
+
+#define APIC_MMIO_FLAGS (VMM_FLAG_WRITABLE | VMM_FLAG_NX | VMM_CACHE_UC)
+
+typedef struct {
+    volatile uint32_t *regs;
+    uint32_t gsi_base;
+    uint32_t gsi_count;
+} ioapic_t;
+
+static bool apic_active = false;
+static bool x2apic_mode = false;
+static volatile uint32_t *lapic_regs = 0;
+static ioapic_t ioapics[ACPI_MAX_IOAPICS];
+static uint32_t ioapic_count = 0;
+
+/* xAPIC registers are 16-byte aligned MMIO; x2APIC maps them to MSRs. */
+static uint32_t lapic_read(uint32_t reg) {
+    if (x2apic_mode) {
+        return (uint32_t)rdmsr(MSR_X2APIC_BASE + (reg >> 4));
+    }
+    return lapic_regs[reg / 4];
+}
+
+static void lapic_write(uint32_t reg, uint32_t value) {
+    if (x2apic_mode) {
+        wrmsr(MSR_X2APIC_BASE + (reg >> 4), value);
+        return;
+    }
+    lapic_regs[reg / 4] = value;
+}
+
+static uint32_t ioapic_read(const ioapic_t *ioapic, uint32_t reg) {
+    ioapic->regs[IOAPIC_REGSEL / 4] = reg;
+    return ioapic->regs[IOAPIC_WINDOW / 4];
+}
+
+static void ioapic_write(const ioapic_t *ioapic, uint32_t reg, uint32_t value) {
+    ioapic->regs[IOAPIC_REGSEL / 4] = reg;
+    ioapic->regs[IOAPIC_WINDOW / 4] = value;
+}
+
+static void ioapic_write_redir(const ioapic_t *ioapic, uint32_t pin, uint64_t entry) {
+    /* Mask first so the pin never fires with a half-written entry. */
+    ioapic_write(ioapic, IOAPIC_REG_REDIR + pin * 2, (uint32_t)IOAPIC_REDIR_MASKED);
+    ioapic_write(ioapic, IOAPIC_REG_REDIR + pin * 2 + 1, (uint32_t)(entry >> 32));
+    ioapic_write(ioapic, IOAPIC_REG_REDIR + pin * 2, (uint32_t)entry);
+}
+
+static ioapic_t *ioapic_for_gsi(uint32_t gsi) {
+    for (uint32_t i = 0; i < ioapic_count; i++) {
+        if (gsi >= ioapics[i].gsi_base && gsi - ioapics[i].gsi_base < ioapics[i].gsi_count) {
+            return &ioapics[i];
+        }
+    }
+    return 0;
+}
+
+/* ISA IRQs are identity-mapped to GSIs, edge/active-high, unless the MADT overrides them. */
+static uint32_t isa_irq_to_gsi(uint8_t isa_irq, uint16_t *out_flags) {
+    const acpi_madt_info_t *madt = acpi_madt();
+
+    *out_flags = 0;
+    for (uint32_t i = 0; madt && i < madt->override_count; i++) {
+        if (madt->overrides[i].source_irq == isa_irq) {
+            *out_flags = madt->overrides[i].flags;
+            return madt->overrides[i].gsi;
+        }
+    }
+    return isa_irq;
+}
+
+/* Per-CPU half of LAPIC setup; every CPU runs it on its own local APIC. */
+static void lapic_enable_local(void) {
+    uint64_t base = rdmsr(MSR_APIC_BASE) | APIC_BASE_ENABLE;
+
+    if (x2apic_mode) {
+        base |= APIC_BASE_X2APIC;
+    }
+    wrmsr(MSR_APIC_BASE, base);
+
+    /* Accept every priority, mask the legacy wire inputs except NMI, then enable. */
+    lapic_write(LAPIC_TPR, 0);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_LVT_LINT0, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_LVT_LINT1, LAPIC_LVT_NMI);
+    lapic_write(LAPIC_LVT_ERROR, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_ESR, 0);
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | APIC_SPURIOUS_VECTOR);
+    lapic_write(LAPIC_EOI, 0);
+}
+
+static void lapic_init(uint64_t phys_addr) {
+    uint32_t a;
+    uint32_t b;
+    uint32_t c;
+    uint32_t d;
+
+    cpuid(1, 0, &a, &b, &c, &d);
+    x2apic_mode = (c & (1U << 21)) != 0;
+
+    if (!x2apic_mode) {
+        if (phys_addr == 0) {
+            phys_addr = rdmsr(MSR_APIC_BASE) & APIC_BASE_ADDR_MASK;
+        }
+        lapic_regs = (volatile uint32_t *)(uintptr_t)vmm_map_mmio(phys_addr, 0x1000, APIC_MMIO_FLAGS);
+        if (!lapic_regs) {
+            return;
+        }
+    }
+    lapic_enable_local();
+}
+
+/*
+ * Bring up the boot CPU's local APIC and every IOAPIC from the MADT, with
+ * all IOAPIC pins masked. False (and nothing touched) when there is no
+ * MADT, so the caller can stay on the 8259.
+ */
+bool apic_init(void) {
+    const acpi_madt_info_t *madt = acpi_madt();
+
+    if (!madt || madt->ioapic_count == 0) {
+        return false;
+    }
+
+    ioapic_count = 0;
+    for (uint32_t i = 0; i < madt->ioapic_count; i++) {
+        ioapic_t *ioapic = &ioapics[ioapic_count];
+        ioapic->regs = (volatile uint32_t *)(uintptr_t)vmm_map_mmio(madt->ioapics[i].address, 0x1000,
+                                                                       APIC_MMIO_FLAGS);
+        if (!ioapic->regs) {
+            continue;
+        }
+        ioapic->gsi_base = madt->ioapics[i].gsi_base;
+        ioapic->gsi_count = ((ioapic_read(ioapic, IOAPIC_REG_VERSION) >> 16) & 0xFFU) + 1;
+        for (uint32_t pin = 0; pin < ioapic->gsi_count; pin++) {
+            ioapic_write_redir(ioapic, pin, IOAPIC_REDIR_MASKED);
+        }
+        ioapic_count++;
+    }
+    if (ioapic_count == 0) {
+        return false;
+    }
+
+    lapic_init(madt->lapic_addr);
+    if (!x2apic_mode && !lapic_regs) {
+        return false;
+    }
+
+    apic_active = true;
+    return true;
+}
+
+/* Application processors reuse the boot CPU's mode and mapping. */
+void apic_init_ap(void) {
+    if (apic_active) {
+        lapic_enable_local();
+    }
+}
+
+bool apic_enabled(void) {
+    return apic_active;
+}
+
+bool apic_x2apic(void) {
+    return apic_active && x2apic_mode;
+}
+
+uint32_t lapic_id(void) {
+    uint32_t id = lapic_read(LAPIC_ID);
+    return x2apic_mode ? id : (id >> 24);
+}
+
+void lapic_eoi(void) {
+    lapic_write(LAPIC_EOI, 0);
+}
+
+/* Send an IPI (ICR low word: vector, delivery mode, level) and wait for delivery. */
+void lapic_send_ipi(uint32_t dest_apic_id, uint32_t icr_low) {
+    if (x2apic_mode) {
+        wrmsr(MSR_X2APIC_ICR, ((uint64_t)dest_apic_id << 32) | icr_low);
+        return;
+    }
+    lapic_write(LAPIC_ICR_HIGH, dest_apic_id << 24);
+    lapic_write(LAPIC_ICR_LOW, icr_low);
+    while (lapic_read(LAPIC_ICR_LOW) & LAPIC_ICR_PENDING) {
+        __asm__ volatile ("pause");
+    }
+}
+
+/* Deliver an ISA IRQ as `vector` to the CPU whose APIC ID is dest_apic_id. */
+bool ioapic_route_irq(uint8_t isa_irq, uint8_t vector, uint32_t dest_apic_id) {
+    uint16_t flags;
+    uint32_t gsi = isa_irq_to_gsi(isa_irq, &flags);
+    ioapic_t *ioapic = ioapic_for_gsi(gsi);
+    uint64_t entry = vector;
+
+    if (!apic_active || !ioapic || vector < 0x20 || dest_apic_id > 0xFF) {
+        return false;
+    }
+
+    if ((flags & ACPI_POLARITY_MASK) == ACPI_POLARITY_LOW) {
+        entry |= IOAPIC_REDIR_ACTIVE_LOW;
+    }
+    if ((flags & ACPI_TRIGGER_MASK) == ACPI_TRIGGER_LEVEL) {
+        entry |= IOAPIC_REDIR_LEVEL;
+    }
+    /* Fixed delivery, physical destination mode. */
+    entry |= (uint64_t)dest_apic_id << 56;
+
+    ioapic_write_redir(ioapic, gsi - ioapic->gsi_base, entry);
+    return true;
+}
+
+bool ioapic_mask_irq(uint8_t isa_irq) {
+    uint16_t flags;
+    uint32_t gsi = isa_irq_to_gsi(isa_irq, &flags);
+    ioapic_t *ioapic = ioapic_for_gsi(gsi);
+
+    if (!apic_active || !ioapic) {
+        return false;
+    }
+    ioapic_write_redir(ioapic, gsi - ioapic->gsi_base, IOAPIC_REDIR_MASKED);
+    return true;
+}
+
+bool lapic_has_tsc_deadline(void) {
+    uint32_t a;
+    uint32_t b;
+    uint32_t c;
+    uint32_t d;
+
+    cpuid(1, 0, &a, &b, &c, &d);
+    return apic_active && (c & (1U << 24)) != 0;
+}
+
+/*
+ * Unmask the LAPIC timer on `vector`, in one-shot mode (divide by 16) or
+ * TSC-deadline mode. It stays idle until the first oneshot/deadline write.
+ */
+void lapic_timer_setup(uint8_t vector, bool tsc_deadline) {
+    lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIV16);
+    lapic_write(LAPIC_LVT_TIMER, vector | (tsc_deadline ? LAPIC_LVT_TSC_DEADLINE : 0));
+}
+
+/* Counts down at the bus clock / 16; also usable masked, for calibration. */
+void lapic_timer_oneshot(uint32_t count) {
+    lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIV16);
+    lapic_write(LAPIC_TIMER_INITIAL, count);
+}
+
+uint32_t lapic_timer_current(void) {
+    return lapic_read(LAPIC_TIMER_CURRENT);
+}
+
+void lapic_timer_deadline(uint64_t tsc) {
+    wrmsr(MSR_TSC_DEADLINE, tsc);
+}
+
+void lapic_timer_stop(void) {
+    lapic_write(LAPIC_TIMER_INITIAL, 0);
+    if (lapic_read(LAPIC_LVT_TIMER) & LAPIC_LVT_TSC_DEADLINE) {
+        wrmsr(MSR_TSC_DEADLINE, 0);
+    }
+}
@@ -0,0 +1,169 @@
+#include <kernel/acpi.h>
+#include <kernel/clock.h>
+#include <kernel/io.h>
+#include <kernel/pit.h>
+#include <kernel/vmm.h>
+
+#define NS_PER_SEC 1000000000ULL
+#define FS_PER_NS 1000000ULL
+/* Fixed-point shift for the cycles<->ns multipliers; products use 128 bits. */
+#define CLOCK_SHIFT 32U
+
+#define CALIBRATE_MS 10U
+#define CALIBRATE_PIT_COUNT (PIT_FREQUENCY_HZ / (1000U / CALIBRATE_MS))
+
+#define HPET_GAS_ADDRESS_OFFSET 44U
+#define HPET_REG_CAPS 0x000U
+#define HPET_REG_CONFIG 0x010U
+#define HPET_REG_COUNTER 0x0F0U
+#define HPET_CONFIG_ENABLE (1ULL << 0)
+#define HPET_CAPS_64BIT (1ULL << 13)
+/* The spec caps the counter period at 100 ns. */
+#define HPET_MAX_PERIOD_FS 100000000ULL
+
+static clock_info_t info;
+static volatile uint64_t *hpet_regs = 0;
+static uint64_t base_count = 0;
+static uint64_t source_mult = 0;
+static uint64_t tsc_mult = 0;
+static uint64_t tsc_inv_mult = 0;
+
+static uint64_t hpet_read(uint32_t reg) {
+    return hpet_regs[reg / 8];
+}
+
+static bool hpet_init(void) {
+    const uint8_t *table = acpi_find_table("HPET");
+    uint64_t phys;
+    uint64_t period_fs;
+
+    if (!table || *(const uint32_t *)(table + 4) < HPET_GAS_ADDRESS_OFFSET + 8) {
+        return false;
+    }
+    phys = *(const uint64_t *)(table + HPET_GAS_ADDRESS_OFFSET);
+    hpet_regs = (volatile uint64_t *)(uintptr_t)vmm_map_mmio(phys, 0x400,
+                                                              VMM_FLAG_WRITABLE | VMM_FLAG_NX | VMM_CACHE_UC);
+    if (!hpet_regs) {
+        return false;
+    }
+
+    /* A 32-bit main counter wraps within minutes; not worth the bookkeeping. */
+    period_fs = hpet_read(HPET_REG_CAPS) >> 32;
+    if (period_fs == 0 || period_fs > HPET_MAX_PERIOD_FS || (hpet_read(HPET_REG_CAPS) & HPET_CAPS_64BIT) == 0) {
+        hpet_regs = 0;
+        return false;
+    }
+    hpet_regs[HPET_REG_CONFIG / 8] = hpet_read(HPET_REG_CONFIG) | HPET_CONFIG_ENABLE;
+    info.source_hz = (NS_PER_SEC * FS_PER_NS) / period_fs;
+    return true;
+}
+
+/* TSC cycles over CALIBRATE_MS, timed by the HPET when present, else PIT channel 2. */
+static uint64_t calibrate_tsc(void) {
+    uint64_t tsc_start;
+    uint64_t tsc_end;
+
+    if (hpet_regs) {
+        uint64_t period_fs = hpet_read(HPET_REG_CAPS) >> 32;
+        uint64_t target = (CALIBRATE_MS * 1000000ULL * FS_PER_NS) / period_fs;
+        uint64_t start = hpet_read(HPET_REG_COUNTER);
+        uint64_t elapsed_ns;
+        uint64_t now;
+
+        tsc_start = rdtsc();
+        do {
+            now = hpet_read(HPET_REG_COUNTER);
+        } while (now - start < target);
+        tsc_end = rdtsc();
+
+        elapsed_ns = ((now - start) * period_fs) / FS_PER_NS;
+        info.calibrated_by_hpet = true;
+        return ((tsc_end - tsc_start) * NS_PER_SEC) / (elapsed_ns ? elapsed_ns : 1);
+    }
+
+    pit_delay_start((uint16_t)CALIBRATE_PIT_COUNT);
+    tsc_start = rdtsc();
+    while (!pit_delay_done()) {
+    }
+    tsc_end = rdtsc();
+    return (tsc_end - tsc_start) * (1000U / CALIBRATE_MS);
+}
+
+/*
+ * (to_hz << CLOCK_SHIFT) / from_hz without a 128-bit division. The remainder
+ * stays below from_hz, and every caller has one side at 1 GHz, so the shift fits.
+ */
+static uint64_t mult_for(uint64_t from_hz, uint64_t to_hz) {
+    return ((to_hz / from_hz) << CLOCK_SHIFT) + ((to_hz % from_hz) << CLOCK_SHIFT) / from_hz;
+}
+
+static inline uint64_t scale(uint64_t value, uint64_t mult) {
+    return (uint64_t)(((unsigned __int128)value * mult) >> CLOCK_SHIFT);
+}
+
+static uint64_t read_source(void) {
+    return (info.source == CLOCK_SOURCE_HPET) ? hpet_read(HPET_REG_COUNTER) : rdtsc();
+}
+
+/*
+ * Calibrate the TSC and choose the monotonic source: the TSC when it is
+ * invariant, the HPET main counter when the TSC may drift with P-states,
+ * and the TSC anyway when there is nothing better. Needs acpi_init().
+ */
+void clock_init(void) {
+    uint32_t a;
+    uint32_t b;
+    uint32_t c;
+    uint32_t d;
+    bool have_hpet = hpet_init();
+
+    cpuid(0x80000000U, 0, &a, &b, &c, &d);
+    if (a >= 0x80000007U) {
+        cpuid(0x80000007U, 0, &a, &b, &c, &d);
+        info.tsc_invariant = (d & (1U << 8)) != 0;
+    }
+
+    info.tsc_hz = calibrate_tsc();
+    if (info.tsc_hz == 0) {
+        info.tsc_hz = 1;
+    }
+    tsc_mult = mult_for(info.tsc_hz, NS_PER_SEC);
+    tsc_inv_mult = mult_for(NS_PER_SEC, info.tsc_hz);
+
+    if (!info.tsc_invariant && have_hpet) {
+        info.source = CLOCK_SOURCE_HPET;
+    } else {
+        info.source = CLOCK_SOURCE_TSC;
+        info.source_hz = info.tsc_hz;
+    }
+    source_mult = mult_for(info.source_hz, NS_PER_SEC);
+    base_count = read_source();
+}
+
+/* Nanoseconds since clock_init(). */
+uint64_t clock_monotonic_ns(void) {
+    if (source_mult == 0) {
+        return 0;
+    }
+    return scale(read_source() - base_count, source_mult);
+}
+
+uint64_t clock_cycles_to_ns(uint64_t cycles) {
+    return scale(cycles, tsc_mult);
+}
+
+uint64_t clock_ns_to_cycles(uint64_t ns) {
+    return scale(ns, tsc_inv_mult);
+}
+
+uint64_t clock_tsc_hz(void) {
+    return info.tsc_hz;
+}
+
+void clock_info(clock_info_t *out) {
+    *out = info;
+}
+
+const char *clock_source_name(clock_source_t source) {
+    return (source == CLOCK_SOURCE_HPET) ? "hpet" : "tsc";
+}
@@ -3,12 +3,13 @@
 #include <kernel/io.h>
 #include <kernel/string.h>
 #include <kernel/video.h>
+#include <kernel/vmm.h>
 
 #include <stdbool.h>
 
 #define VGA_WIDTH 80
 #define VGA_HEIGHT 25
-#define VGA_MEMORY ((volatile uint16_t *)0xB8000)
+#define VGA_MEMORY ((volatile uint16_t *)vmm_phys_to_virt(0xB8000))
 
 #define FB_MAX_COLS 160
 #define FB_MAX_ROWS 100
@@ -177,6 +178,18 @@ static void fb_redraw_full(void) {
     }
 }
 
+uint64_t console_redraw_cycles(void) {
+    uint64_t start;
+
+    if (g_backend != CONSOLE_BACKEND_FB) {
+        return 0;
+    }
+
+    start = rdtsc();
+    fb_redraw_full();
+    return rdtsc() - start;
+}
+
 static void backend_put_cell(size_t row, size_t col, char c, uint8_t color) {
     if (row >= term_rows || col >= term_cols) {
         return;
@@ -615,7 +628,7 @@ bool console_enable_framebuffer(void) {
         return false;
     }
 
-    fb_memory = (volatile uint32_t *)(uintptr_t)fb->phys_addr;
+    fb_memory = (volatile uint32_t *)(uintptr_t)fb->virt_addr;
     fb_width = fb->width;
     fb_height = fb->height;
     fb_pitch_pixels = fb->pitch / 4;
@@ -738,20 +751,39 @@ void console_write_hex(uint64_t value) {
     }
 }
 
-void console_write_dec(uint64_t value) {
-    if (value == 0) {
-        console_putc('0');
-        return;
-    }
-
-    char buf[21];
+static size_t format_dec(uint64_t value, char *buf) {
     size_t i = 0;
-    while (value > 0 && i < sizeof(buf)) {
+
+    do {
         buf[i++] = (char)('0' + (value % 10));
         value /= 10;
-    }
+    } while (value > 0);
+    return i;
+}
+
+void console_write_dec(uint64_t value) {
+    char buf[21];
+    size_t i = format_dec(value, buf);
 
     while (i > 0) {
         console_putc(buf[--i]);
     }
 }
+
+void console_serial_write(const char *s) {
+    for (size_t i = 0; s[i] != '\0'; i++) {
+        if (s[i] == '\n') {
+            serial_write_char('\r');
+        }
+        serial_write_char(s[i]);
+    }
+}
+
+void console_serial_write_dec(uint64_t value) {
+    char buf[21];
+    size_t i = format_dec(value, buf);
+
+    while (i > 0) {
+        serial_write_char(buf[--i]);
+    }
+}
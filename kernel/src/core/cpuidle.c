@@ -0,0 +1,189 @@
+#include <kernel/clock.h>
+#include <kernel/cpuidle.h>
+#include <kernel/io.h>
+#include <kernel/smp.h>
+
+#define CPUID1_ECX_MONITOR (1U << 3)
+#define CPUID5_ECX_EXTENSIONS (1U << 0)
+#define CPUID5_ECX_IRQ_BREAK (1U << 1)
+/* MWAIT ECX bit 0: a pending interrupt ends the wait even with IF=0. */
+#define MWAIT_ECX_IRQ_BREAK 1U
+
+/*
+ * One line per CPU. MONITOR watches `kick_tsc`, so the store a remote
+ * kick makes ends MWAIT on its own; the IPI that follows is serviced once
+ * the idle loop re-enables interrupts.
+ */
+typedef struct {
+    volatile uint64_t kick_tsc;
+    volatile bool idle;
+    uint64_t entries[CPUIDLE_MAX_STATES];
+    uint64_t residency[CPUIDLE_MAX_STATES];
+    uint64_t timed_wakeups;
+    uint64_t latency_sum;
+    uint64_t latency_max;
+} __attribute__((aligned(64))) idle_cpu_t;
+
+static const char *const cstate_names[CPUIDLE_MAX_STATES] = {
+    "HLT", "C1", "C2", "C3", "C4", "C5", "C6", "C7",
+};
+
+static cpuidle_state_t states[CPUIDLE_MAX_STATES];
+static unsigned int state_count = 0;
+static volatile unsigned int selected = 0;
+static idle_cpu_t idle_cpus[SMP_MAX_CPUS];
+
+/* Boot CPU; the APs are assumed to report the same MWAIT support. */
+void cpuidle_init(void) {
+    uint32_t a;
+    uint32_t b;
+    uint32_t c;
+    uint32_t d;
+
+    states[0].name = cstate_names[0];
+    states[0].mwait = false;
+    states[0].hint = 0;
+    states[0].substates = 1;
+    state_count = 1;
+    selected = 0;
+
+    cpuid(0, 0, &a, &b, &c, &d);
+    if (a < 5) {
+        return;
+    }
+    cpuid(1, 0, &a, &b, &c, &d);
+    if (!(c & CPUID1_ECX_MONITOR)) {
+        return;
+    }
+    cpuid(5, 0, &a, &b, &c, &d);
+    if (!(c & CPUID5_ECX_EXTENSIONS) || !(c & CPUID5_ECX_IRQ_BREAK)) {
+        return;
+    }
+
+    /* EDX holds a 4-bit sub-state count per C-state, C0 in the low nibble. */
+    for (unsigned int cstate = 1; cstate < CPUIDLE_MAX_STATES; cstate++) {
+        uint32_t substates = (d >> (cstate * 4U)) & 0xFU;
+        cpuidle_state_t *state;
+
+        if (substates == 0) {
+            continue;
+        }
+        state = &states[state_count++];
+        state->name = cstate_names[cstate];
+        state->mwait = true;
+        state->hint = (cstate - 1U) << 4;
+        state->substates = substates;
+    }
+
+    /* Shallowest MWAIT state: wakes fastest; deeper ones are opt-in via `cpuidle`. */
+    if (state_count > 1) {
+        selected = 1;
+    }
+}
+
+/*
+ * Sleep in the selected state until an interrupt or kick. Called and
+ * returns with interrupts off. `wake_tsc` is when the caller's timer is due
+ * (UINT64_MAX if none); with a kick it dates the wakeup for the latency
+ * figures. MWAIT exits before the interrupt is serviced, so its latency is
+ * pure exit time; HLT services the interrupt first, so it includes the
+ * handler.
+ */
+void cpuidle_enter(uint64_t wake_tsc) {
+    idle_cpu_t *cpu = &idle_cpus[smp_cpu_id()];
+    unsigned int index = selected;
+    const cpuidle_state_t *state = &states[index];
+    uint64_t cause;
+    uint64_t start;
+    uint64_t end;
+
+    cpu->kick_tsc = 0;
+    __atomic_store_n(&cpu->idle, true, __ATOMIC_SEQ_CST);
+    start = rdtsc();
+    if (state->mwait) {
+        __asm__ volatile ("monitor" : : "a"(&cpu->kick_tsc), "c"(0U), "d"(0U) : "memory");
+        if (cpu->kick_tsc == 0) {
+            __asm__ volatile ("mwait" : : "a"(state->hint), "c"(MWAIT_ECX_IRQ_BREAK) : "memory");
+        }
+        end = rdtsc();
+    } else {
+        sti_hlt();
+        cli();
+        end = rdtsc();
+    }
+    __atomic_store_n(&cpu->idle, false, __ATOMIC_RELAXED);
+
+    cpu->entries[index]++;
+    cpu->residency[index] += end - start;
+
+    /* The earliest known reason to wake; none if an unrelated IRQ came first. */
+    cause = cpu->kick_tsc;
+    if (cause == 0 || wake_tsc < cause) {
+        cause = wake_tsc;
+    }
+    if (cause >= start && cause <= end) {
+        uint64_t latency = end - cause;
+
+        cpu->timed_wakeups++;
+        cpu->latency_sum += latency;
+        if (latency > cpu->latency_max) {
+            cpu->latency_max = latency;
+        }
+    }
+}
+
+/* Date a wakeup of an idle CPU; the first kick of an idle period wins. */
+void cpuidle_kick(unsigned int cpu) {
+    idle_cpu_t *target;
+    uint64_t expected = 0;
+
+    if (cpu >= SMP_MAX_CPUS) {
+        return;
+    }
+    target = &idle_cpus[cpu];
+    if (__atomic_load_n(&target->idle, __ATOMIC_SEQ_CST)) {
+        __atomic_compare_exchange_n(&target->kick_tsc, &expected, rdtsc(), false,
+                                    __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+    }
+}
+
+unsigned int cpuidle_state_count(void) {
+    return state_count;
+}
+
+bool cpuidle_state_info(unsigned int index, cpuidle_state_t *out) {
+    if (index >= state_count || !out) {
+        return false;
+    }
+    *out = states[index];
+    return true;
+}
+
+unsigned int cpuidle_selected(void) {
+    return selected;
+}
+
+bool cpuidle_select(unsigned int index) {
+    if (index >= state_count) {
+        return false;
+    }
+    selected = index;
+    return true;
+}
+
+bool cpuidle_cpu_info(unsigned int cpu, cpuidle_cpu_info_t *out) {
+    const idle_cpu_t *idle;
+
+    if (cpu >= SMP_MAX_CPUS || !smp_cpu(cpu) || !out) {
+        return false;
+    }
+    idle = &idle_cpus[cpu];
+    for (unsigned int i = 0; i < CPUIDLE_MAX_STATES; i++) {
+        out->entries[i] = idle->entries[i];
+        out->residency_ns[i] = clock_cycles_to_ns(idle->residency[i]);
+    }
+    out->timed_wakeups = idle->timed_wakeups;
+    out->latency_sum_ns = clock_cycles_to_ns(idle->latency_sum);
+    out->latency_max_ns = clock_cycles_to_ns(idle->latency_max);
+    return true;
+}
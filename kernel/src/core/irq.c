@@ -0,0 +1,173 @@
+#include <kernel/apic.h>
+#include <kernel/io.h>
+#include <kernel/irq.h>
+#include <kernel/lock.h>
+#include <kernel/pic.h>
+#include <kernel/sched.h>
+#include <kernel/softirq.h>
+
+typedef struct irq_action {
+    irq_handler_t handler;
+    void *ctx;
+    struct irq_action *next;
+} irq_action_t;
+
+typedef struct {
+    irq_action_t *actions;
+    /* CPUs inside irq_dispatch() for this line. */
+    volatile uint32_t walkers;
+    irq_stats_t stats;
+} irq_line_t;
+
+static irq_action_t action_pool[IRQ_MAX_ACTIONS];
+static irq_line_t lines[IRQ_LINES];
+
+/*
+ * Serialises changes to the chains and the pool. irq_dispatch() walks a
+ * chain without it, on any CPU: new actions are published with a release
+ * store, and an unlinked action goes back to the pool only once no CPU is
+ * still walking its line. Zero-initialised rather than registered, since
+ * it must work before any init code runs.
+ */
+static spinlock_t irq_lock;
+static uint64_t spurious_vectors = 0;
+
+static void record_cycles(irq_stats_t *stats, uint64_t cycles) {
+    unsigned int bucket = (cycles == 0) ? 0 : (unsigned int)(63 - __builtin_clzll(cycles));
+
+    if (bucket >= IRQ_HIST_BUCKETS) {
+        bucket = IRQ_HIST_BUCKETS - 1;
+    }
+    stats->hist[bucket]++;
+    stats->cycles_total += cycles;
+    if (stats->count == 1 || cycles < stats->cycles_min) {
+        stats->cycles_min = cycles;
+    }
+    if (cycles > stats->cycles_max) {
+        stats->cycles_max = cycles;
+    }
+}
+
+/* Several handlers may share a line; each is asked in registration order. */
+bool irq_register(uint8_t line, irq_handler_t handler, void *ctx) {
+    irq_action_t *action = 0;
+    irq_action_t **tail;
+    uint64_t flags;
+
+    if (line >= IRQ_LINES || !handler) {
+        return false;
+    }
+
+    flags = spin_lock_irqsave(&irq_lock);
+    for (uint32_t i = 0; i < IRQ_MAX_ACTIONS; i++) {
+        if (!action_pool[i].handler) {
+            action = &action_pool[i];
+            break;
+        }
+    }
+    if (action) {
+        action->handler = handler;
+        action->ctx = ctx;
+        action->next = 0;
+        for (tail = &lines[line].actions; *tail; tail = &(*tail)->next) {
+        }
+        __atomic_store_n(tail, action, __ATOMIC_RELEASE);
+        lines[line].stats.handlers++;
+    }
+    spin_unlock_irqrestore(&irq_lock, flags);
+    return action != 0;
+}
+
+/* Must not be called from a handler on the same line: it waits for those to finish. */
+bool irq_unregister(uint8_t line, irq_handler_t handler, void *ctx) {
+    irq_action_t **link;
+    irq_action_t *action = 0;
+    uint64_t flags;
+
+    if (line >= IRQ_LINES) {
+        return false;
+    }
+
+    flags = spin_lock_irqsave(&irq_lock);
+    for (link = &lines[line].actions; *link; link = &(*link)->next) {
+        if ((*link)->handler == handler && (*link)->ctx == ctx) {
+            action = *link;
+            /* Walkers already on it still follow its next pointer. */
+            __atomic_store_n(link, action->next, __ATOMIC_RELEASE);
+            lines[line].stats.handlers--;
+            break;
+        }
+    }
+    if (action) {
+        /* Pairs with the walker's increment: either it sees the unlink or we see it. */
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&lines[line].walkers, __ATOMIC_ACQUIRE) != 0) {
+            cpu_relax();
+        }
+        action->handler = 0;
+    }
+    spin_unlock_irqrestore(&irq_lock, flags);
+    return action != 0;
+}
+
+void irq_eoi(uint8_t line) {
+    if (apic_enabled()) {
+        lapic_eoi();
+    } else {
+        pic_send_eoi(line);
+    }
+}
+
+/* Entry from the per-line IDT stubs, with interrupts disabled. */
+void irq_dispatch(uint8_t line) {
+    irq_line_t *entry = &lines[line];
+    bool handled = false;
+    uint64_t start;
+
+    /* The 8259 reports a vanished request on its lowest-priority pin; it must not be EOI'd. */
+    if (!apic_enabled() && (line == 7 || line == 15) && pic_is_spurious(line)) {
+        entry->stats.spurious++;
+        if (line == 15) {
+            pic_send_eoi(2);
+        }
+        return;
+    }
+
+    start = rdtsc();
+    __atomic_fetch_add(&entry->walkers, 1U, __ATOMIC_SEQ_CST);
+    for (irq_action_t *action = __atomic_load_n(&entry->actions, __ATOMIC_ACQUIRE); action;
+         action = __atomic_load_n(&action->next, __ATOMIC_ACQUIRE)) {
+        handled |= action->handler(action->ctx);
+    }
+    __atomic_fetch_sub(&entry->walkers, 1U, __ATOMIC_RELEASE);
+    entry->stats.count++;
+    record_cycles(&entry->stats, rdtsc() - start);
+    if (!handled) {
+        entry->stats.spurious++;
+    }
+
+    irq_eoi(line);
+    softirq_run();
+    sched_irq_exit();
+}
+
+bool irq_stats(uint8_t line, irq_stats_t *out) {
+    uint64_t flags;
+
+    if (line >= IRQ_LINES) {
+        return false;
+    }
+    flags = irq_save();
+    *out = lines[line].stats;
+    irq_restore(flags);
+    return true;
+}
+
+/* LAPIC spurious vector: no line, no EOI. */
+void irq_note_spurious_vector(void) {
+    spurious_vectors++;
+}
+
+uint64_t irq_spurious_vectors(void) {
+    return spurious_vectors;
+}
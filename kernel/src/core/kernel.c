@@ -1,15 +1,24 @@
+#include <kernel/acpi.h>
+#include <kernel/apic.h>
+#include <kernel/clock.h>
 #include <kernel/console.h>
+#include <kernel/cpuidle.h>
 #include <kernel/idt.h>
 #include <kernel/io.h>
 #include <kernel/keyboard.h>
+#include <kernel/ktimer.h>
 #include <kernel/multiboot2.h>
 #include <kernel/pic.h>
-#include <kernel/pit.h>
 #include <kernel/pmm.h>
 #include <kernel/pty.h>
 #include <kernel/rust.h>
+#include <kernel/sched.h>
 #include <kernel/session.h>
 #include <kernel/shell.h>
+#include <kernel/slab.h>
+#include <kernel/smp.h>
+#include <kernel/softirq.h>
+#include <kernel/timer.h>
 #include <kernel/tty.h>
 #include <kernel/video.h>
 #include <kernel/vmm.h>
@@ -21,7 +30,19 @@ static void halt_forever(void) {
     }
 }
 
+/* Sleeps until the keyboard softirq or a PTY writer signals input. */
+static void shell_thread(void *arg) {
+    (void)arg;
+
+    shell_init();
+    for (;;) {
+        shell_poll();
+        tty_wait_input();
+    }
+}
+
 void kernel_main(uint32_t multiboot_magic, uint32_t multiboot_info_addr) {
+    smp_init_bsp();
     console_init();
 
     console_write("WaluOS booting...\n");
@@ -41,9 +62,12 @@ void kernel_main(uint32_t multiboot_magic, uint32_t multiboot_info_addr) {
     pmm_init(multiboot_info_addr);
     console_write("PMM initialized\n");
 
-    vmm_init();
+    vmm_init(multiboot_info_addr);
     console_write("VMM initialized\n");
 
+    slab_init();
+    console_write("Slab allocator initialized\n");
+
     if (video_map_framebuffer() && console_enable_framebuffer()) {
         console_write("Framebuffer console enabled\n");
     } else {
@@ -57,11 +81,24 @@ void kernel_main(uint32_t multiboot_magic, uint32_t multiboot_info_addr) {
         pic_set_mask(irq);
     }
 
-    pic_clear_mask(0);
-    pic_clear_mask(1);
-    pic_clear_mask(2);
+    /* The 8259 stays remapped and fully masked once the IOAPIC takes over. */
+    if (acpi_init(multiboot_info_addr) && apic_init()) {
+        uint32_t boot_cpu = lapic_id();
+        ioapic_route_irq(0, 0x20, boot_cpu);
+        ioapic_route_irq(1, 0x21, boot_cpu);
+        console_write(apic_x2apic() ? "APIC: x2APIC + IOAPIC\n" : "APIC: xAPIC + IOAPIC\n");
+    } else {
+        pic_clear_mask(0);
+        pic_clear_mask(1);
+        pic_clear_mask(2);
+        console_write("APIC: unavailable, using 8259 PIC\n");
+    }
 
-    pit_init(100);
+    clock_init();
+    timer_init();
+    cpuidle_init();
+    ktimer_init();
+    sched_init();
     keyboard_init();
     tty_init();
     pty_init();
@@ -78,6 +115,12 @@ void kernel_main(uint32_t multiboot_magic, uint32_t multiboot_info_addr) {
         }
     }
 
+    console_write("SMP: ");
+    console_write_dec(smp_boot_aps());
+    console_write(" of ");
+    console_write_dec(acpi_madt() ? acpi_madt()->cpu_count : 1);
+    console_write(" CPUs online\n");
+
     console_write("Interrupts initialized\n");
     console_write((const char *)rust_boot_banner());
     console_putc('\n');
@@ -85,10 +128,40 @@ void kernel_main(uint32_t multiboot_magic, uint32_t multiboot_info_addr) {
     sti();
 
     console_write("Kernel ready. Type `help`.\n");
-    shell_init();
+    /* Console, TTY and PTY state are CPU 0 only until they get locks. */
+    if (!thread_create("shell", shell_thread, 0, 0)) {
+        console_write("Shell thread creation failed\n");
+        halt_forever();
+    }
 
+    /* From here on the boot context is CPU 0's idle thread. */
     for (;;) {
-        shell_poll();
-        hlt();
+        if (sched_has_work()) {
+            sched_yield();
+            continue;
+        }
+        /* Zero a few frames per wakeup; sleep once the pool is full. */
+        if (pmm_zero_pool_refill(4)) {
+            continue;
+        }
+
+        /*
+         * Work is checked with interrupts off so a wakeup cannot land between
+         * the check and the idle state. Deferred work left over by an IRQ exit runs first.
+         * The tick keeps running while another CPU has threads queued.
+         */
+        cli();
+        softirq_run();
+        if (!sched_has_work() && !softirq_pending()) {
+            bool tickless = !sched_needs_tick();
+            if (tickless) {
+                timer_idle_enter();
+            }
+            cpuidle_enter(timer_deadline_tsc());
+            if (tickless) {
+                timer_idle_exit();
+            }
+        }
+        sti();
     }
 }
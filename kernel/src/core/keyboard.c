@@ -1,18 +1,28 @@
 #include <kernel/io.h>
+#include <kernel/irq.h>
 #include <kernel/keyboard.h>
+#include <kernel/ring.h>
+#include <kernel/softirq.h>
+#include <kernel/waitqueue.h>
 
 #define KEYBOARD_DATA_PORT 0x60
 
-#define KBD_BYTE_QUEUE_SIZE 1024
-#define KBD_EVENT_QUEUE_SIZE 256
+/* Queue sizes as powers of two: 64 scancodes, 1024 bytes, 256 events. */
+#define KBD_SCANCODE_QUEUE_ORDER 6
+#define KBD_BYTE_QUEUE_ORDER 10
+#define KBD_EVENT_QUEUE_ORDER 8
 
-static volatile uint8_t kbd_byte_queue[KBD_BYTE_QUEUE_SIZE];
-static volatile unsigned int kbd_byte_head = 0;
-static volatile unsigned int kbd_byte_tail = 0;
+RING_DEFINE(kbd_scancode_ring, uint8_t, KBD_SCANCODE_QUEUE_ORDER)
+RING_DEFINE(kbd_byte_ring, uint8_t, KBD_BYTE_QUEUE_ORDER)
+RING_DEFINE(kbd_event_ring, key_event_t, KBD_EVENT_QUEUE_ORDER)
 
-static volatile key_event_t kbd_event_queue[KBD_EVENT_QUEUE_SIZE];
-static volatile unsigned int kbd_event_head = 0;
-static volatile unsigned int kbd_event_tail = 0;
+/* Raw scancodes from the IRQ top half, decoded later by the keyboard softirq. */
+static kbd_scancode_ring_t kbd_scancodes;
+/* Decoded UTF-8 input bytes and key events, produced by the softirq. */
+static kbd_byte_ring_t kbd_bytes;
+static kbd_event_ring_t kbd_events;
+/* Bytes and events queued, so the softirq knows whether to wake readers. */
+static uint64_t kbd_queued_count = 0;
 
 static bool kbd_extended = false;
 static unsigned int kbd_e1_skip = 0;
@@ -20,8 +30,11 @@ static uint8_t kbd_modifiers = 0;
 static uint8_t kbd_locks = 0;
 static bool kbd_key_down[KEY_MAX];
 static uint64_t kbd_rx_scancode_count = 0;
+static uint64_t kbd_drop_scancode_count = 0;
 static uint64_t kbd_drop_byte_count = 0;
 static uint64_t kbd_drop_event_count = 0;
+/* Readers of the byte and event queues sleep here until the softirq decodes input. */
+static wait_queue_t kbd_wait;
 
 static const keycode_t scancode_to_key[128] = {
     [0x01] = KEY_ESC,
@@ -131,25 +144,26 @@ static const keycode_t scancode_to_key_e0[128] = {
 };
 
 static void kbd_push_byte(uint8_t byte) {
-    unsigned int next = (kbd_byte_head + 1) % KBD_BYTE_QUEUE_SIZE;
-    if (next == kbd_byte_tail) {
+    if (!kbd_byte_ring_push(&kbd_bytes, byte)) {
         kbd_drop_byte_count++;
         return;
     }
+    kbd_queued_count++;
+}
+
+static void kbd_push_bytes(const uint8_t *bytes, size_t len) {
+    size_t pushed = kbd_byte_ring_push_n(&kbd_bytes, bytes, len);
 
-    kbd_byte_queue[kbd_byte_head] = byte;
-    kbd_byte_head = next;
+    kbd_drop_byte_count += len - pushed;
+    kbd_queued_count += pushed;
 }
 
 static void kbd_push_event(key_event_t event) {
-    unsigned int next = (kbd_event_head + 1) % KBD_EVENT_QUEUE_SIZE;
-    if (next == kbd_event_tail) {
+    if (!kbd_event_ring_push(&kbd_events, event)) {
         kbd_drop_event_count++;
         return;
     }
-
-    kbd_event_queue[kbd_event_head] = event;
-    kbd_event_head = next;
+    kbd_queued_count++;
 }
 
 static void kbd_emit_utf8(uint32_t codepoint) {
@@ -183,9 +197,12 @@ static void kbd_emit_utf8(uint32_t codepoint) {
 }
 
 static void kbd_emit_sequence(const char *seq) {
-    while (*seq != '\0') {
-        kbd_push_byte((uint8_t)*seq++);
+    size_t len = 0;
+
+    while (seq[len] != '\0') {
+        len++;
     }
+    kbd_push_bytes((const uint8_t *)seq, len);
 }
 
 static void kbd_set_modifier_bit(uint8_t bit, bool pressed) {
@@ -379,33 +396,12 @@ static void kbd_emit_input_bytes(const key_event_t *event) {
     kbd_emit_special_sequence(event->keycode);
 }
 
-void keyboard_init(void) {
-    kbd_byte_head = 0;
-    kbd_byte_tail = 0;
-    kbd_event_head = 0;
-    kbd_event_tail = 0;
-    kbd_extended = false;
-    kbd_e1_skip = 0;
-    kbd_modifiers = 0;
-    kbd_locks = 0;
-    kbd_rx_scancode_count = 0;
-    kbd_drop_byte_count = 0;
-    kbd_drop_event_count = 0;
-
-    for (unsigned int i = 0; i < KEY_MAX; i++) {
-        kbd_key_down[i] = false;
-    }
-}
-
-void keyboard_on_irq(void) {
-    uint8_t scancode = inb(KEYBOARD_DATA_PORT);
+static void kbd_decode_scancode(uint8_t scancode) {
     bool released;
     uint8_t code;
     keycode_t keycode;
     key_event_t event;
 
-    kbd_rx_scancode_count++;
-
     if (scancode == 0xE0) {
         kbd_extended = true;
         return;
@@ -456,26 +452,89 @@ void keyboard_on_irq(void) {
     kbd_emit_input_bytes(&event);
 }
 
-bool keyboard_pop_char(char *out) {
-    if (kbd_byte_tail == kbd_byte_head) {
-        return false;
+/* Bottom half: drain raw scancodes with interrupts enabled. */
+static void keyboard_softirq(void) {
+    uint64_t queued = kbd_queued_count;
+    uint8_t scancode;
+
+    while (kbd_scancode_ring_pop(&kbd_scancodes, &scancode)) {
+        kbd_decode_scancode(scancode);
     }
+    if (kbd_queued_count != queued) {
+        wake_up_all(&kbd_wait);
+    }
+}
 
-    *out = (char)kbd_byte_queue[kbd_byte_tail];
-    kbd_byte_tail = (kbd_byte_tail + 1) % KBD_BYTE_QUEUE_SIZE;
+static bool keyboard_irq(void *ctx) {
+    (void)ctx;
+    keyboard_on_irq();
     return true;
 }
 
-bool keyboard_pop_event(key_event_t *out) {
-    if (kbd_event_tail == kbd_event_head) {
-        return false;
+void keyboard_init(void) {
+    kbd_scancode_ring_init(&kbd_scancodes);
+    kbd_byte_ring_init(&kbd_bytes);
+    kbd_event_ring_init(&kbd_events);
+    kbd_queued_count = 0;
+    kbd_extended = false;
+    kbd_e1_skip = 0;
+    kbd_modifiers = 0;
+    kbd_locks = 0;
+    kbd_rx_scancode_count = 0;
+    kbd_drop_scancode_count = 0;
+    kbd_drop_byte_count = 0;
+    kbd_drop_event_count = 0;
+
+    for (unsigned int i = 0; i < KEY_MAX; i++) {
+        kbd_key_down[i] = false;
+    }
+
+    wait_queue_init(&kbd_wait, "keyboard-wait");
+    softirq_register(SOFTIRQ_KEYBOARD, "keyboard", keyboard_softirq);
+    irq_register(1, keyboard_irq, 0);
+}
+
+/* Top half: read the controller and queue the raw byte; decoding is deferred. */
+void keyboard_on_irq(void) {
+    keyboard_test_inject_scancode(inb(KEYBOARD_DATA_PORT));
+}
+
+/* The top half after the port read; host benches feed scancodes through it. */
+void keyboard_test_inject_scancode(uint8_t scancode) {
+    kbd_rx_scancode_count++;
+    if (!kbd_scancode_ring_push(&kbd_scancodes, scancode)) {
+        kbd_drop_scancode_count++;
+        return;
     }
+    softirq_raise(SOFTIRQ_KEYBOARD);
+}
+
+bool keyboard_pop_char(char *out) {
+    uint8_t byte;
 
-    *out = kbd_event_queue[kbd_event_tail];
-    kbd_event_tail = (kbd_event_tail + 1) % KBD_EVENT_QUEUE_SIZE;
+    if (!kbd_byte_ring_pop(&kbd_bytes, &byte)) {
+        return false;
+    }
+    *out = (char)byte;
     return true;
 }
 
+size_t keyboard_read(char *buf, size_t len) {
+    return kbd_byte_ring_pop_n(&kbd_bytes, (uint8_t *)buf, len);
+}
+
+bool keyboard_has_input(void) {
+    return !kbd_byte_ring_empty(&kbd_bytes);
+}
+
+wait_queue_t *keyboard_wait_queue(void) {
+    return &kbd_wait;
+}
+
+bool keyboard_pop_event(key_event_t *out) {
+    return kbd_event_ring_pop(&kbd_events, out);
+}
+
 uint8_t keyboard_modifiers(void) {
     return kbd_modifiers;
 }
@@ -488,6 +547,10 @@ uint64_t keyboard_rx_scancodes(void) {
     return kbd_rx_scancode_count;
 }
 
+uint64_t keyboard_dropped_scancodes(void) {
+    return kbd_drop_scancode_count;
+}
+
 uint64_t keyboard_dropped_bytes(void) {
     return kbd_drop_byte_count;
 }
@@ -0,0 +1,318 @@
+#include <kernel/clock.h>
+#include <kernel/ktimer.h>
+#include <kernel/lock.h>
+#include <kernel/softirq.h>
+#include <kernel/timer.h>
+
+#define SLOT_MASK (KTIMER_SLOTS - 1U)
+#define SLOT_EXPIRED (KTIMER_LEVELS * KTIMER_SLOTS)
+#define WHEEL_SPAN (1ULL << (KTIMER_LEVEL_BITS * KTIMER_LEVELS))
+
+/*
+ * Hierarchical timing wheel. Level L has 64 slots of 64^L ticks each; a
+ * timer is filed at the lowest level whose range covers its distance from
+ * `clk`, so insert and cancel are a list operation plus a bit flip. When
+ * `clk` crosses a level-L boundary, the slot it enters is re-filed into the
+ * levels below ("cascade"), and level 0 slots expire as `clk` passes them.
+ * Per-level occupancy bitmaps let an idle stretch be skipped in a few
+ * steps and give the next deadline for the tickless timer.
+ *
+ * There is one wheel for the whole machine. The clockevent interrupt only
+ * exists on CPU 0, so its softirq is the only place that advances the wheel
+ * and runs the callbacks; any CPU may arm or cancel under the lock.
+ */
+typedef struct {
+    spinlock_t lock;
+    bool started;
+    /* Next tick to process. */
+    uint64_t clk;
+    /* Lower bound for the earliest expiry, in ticks; UINT64_MAX when empty. */
+    volatile uint64_t next;
+    uint64_t occupied[KTIMER_LEVELS];
+    ktimer_t *slots[KTIMER_LEVELS * KTIMER_SLOTS];
+    /* Expired but not yet run; still pending, so cancel can pull them. */
+    ktimer_t *expired;
+    volatile uint64_t pending;
+    uint64_t armed;
+    uint64_t fired;
+    uint64_t cancelled;
+    uint64_t cascaded;
+} __attribute__((aligned(64))) ktimer_wheel_t;
+
+static ktimer_wheel_t wheel;
+
+static uint64_t now_ticks(void) {
+    return clock_monotonic_ns() / KTIMER_TICK_NS;
+}
+
+static inline uint64_t rotate_right(uint64_t value, unsigned int shift) {
+    return (value >> shift) | (value << ((64U - shift) & 63U));
+}
+
+static void list_add(ktimer_t **head, ktimer_t *timer) {
+    timer->next = *head;
+    if (*head) {
+        (*head)->pprev = &timer->next;
+    }
+    *head = timer;
+    timer->pprev = head;
+}
+
+static void unlink(ktimer_wheel_t *wheel, ktimer_t *timer) {
+    *timer->pprev = timer->next;
+    if (timer->next) {
+        timer->next->pprev = timer->pprev;
+    }
+    if (timer->slot < SLOT_EXPIRED && !wheel->slots[timer->slot]) {
+        wheel->occupied[timer->slot / KTIMER_SLOTS] &= ~(1ULL << (timer->slot & SLOT_MASK));
+    }
+    timer->next = 0;
+    timer->pprev = 0;
+}
+
+static void enqueue(ktimer_wheel_t *wheel, ktimer_t *timer) {
+    uint64_t expires = (timer->expires < wheel->clk) ? wheel->clk : timer->expires;
+    uint64_t delta = expires - wheel->clk;
+    unsigned int level = 0;
+    unsigned int index;
+
+    /* Beyond the top level: park in its farthest slot and re-file from there. */
+    if (delta >= WHEEL_SPAN) {
+        delta = WHEEL_SPAN - 1;
+        expires = wheel->clk + delta;
+    }
+    while (level + 1 < KTIMER_LEVELS && delta >= (1ULL << (KTIMER_LEVEL_BITS * (level + 1)))) {
+        level++;
+    }
+    index = (unsigned int)(expires >> (KTIMER_LEVEL_BITS * level)) & SLOT_MASK;
+
+    timer->slot = (uint16_t)(level * KTIMER_SLOTS + index);
+    list_add(&wheel->slots[timer->slot], timer);
+    wheel->occupied[level] |= 1ULL << index;
+}
+
+/* Detach a slot's list; the caller re-files or expires every entry. */
+static ktimer_t *take_slot(ktimer_wheel_t *wheel, unsigned int level, unsigned int index) {
+    ktimer_t *list = wheel->slots[level * KTIMER_SLOTS + index];
+
+    wheel->slots[level * KTIMER_SLOTS + index] = 0;
+    wheel->occupied[level] &= ~(1ULL << index);
+    return list;
+}
+
+static void cascade(ktimer_wheel_t *wheel, unsigned int level) {
+    unsigned int index = (unsigned int)(wheel->clk >> (KTIMER_LEVEL_BITS * level)) & SLOT_MASK;
+    ktimer_t *timer = take_slot(wheel, level, index);
+
+    while (timer) {
+        ktimer_t *next = timer->next;
+        enqueue(wheel, timer);
+        wheel->cascaded++;
+        timer = next;
+    }
+}
+
+/* Process every tick up to and including `now`, moving due timers to `expired`. */
+static void advance(ktimer_wheel_t *wheel, uint64_t now) {
+    while (wheel->clk <= now) {
+        unsigned int level;
+        ktimer_t *timer;
+
+        for (level = 1; level < KTIMER_LEVELS &&
+             (wheel->clk & ((1ULL << (KTIMER_LEVEL_BITS * level)) - 1)) == 0; level++) {
+            cascade(wheel, level);
+        }
+
+        timer = take_slot(wheel, 0, (unsigned int)wheel->clk & SLOT_MASK);
+        while (timer) {
+            ktimer_t *next = timer->next;
+            timer->slot = SLOT_EXPIRED;
+            list_add(&wheel->expired, timer);
+            timer = next;
+        }
+        wheel->clk++;
+
+        /* With levels below L empty, nothing happens before the next level-L boundary. */
+        for (level = 0; level < KTIMER_LEVELS && wheel->occupied[level] == 0; level++) {
+        }
+        if (level == KTIMER_LEVELS) {
+            if (wheel->clk <= now) {
+                wheel->clk = now + 1;
+            }
+        } else if (level > 0) {
+            uint64_t granule = 1ULL << (KTIMER_LEVEL_BITS * level);
+            uint64_t target = (wheel->clk + granule - 1) & ~(granule - 1);
+            wheel->clk = (target > now + 1) ? now + 1 : target;
+        }
+    }
+}
+
+/*
+ * Level 0 slots hold exact ticks; a higher slot is due when `clk` reaches
+ * its block, which has already happened for the block `clk` is inside.
+ */
+static uint64_t compute_next(const ktimer_wheel_t *wheel) {
+    uint64_t best = UINT64_MAX;
+
+    if (wheel->expired) {
+        return wheel->clk;
+    }
+    for (unsigned int level = 0; level < KTIMER_LEVELS; level++) {
+        unsigned int shift = KTIMER_LEVEL_BITS * level;
+        uint64_t base = wheel->clk >> shift;
+        uint64_t tick;
+
+        if (wheel->occupied[level] == 0) {
+            continue;
+        }
+        if (level > 0 && (wheel->clk & ((1ULL << shift) - 1)) != 0) {
+            base++;
+        }
+        base += (uint64_t)__builtin_ctzll(rotate_right(wheel->occupied[level], (unsigned int)base & SLOT_MASK));
+        tick = base << shift;
+        if (tick < best) {
+            best = tick;
+        }
+    }
+    return best;
+}
+
+/* Boot CPU, after clock_init(). */
+void ktimer_init(void) {
+    spin_init(&wheel.lock, "ktimer");
+    wheel.clk = now_ticks();
+    wheel.next = UINT64_MAX;
+    __atomic_store_n(&wheel.started, true, __ATOMIC_RELEASE);
+    softirq_register(SOFTIRQ_TIMER, "timer", ktimer_run);
+}
+
+void ktimer_setup(ktimer_t *timer, ktimer_fn fn, void *arg) {
+    timer->next = 0;
+    timer->pprev = 0;
+    timer->expires = 0;
+    timer->fn = fn;
+    timer->arg = arg;
+    timer->slot = 0;
+    timer->pending = false;
+}
+
+/* Needs the wheel lock. */
+static void cancel_locked(ktimer_t *timer) {
+    unlink(&wheel, timer);
+    timer->pending = false;
+    wheel.pending--;
+    wheel.cancelled++;
+}
+
+/*
+ * (Re)start `timer` to fire delay_ns from now. Returns true when it was
+ * already pending. A given timer has a single owner that arms it; cancel
+ * is safe from anywhere.
+ */
+bool ktimer_arm(ktimer_t *timer, uint64_t delay_ns) {
+    uint64_t now_ns = clock_monotonic_ns();
+    uint64_t deadline_ns = (delay_ns > UINT64_MAX - now_ns - KTIMER_TICK_NS) ? UINT64_MAX - KTIMER_TICK_NS
+                                                                              : now_ns + delay_ns;
+    bool was_pending;
+    uint64_t old_next;
+    uint64_t new_next;
+    uint64_t flags;
+
+    if (!timer->fn || !wheel.started) {
+        return ktimer_cancel(timer);
+    }
+
+    flags = spin_lock_irqsave(&wheel.lock);
+    was_pending = timer->pending;
+    if (was_pending) {
+        cancel_locked(timer);
+    }
+    if (wheel.pending == 0 && wheel.clk < now_ns / KTIMER_TICK_NS) {
+        wheel.clk = now_ns / KTIMER_TICK_NS;
+    }
+    /* Round up: a timer may fire late by up to a tick, never early. */
+    timer->expires = (deadline_ns + KTIMER_TICK_NS - 1) / KTIMER_TICK_NS;
+    enqueue(&wheel, timer);
+    timer->pending = true;
+    wheel.pending++;
+    wheel.armed++;
+    old_next = (wheel.pending == 1) ? UINT64_MAX : wheel.next;
+    new_next = compute_next(&wheel);
+    wheel.next = new_next;
+    spin_unlock_irqrestore(&wheel.lock, flags);
+
+    if (new_next < old_next) {
+        timer_reprogram();
+    }
+    return was_pending;
+}
+
+/* True when the timer was pending. A callback already running is not waited for. */
+bool ktimer_cancel(ktimer_t *timer) {
+    bool was_pending;
+    uint64_t flags;
+
+    if (!timer->pending) {
+        return false;
+    }
+    flags = spin_lock_irqsave(&wheel.lock);
+    /* Re-check: it may have fired meanwhile. */
+    was_pending = timer->pending;
+    if (was_pending) {
+        cancel_locked(timer);
+    }
+    spin_unlock_irqrestore(&wheel.lock, flags);
+    return was_pending;
+}
+
+bool ktimer_pending(const ktimer_t *timer) {
+    return timer->pending;
+}
+
+/*
+ * SOFTIRQ_TIMER: advance the wheel and run what expired. Callbacks run
+ * with interrupts enabled and no lock held, so they may re-arm themselves.
+ */
+void ktimer_run(void) {
+    uint64_t now = now_ticks();
+    ktimer_t *timer;
+    uint64_t flags;
+
+    if (wheel.started && wheel.pending != 0) {
+        flags = spin_lock_irqsave(&wheel.lock);
+        advance(&wheel, now);
+        while ((timer = wheel.expired) != 0) {
+            ktimer_fn fn = timer->fn;
+            void *arg = timer->arg;
+
+            unlink(&wheel, timer);
+            timer->pending = false;
+            wheel.pending--;
+            wheel.fired++;
+            spin_unlock_irqrestore(&wheel.lock, flags);
+            fn(arg);
+            flags = spin_lock_irqsave(&wheel.lock);
+        }
+        wheel.next = compute_next(&wheel);
+        spin_unlock_irqrestore(&wheel.lock, flags);
+    }
+    timer_reprogram();
+}
+
+/* Earliest wheel deadline in monotonic ns (possibly early, never late), or UINT64_MAX. */
+uint64_t ktimer_next_deadline_ns(void) {
+    uint64_t next = wheel.next;
+
+    if (!wheel.started || wheel.pending == 0 || next == UINT64_MAX) {
+        return UINT64_MAX;
+    }
+    return next * KTIMER_TICK_NS;
+}
+
+void ktimer_stats(ktimer_stats_t *out) {
+    out->pending = wheel.pending;
+    out->armed = wheel.armed;
+    out->fired = wheel.fired;
+    out->cancelled = wheel.cancelled;
+    out->cascaded = wheel.cascaded;
+}
@@ -0,0 +1,246 @@
+#include <kernel/io.h>
+#include <kernel/lock.h>
+
+static lock_stats_t *registry[LOCK_MAX_TRACKED];
+static size_t registry_count = 0;
+static size_t registry_dropped = 0;
+static volatile uint32_t registry_lock = 0;
+
+static const char *const kind_names[] = {
+    [LOCK_KIND_SPIN] = "spin",
+    [LOCK_KIND_TICKET] = "ticket",
+    [LOCK_KIND_MCS] = "mcs",
+};
+
+/* Re-initialising a lock (PMM/slab re-init in host tests) keeps one entry. */
+static void stats_init(lock_stats_t *stats, const char *name, lock_kind_t kind) {
+    bool found = false;
+
+    stats->name = name;
+    stats->kind = kind;
+    stats->acquisitions = 0;
+    stats->contended = 0;
+    stats->spin_cycles = 0;
+    stats->hold_max = 0;
+    stats->hold_start = 0;
+
+    while (__atomic_exchange_n(&registry_lock, 1U, __ATOMIC_ACQUIRE) != 0) {
+        cpu_relax();
+    }
+    for (size_t i = 0; i < registry_count; i++) {
+        if (registry[i] == stats) {
+            found = true;
+            break;
+        }
+    }
+    if (!found && registry_count < LOCK_MAX_TRACKED) {
+        registry[registry_count++] = stats;
+    } else if (!found) {
+        registry_dropped++;
+    }
+    __atomic_store_n(&registry_lock, 0U, __ATOMIC_RELEASE);
+}
+
+/* `start` is the TSC when spinning began, or 0 for an uncontended acquire. */
+static void stats_acquired(lock_stats_t *stats, uint64_t start) {
+    uint64_t now = rdtsc();
+
+    stats->acquisitions++;
+    if (start != 0) {
+        stats->contended++;
+        stats->spin_cycles += now - start;
+    }
+    stats->hold_start = now;
+}
+
+static void stats_released(lock_stats_t *stats) {
+    uint64_t held = rdtsc() - stats->hold_start;
+
+    if (held > stats->hold_max) {
+        stats->hold_max = held;
+    }
+}
+
+void spin_init(spinlock_t *lock, const char *name) {
+    lock->locked = 0;
+    stats_init(&lock->stats, name, LOCK_KIND_SPIN);
+}
+
+void spin_lock(spinlock_t *lock) {
+    uint64_t start = 0;
+
+    while (__atomic_exchange_n(&lock->locked, 1U, __ATOMIC_ACQUIRE) != 0) {
+        if (start == 0) {
+            start = rdtsc();
+        }
+        while (__atomic_load_n(&lock->locked, __ATOMIC_RELAXED) != 0) {
+            cpu_relax();
+        }
+    }
+    stats_acquired(&lock->stats, start);
+}
+
+bool spin_trylock(spinlock_t *lock) {
+    if (__atomic_load_n(&lock->locked, __ATOMIC_RELAXED) != 0 ||
+        __atomic_exchange_n(&lock->locked, 1U, __ATOMIC_ACQUIRE) != 0) {
+        return false;
+    }
+    stats_acquired(&lock->stats, 0);
+    return true;
+}
+
+void spin_unlock(spinlock_t *lock) {
+    stats_released(&lock->stats);
+    __atomic_store_n(&lock->locked, 0U, __ATOMIC_RELEASE);
+}
+
+uint64_t spin_lock_irqsave(spinlock_t *lock) {
+    uint64_t flags = irq_save();
+    spin_lock(lock);
+    return flags;
+}
+
+void spin_unlock_irqrestore(spinlock_t *lock, uint64_t flags) {
+    spin_unlock(lock);
+    irq_restore(flags);
+}
+
+void ticket_init(ticketlock_t *lock, const char *name) {
+    lock->next = 0;
+    lock->owner = 0;
+    stats_init(&lock->stats, name, LOCK_KIND_TICKET);
+}
+
+void ticket_lock(ticketlock_t *lock) {
+    uint32_t ticket = __atomic_fetch_add(&lock->next, 1U, __ATOMIC_RELAXED);
+    uint64_t start = 0;
+
+    if (__atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE) != ticket) {
+        start = rdtsc();
+        while (__atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE) != ticket) {
+            cpu_relax();
+        }
+    }
+    stats_acquired(&lock->stats, start);
+}
+
+/* Only take a ticket when it would be served immediately. */
+bool ticket_trylock(ticketlock_t *lock) {
+    uint32_t owner = __atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE);
+    uint32_t expected = owner;
+
+    if (!__atomic_compare_exchange_n(&lock->next, &expected, owner + 1U, false,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return false;
+    }
+    stats_acquired(&lock->stats, 0);
+    return true;
+}
+
+void ticket_unlock(ticketlock_t *lock) {
+    stats_released(&lock->stats);
+    __atomic_store_n(&lock->owner, lock->owner + 1U, __ATOMIC_RELEASE);
+}
+
+uint64_t ticket_lock_irqsave(ticketlock_t *lock) {
+    uint64_t flags = irq_save();
+    ticket_lock(lock);
+    return flags;
+}
+
+void ticket_unlock_irqrestore(ticketlock_t *lock, uint64_t flags) {
+    ticket_unlock(lock);
+    irq_restore(flags);
+}
+
+void mcs_init(mcslock_t *lock, const char *name) {
+    lock->tail = 0;
+    stats_init(&lock->stats, name, LOCK_KIND_MCS);
+}
+
+void mcs_lock(mcslock_t *lock, mcs_node_t *node) {
+    mcs_node_t *prev;
+    uint64_t start = 0;
+
+    node->next = 0;
+    node->locked = true;
+    prev = __atomic_exchange_n(&lock->tail, node, __ATOMIC_ACQ_REL);
+    if (prev) {
+        start = rdtsc();
+        __atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+        while (__atomic_load_n(&node->locked, __ATOMIC_ACQUIRE)) {
+            cpu_relax();
+        }
+    }
+    stats_acquired(&lock->stats, start);
+}
+
+bool mcs_trylock(mcslock_t *lock, mcs_node_t *node) {
+    mcs_node_t *expected = 0;
+
+    node->next = 0;
+    node->locked = false;
+    if (!__atomic_compare_exchange_n(&lock->tail, &expected, node, false,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return false;
+    }
+    stats_acquired(&lock->stats, 0);
+    return true;
+}
+
+void mcs_unlock(mcslock_t *lock, mcs_node_t *node) {
+    mcs_node_t *next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE);
+
+    stats_released(&lock->stats);
+    if (!next) {
+        mcs_node_t *expected = node;
+        if (__atomic_compare_exchange_n(&lock->tail, &expected, 0, false,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+            return;
+        }
+        /* A successor swapped the tail but has not linked itself yet. */
+        while ((next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE)) == 0) {
+            cpu_relax();
+        }
+    }
+    __atomic_store_n(&next->locked, false, __ATOMIC_RELEASE);
+}
+
+uint64_t mcs_lock_irqsave(mcslock_t *lock, mcs_node_t *node) {
+    uint64_t flags = irq_save();
+    mcs_lock(lock, node);
+    return flags;
+}
+
+void mcs_unlock_irqrestore(mcslock_t *lock, mcs_node_t *node, uint64_t flags) {
+    mcs_unlock(lock, node);
+    irq_restore(flags);
+}
+
+bool lock_info(size_t index, lock_info_t *out) {
+    const lock_stats_t *stats;
+
+    if (index >= registry_count || !out) {
+        return false;
+    }
+
+    stats = registry[index];
+    out->name = stats->name;
+    out->kind = stats->kind;
+    out->acquisitions = stats->acquisitions;
+    out->contended = stats->contended;
+    out->spin_cycles = stats->spin_cycles;
+    out->hold_max_cycles = stats->hold_max;
+    return true;
+}
+
+size_t lock_untracked(void) {
+    return registry_dropped;
+}
+
+const char *lock_kind_name(lock_kind_t kind) {
+    if ((unsigned int)kind >= sizeof(kind_names) / sizeof(kind_names[0])) {
+        return "?";
+    }
+    return kind_names[kind];
+}
@@ -11,6 +11,7 @@
 #define ICW1_INIT    0x10
 #define ICW1_ICW4    0x01
 #define ICW4_8086    0x01
+#define OCW3_READ_ISR 0x0B
 
 void pic_remap(uint8_t offset1, uint8_t offset2) {
     uint8_t mask1 = inb(PIC1_DATA);
@@ -58,6 +59,14 @@ void pic_clear_mask(uint8_t irq_line) {
     outb(port, value);
 }
 
+/* True when irq_line is not actually in service (a spurious IRQ 7 or 15). */
+bool pic_is_spurious(uint8_t irq_line) {
+    uint16_t port = (irq_line < 8) ? PIC1_COMMAND : PIC2_COMMAND;
+
+    outb(port, OCW3_READ_ISR);
+    return (inb(port) & (1U << (irq_line & 7))) == 0;
+}
+
 void pic_send_eoi(uint8_t irq_line) {
     if (irq_line >= 8) {
         outb(PIC2_COMMAND, PIC_EOI);
@@ -3,26 +3,38 @@
 
 #define PIT_COMMAND 0x43
 #define PIT_CHANNEL0 0x40
-#define PIT_BASE_FREQUENCY 1193182U
+#define PIT_CHANNEL2 0x42
+#define PIT_GATE_PORT 0x61
 
-static volatile uint64_t g_ticks = 0;
+#define PIT_GATE2 0x01U
+#define PIT_SPEAKER 0x02U
+#define PIT_OUT2 0x20U
 
-void pit_init(uint32_t frequency_hz) {
-    if (frequency_hz == 0) {
-        frequency_hz = 100;
-    }
+/* Channel 0, lobyte/hibyte access, mode 0. */
+#define PIT_CH0_ONESHOT 0x30U
+/* Channel 2, lobyte/hibyte access, mode 0. */
+#define PIT_CH2_ONESHOT 0xB0U
 
-    uint16_t divisor = (uint16_t)(PIT_BASE_FREQUENCY / frequency_hz);
+/* Mode 0: IRQ0 fires once, `count` PIT cycles from now. */
+void pit_oneshot(uint16_t count) {
+    outb(PIT_COMMAND, PIT_CH0_ONESHOT);
+    outb(PIT_CHANNEL0, (uint8_t)(count & 0xFF));
+    outb(PIT_CHANNEL0, (uint8_t)((count >> 8) & 0xFF));
+}
 
-    outb(PIT_COMMAND, 0x36);
-    outb(PIT_CHANNEL0, (uint8_t)(divisor & 0xFF));
-    outb(PIT_CHANNEL0, (uint8_t)((divisor >> 8) & 0xFF));
+/* A mode word without a count leaves channel 0 waiting: no further IRQs. */
+void pit_stop(void) {
+    outb(PIT_COMMAND, PIT_CH0_ONESHOT);
 }
 
-void pit_on_tick(void) {
-    g_ticks++;
+/* Channel 2 is gated from port 0x61 and never raises an IRQ; used for calibration. */
+void pit_delay_start(uint16_t count) {
+    outb(PIT_GATE_PORT, (uint8_t)((inb(PIT_GATE_PORT) & ~PIT_SPEAKER) | PIT_GATE2));
+    outb(PIT_COMMAND, PIT_CH2_ONESHOT);
+    outb(PIT_CHANNEL2, (uint8_t)(count & 0xFF));
+    outb(PIT_CHANNEL2, (uint8_t)((count >> 8) & 0xFF));
 }
 
-uint64_t pit_ticks(void) {
-    return g_ticks;
+bool pit_delay_done(void) {
+    return (inb(PIT_GATE_PORT) & PIT_OUT2) != 0;
 }
@@ -1,78 +1,478 @@
+#include <kernel/io.h>
+#include <kernel/lock.h>
 #include <kernel/multiboot2.h>
 #include <kernel/pmm.h>
+#include <kernel/smp.h>
 #include <kernel/string.h>
+#include <kernel/vmm.h>
 
 #define FRAME_SIZE 4096ULL
-#define PMM_MAX_MEMORY (1024ULL * 1024ULL * 1024ULL)
-#define PMM_MAX_FRAMES (PMM_MAX_MEMORY / FRAME_SIZE)
+#define PMM_MIN_MEMORY (16ULL * 1024ULL * 1024ULL)
 
-static uint8_t frame_bitmap[PMM_MAX_FRAMES / 8];
-static uint64_t total_frames = PMM_MAX_FRAMES;
-static uint64_t used_frames = PMM_MAX_FRAMES;
+#define PMM_WORD_BITS 64ULL
+#define PMM_BITMAP_LEVELS 4
+#define PMM_NOT_FOUND UINT64_MAX
+
+#define PMM_REGION_MAX 64
+#define PMM_RESERVED_MAX 4
+
+/*
+ * Hierarchical bitmap. level[0] has one bit per block (set = free); every
+ * level above has one bit per non-zero word of the level below, up to a
+ * single top word. Finding the next free block is one tzcnt/bsf per level
+ * instead of a bit-by-bit scan.
+ */
+typedef struct {
+    uint64_t *level[PMM_BITMAP_LEVELS];
+    uint64_t words[PMM_BITMAP_LEVELS];
+    uint64_t bits;
+    unsigned int depth;
+} pmm_bitmap_t;
+
+typedef struct {
+    uint64_t first;
+    uint64_t last;
+} frame_range_t;
+
+/*
+ * Zones split physical memory by what constrained callers can reach: DMA
+ * below 16 MiB, DMA32 below 4 GiB and NORMAL above. Every zone runs its own
+ * buddy allocator: free_maps[k] marks the free blocks of 2^k frames (indexed
+ * from the zone start) that are not part of a larger free block. Allocation
+ * splits the smallest free block that fits; free coalesces with the buddy
+ * while it is free at the same order. Zone boundaries are aligned to the
+ * largest order, so a block never straddles two zones.
+ *
+ * The maps are sized from the highest available address in the memory map
+ * and carved out of available RAM at boot, so nothing scales with .bss.
+ */
+typedef struct {
+    const char *name;
+    uint64_t limit_frame;
+    uint64_t start_frame;
+    uint64_t end_frame;
+    uint64_t managed_frames;
+    uint64_t free_frames;
+    pmm_bitmap_t free_maps[PMM_MAX_ORDER + 1];
+    uint64_t alloc_hint[PMM_MAX_ORDER + 1];
+} pmm_zone_t;
+
+static pmm_zone_t zones[PMM_ZONE_COUNT] = {
+    [PMM_ZONE_DMA] = { .name = "DMA", .limit_frame = (16ULL << 20) / FRAME_SIZE },
+    [PMM_ZONE_DMA32] = { .name = "DMA32", .limit_frame = (4ULL << 30) / FRAME_SIZE },
+    [PMM_ZONE_NORMAL] = { .name = "NORMAL", .limit_frame = UINT64_MAX / FRAME_SIZE },
+};
+
+/*
+ * Per-CPU magazines of single frames sit in front of the zones. The common
+ * alloc/free pair only touches the local magazine; an empty magazine refills
+ * PMM_MAG_BATCH frames at once (one buddy block when possible) and a full
+ * one drains PMM_MAG_BATCH frames back, so the shared maps are visited once
+ * per batch instead of once per frame. The owner takes the magazine's lock
+ * on every access; it is only contended when a CPU short of memory drains
+ * the other magazines. Lock order is magazine, then zone.
+ *
+ * The magazine also carries this CPU's share of the allocation telemetry,
+ * written only by the owner with interrupts off and summed by pmm_stats().
+ * Latencies are TSC cycles bucketed by log2, so the percentiles are bucket
+ * upper bounds; the maximum is exact.
+ */
+#define PMM_MAG_SIZE 64
+#define PMM_MAG_BATCH 32
+#define PMM_MAG_BATCH_ORDER 5
+
+typedef struct {
+    spinlock_t lock;
+    uint64_t frames[PMM_MAG_SIZE];
+    uint32_t count;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t refills;
+    uint64_t drains;
+    uint64_t zero_hits;
+    uint64_t zero_misses;
+    uint64_t allocs;
+    uint64_t alloc_failures;
+    uint64_t frees;
+    uint64_t latency_max;
+    uint64_t latency_hist[PMM_LATENCY_BUCKETS];
+} __attribute__((aligned(64))) pmm_magazine_t;
+
+static pmm_magazine_t magazines[SMP_MAX_CPUS];
+
+/*
+ * Everything behind the magazines (zone maps, zero pool, free counts) is
+ * shared by all CPUs. Magazine refills and drains arrive in bursts from
+ * every CPU at once, and every free checks the zone maps under it, so the
+ * zone lock is an MCS queue lock.
+ */
+static mcslock_t zone_lock;
+
+/*
+ * Frames zeroed ahead of time by the idle loop, so page-table and
+ * anonymous-page allocations do not pay for clearing 4 KiB inline. They
+ * come from the direct map so the idle loop can reach them.
+ */
+#define PMM_ZERO_POOL_SIZE 32
+
+static uint64_t zero_pool[PMM_ZERO_POOL_SIZE];
+static uint32_t zero_pool_count = 0;
+
+static frame_range_t boot_info_range = { 0, 0 };
+static uint64_t metadata_phys = 0;
+static uint64_t metadata_frames = 0;
+static uint64_t total_frames = 0;
+static uint64_t invalid_ops = 0;
 
 extern uint8_t _kernel_start;
 extern uint8_t _kernel_end;
 
-static void bitmap_set(uint64_t frame) {
-    if (frame >= total_frames) {
-        return;
+static pmm_magazine_t *this_magazine(void) {
+    return &magazines[smp_cpu_id()];
+}
+
+static uint64_t stats_record_alloc(uint64_t start, uint64_t phys_addr) {
+    uint64_t cycles = rdtsc() - start;
+    unsigned int bucket = (cycles == 0) ? 0 : (unsigned int)(63 - __builtin_clzll(cycles));
+    uint64_t flags = irq_save();
+    pmm_magazine_t *mag = this_magazine();
+
+    if (bucket >= PMM_LATENCY_BUCKETS) {
+        bucket = PMM_LATENCY_BUCKETS - 1;
+    }
+    mag->latency_hist[bucket]++;
+    if (cycles > mag->latency_max) {
+        mag->latency_max = cycles;
     }
-    uint8_t mask = (uint8_t)(1U << (frame % 8));
-    uint8_t *cell = &frame_bitmap[frame / 8];
-    if ((*cell & mask) == 0) {
-        *cell |= mask;
-        used_frames++;
+
+    mag->allocs++;
+    if (phys_addr == 0) {
+        mag->alloc_failures++;
     }
+    irq_restore(flags);
+    return phys_addr;
 }
 
-static void bitmap_clear(uint64_t frame) {
-    if (frame >= total_frames) {
-        return;
+static inline uint64_t mask_from(uint64_t bit) {
+    return (bit >= PMM_WORD_BITS) ? 0 : (~0ULL << bit);
+}
+
+/* Words needed for a bitmap of `bits` entries, all levels included. */
+static uint64_t bitmap_words(uint64_t bits) {
+    uint64_t words = (bits + PMM_WORD_BITS - 1) / PMM_WORD_BITS;
+    uint64_t total = 0;
+
+    for (unsigned int l = 0; l < PMM_BITMAP_LEVELS; l++) {
+        if (words == 0) {
+            words = 1;
+        }
+        total += words;
+        if (words == 1) {
+            break;
+        }
+        words = (words + PMM_WORD_BITS - 1) / PMM_WORD_BITS;
+    }
+    return total;
+}
+
+static void bitmap_setup(pmm_bitmap_t *bm, uint64_t bits, uint64_t **pool) {
+    uint64_t words = (bits + PMM_WORD_BITS - 1) / PMM_WORD_BITS;
+
+    bm->bits = bits;
+    bm->depth = 0;
+    for (unsigned int l = 0; l < PMM_BITMAP_LEVELS; l++) {
+        if (words == 0) {
+            words = 1;
+        }
+        bm->level[l] = *pool;
+        bm->words[l] = words;
+        memset(bm->level[l], 0, words * sizeof(uint64_t));
+        *pool += words;
+        bm->depth = l + 1;
+        if (words == 1) {
+            break;
+        }
+        words = (words + PMM_WORD_BITS - 1) / PMM_WORD_BITS;
     }
-    uint8_t mask = (uint8_t)(1U << (frame % 8));
-    uint8_t *cell = &frame_bitmap[frame / 8];
-    if ((*cell & mask) != 0) {
-        *cell &= (uint8_t)~mask;
-        if (used_frames > 0) {
-            used_frames--;
+}
+
+/* Lay the zones over [0, frames); returns the map words they need. */
+static uint64_t zones_layout(uint64_t frames) {
+    uint64_t words = 0;
+    uint64_t start = 0;
+
+    for (unsigned int z = 0; z < PMM_ZONE_COUNT; z++) {
+        uint64_t end = (zones[z].limit_frame < frames) ? zones[z].limit_frame : frames;
+        if (end < start) {
+            end = start;
         }
+        zones[z].start_frame = start;
+        zones[z].end_frame = end;
+        if (end > start) {
+            for (unsigned int k = 0; k <= PMM_MAX_ORDER; k++) {
+                words += bitmap_words((end - start + (1ULL << k) - 1) >> k);
+            }
+        }
+        start = end;
     }
+    return words;
 }
 
-static bool bitmap_test(uint64_t frame) {
-    if (frame >= total_frames) {
-        return true;
+static pmm_zone_t *zone_for_frame(uint64_t frame) {
+    for (unsigned int z = 0; z < PMM_ZONE_COUNT; z++) {
+        if (frame < zones[z].limit_frame) {
+            return &zones[z];
+        }
     }
-    return (frame_bitmap[frame / 8] & (1U << (frame % 8))) != 0;
+    return &zones[PMM_ZONE_NORMAL];
 }
 
-static void mark_region(uint64_t addr, uint64_t len, bool available) {
-    if (len == 0 || addr >= PMM_MAX_MEMORY) {
-        return;
+/*
+ * Find `count` frames inside an available region, clear of every reserved
+ * range and below `limit_frame` (the part of RAM the kernel can address yet).
+ */
+static uint64_t carve_frames(const pmm_region_t *regions, size_t region_count,
+                             const frame_range_t *reserved, size_t reserved_count,
+                             uint64_t count, uint64_t limit_frame) {
+    for (size_t i = 0; i < region_count; i++) {
+        uint64_t first = (regions[i].base + FRAME_SIZE - 1) / FRAME_SIZE;
+        uint64_t last = (regions[i].base + regions[i].length) / FRAME_SIZE;
+        bool moved = true;
+
+        if (last > limit_frame) {
+            last = limit_frame;
+        }
+
+        while (moved && first + count <= last) {
+            moved = false;
+            for (size_t r = 0; r < reserved_count; r++) {
+                if (reserved[r].first < first + count && reserved[r].last > first) {
+                    first = reserved[r].last;
+                    moved = true;
+                }
+            }
+        }
+
+        if (first + count <= last) {
+            return first;
+        }
     }
 
-    uint64_t end = addr + len;
-    if (end > PMM_MAX_MEMORY) {
-        end = PMM_MAX_MEMORY;
+    return PMM_NOT_FOUND;
+}
+
+static bool bitmap_test(const pmm_bitmap_t *bm, uint64_t idx) {
+    if (idx >= bm->bits) {
+        return false;
     }
+    return (bm->level[0][idx / PMM_WORD_BITS] & (1ULL << (idx % PMM_WORD_BITS))) != 0;
+}
 
-    uint64_t first = addr / FRAME_SIZE;
-    uint64_t last = (end + FRAME_SIZE - 1) / FRAME_SIZE;
+static void bitmap_set(pmm_bitmap_t *bm, uint64_t idx) {
+    for (unsigned int l = 0; l < bm->depth; l++) {
+        uint64_t *word = &bm->level[l][idx / PMM_WORD_BITS];
+        bool was_empty = (*word == 0);
+        *word |= 1ULL << (idx % PMM_WORD_BITS);
+        if (!was_empty) {
+            break;
+        }
+        idx /= PMM_WORD_BITS;
+    }
+}
 
-    for (uint64_t f = first; f < last; f++) {
-        if (available) {
-            bitmap_clear(f);
-        } else {
-            bitmap_set(f);
+static void bitmap_clear(pmm_bitmap_t *bm, uint64_t idx) {
+    for (unsigned int l = 0; l < bm->depth; l++) {
+        uint64_t *word = &bm->level[l][idx / PMM_WORD_BITS];
+        *word &= ~(1ULL << (idx % PMM_WORD_BITS));
+        if (*word != 0) {
+            break;
         }
+        idx /= PMM_WORD_BITS;
     }
 }
 
+/* First set bit in [from, limit), or PMM_NOT_FOUND. */
+static uint64_t bitmap_find(const pmm_bitmap_t *bm, uint64_t from, uint64_t limit) {
+    uint64_t idx = from;
+    unsigned int l = 0;
+
+    if (limit > bm->bits) {
+        limit = bm->bits;
+    }
+    if (from >= limit) {
+        return PMM_NOT_FOUND;
+    }
+
+    /* Climb until a word has a set bit at or after the cursor. */
+    while (l < bm->depth) {
+        uint64_t w = idx / PMM_WORD_BITS;
+        uint64_t bits;
+
+        if (w >= bm->words[l]) {
+            return PMM_NOT_FOUND;
+        }
+        bits = bm->level[l][w] & mask_from(idx % PMM_WORD_BITS);
+        if (bits != 0) {
+            idx = w * PMM_WORD_BITS + (uint64_t)__builtin_ctzll(bits);
+            break;
+        }
+        idx = w + 1;
+        l++;
+    }
+    if (l == bm->depth) {
+        return PMM_NOT_FOUND;
+    }
+
+    /* Descend along the lowest set bit of each child word. */
+    while (l > 0) {
+        l--;
+        idx = idx * PMM_WORD_BITS + (uint64_t)__builtin_ctzll(bm->level[l][idx]);
+    }
+
+    return (idx < limit) ? idx : PMM_NOT_FOUND;
+}
+
+static bool block_is_free(const pmm_zone_t *z, uint64_t rel, unsigned int order) {
+    for (unsigned int k = order; k <= PMM_MAX_ORDER; k++) {
+        if (bitmap_test(&z->free_maps[k], rel >> k)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void buddy_insert(pmm_zone_t *z, uint64_t rel, unsigned int order) {
+    uint64_t block = rel >> order;
+
+    z->free_frames += 1ULL << order;
+    while (order < PMM_MAX_ORDER) {
+        uint64_t buddy = block ^ 1ULL;
+        if (!bitmap_test(&z->free_maps[order], buddy)) {
+            break;
+        }
+        bitmap_clear(&z->free_maps[order], buddy);
+        block >>= 1;
+        order++;
+    }
+
+    bitmap_set(&z->free_maps[order], block);
+}
+
+/* Remove free block `block` of order k and split it down to `order`. */
+static uint64_t buddy_take_block(pmm_zone_t *z, unsigned int k, uint64_t block, unsigned int order) {
+    bitmap_clear(&z->free_maps[k], block);
+    z->alloc_hint[k] = block;
+
+    /* Split down to the requested order, freeing the upper halves. */
+    while (k > order) {
+        k--;
+        block <<= 1;
+        bitmap_set(&z->free_maps[k], block | 1ULL);
+    }
+
+    z->free_frames -= 1ULL << order;
+    return block << order;
+}
+
+/* Next-fit: resume at the per-order hint and wrap. Returns a zone-relative frame. */
+static uint64_t buddy_take(pmm_zone_t *z, unsigned int order) {
+    for (unsigned int k = order; k <= PMM_MAX_ORDER; k++) {
+        pmm_bitmap_t *map = &z->free_maps[k];
+        uint64_t block = bitmap_find(map, z->alloc_hint[k], map->bits);
+
+        if (block == PMM_NOT_FOUND) {
+            block = bitmap_find(map, 0, z->alloc_hint[k]);
+        }
+        if (block != PMM_NOT_FOUND) {
+            return buddy_take_block(z, k, block, order);
+        }
+    }
+
+    return PMM_NOT_FOUND;
+}
+
+/* First-fit for a block that ends at or below zone-relative frame `limit`. */
+static uint64_t buddy_take_below(pmm_zone_t *z, unsigned int order, uint64_t limit) {
+    for (unsigned int k = order; k <= PMM_MAX_ORDER; k++) {
+        uint64_t block = bitmap_find(&z->free_maps[k], 0, (limit + (1ULL << k) - 1) >> k);
+        if (block != PMM_NOT_FOUND && (block << k) + (1ULL << order) <= limit) {
+            return buddy_take_block(z, k, block, order);
+        }
+    }
+
+    return PMM_NOT_FOUND;
+}
+
+static void free_range(uint64_t first, uint64_t last) {
+    while (first < last) {
+        pmm_zone_t *z = zone_for_frame(first);
+        uint64_t end = (last < z->end_frame) ? last : z->end_frame;
+        uint64_t rel = first - z->start_frame;
+        unsigned int order = 0;
+
+        while (order < PMM_MAX_ORDER &&
+               (rel & ((2ULL << order) - 1)) == 0 &&
+               first + (2ULL << order) <= end) {
+            order++;
+        }
+
+        buddy_insert(z, rel, order);
+        z->managed_frames += 1ULL << order;
+        first += 1ULL << order;
+    }
+}
+
+static void seed_range(uint64_t first, uint64_t last, const frame_range_t *reserved, size_t count) {
+    if (first >= last) {
+        return;
+    }
+    if (count == 0) {
+        free_range(first, last);
+        return;
+    }
+    if (reserved->last <= first || reserved->first >= last) {
+        seed_range(first, last, reserved + 1, count - 1);
+        return;
+    }
+    seed_range(first, reserved->first, reserved + 1, count - 1);
+    seed_range(reserved->last, last, reserved + 1, count - 1);
+}
+
+static size_t sort_and_merge(pmm_region_t *regions, size_t count) {
+    size_t out = 0;
+
+    for (size_t i = 1; i < count; i++) {
+        pmm_region_t key = regions[i];
+        size_t j = i;
+        while (j > 0 && regions[j - 1].base > key.base) {
+            regions[j] = regions[j - 1];
+            j--;
+        }
+        regions[j] = key;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (regions[i].length == 0) {
+            continue;
+        }
+        if (out > 0 && regions[i].base <= regions[out - 1].base + regions[out - 1].length) {
+            uint64_t end = regions[i].base + regions[i].length;
+            if (end > regions[out - 1].base + regions[out - 1].length) {
+                regions[out - 1].length = end - regions[out - 1].base;
+            }
+            continue;
+        }
+        regions[out++] = regions[i];
+    }
+
+    return out;
+}
+
 void pmm_init(uint32_t multiboot_info_addr) {
-    uint8_t *mb = (uint8_t *)(uintptr_t)multiboot_info_addr;
+    uint8_t *mb = (uint8_t *)vmm_phys_to_virt(multiboot_info_addr);
     uint32_t mb_total_size = *(uint32_t *)mb;
-
-    uint64_t highest_available_end = 16ULL * 1024ULL * 1024ULL;
+    pmm_region_t regions[PMM_REGION_MAX];
+    size_t region_count = 0;
 
     struct multiboot_tag *tag = (struct multiboot_tag *)(mb + 8);
     while ((uint8_t *)tag < mb + mb_total_size && tag->type != MULTIBOOT_TAG_TYPE_END) {
@@ -83,11 +483,10 @@ void pmm_init(uint32_t multiboot_info_addr) {
 
             while (entry_ptr < entry_end) {
                 struct multiboot_mmap_entry *entry = (struct multiboot_mmap_entry *)entry_ptr;
-                if (entry->type == MULTIBOOT_MEMORY_AVAILABLE) {
-                    uint64_t candidate_end = entry->addr + entry->len;
-                    if (candidate_end > highest_available_end) {
-                        highest_available_end = candidate_end;
-                    }
+                if (entry->type == MULTIBOOT_MEMORY_AVAILABLE && region_count < PMM_REGION_MAX) {
+                    regions[region_count].base = entry->addr;
+                    regions[region_count].length = entry->len;
+                    region_count++;
                 }
                 entry_ptr += mmap->entry_size;
             }
@@ -96,72 +495,437 @@ void pmm_init(uint32_t multiboot_info_addr) {
         tag = (struct multiboot_tag *)((uint8_t *)tag + ((tag->size + 7) & ~7U));
     }
 
-    if (highest_available_end > PMM_MAX_MEMORY) {
-        highest_available_end = PMM_MAX_MEMORY;
+    /* Later subsystems still read boot info tags; keep them out of the allocator. */
+    boot_info_range.first = multiboot_info_addr / FRAME_SIZE;
+    boot_info_range.last = ((uint64_t)multiboot_info_addr + mb_total_size + FRAME_SIZE - 1) / FRAME_SIZE;
+
+    pmm_init_regions(regions, region_count);
+}
+
+void pmm_init_regions(const pmm_region_t *regions, size_t count) {
+    uint64_t highest_available_end = PMM_MIN_MEMORY;
+    pmm_region_t sorted[PMM_REGION_MAX];
+    frame_range_t reserved[PMM_RESERVED_MAX];
+    size_t reserved_count = 0;
+    uint64_t *pool;
+    uint64_t meta_first = PMM_NOT_FOUND;
+
+    memset(magazines, 0, sizeof(magazines));
+    for (unsigned int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        spin_init(&magazines[cpu].lock, "pmm_magazine");
+    }
+    mcs_init(&zone_lock, "pmm_zone");
+    zero_pool_count = 0;
+    if (count > PMM_REGION_MAX) {
+        count = PMM_REGION_MAX;
+    }
+    for (size_t i = 0; i < count; i++) {
+        sorted[i] = regions[i];
+        if (sorted[i].length > UINT64_MAX - sorted[i].base) {
+            sorted[i].length = UINT64_MAX - sorted[i].base;
+        }
+    }
+    count = sort_and_merge(sorted, count);
+
+    for (size_t i = 0; i < count; i++) {
+        uint64_t candidate_end = sorted[i].base + sorted[i].length;
+        if (candidate_end > highest_available_end) {
+            highest_available_end = candidate_end;
+        }
     }
 
     total_frames = highest_available_end / FRAME_SIZE;
-    if (total_frames == 0) {
-        total_frames = 1;
+    invalid_ops = 0;
+
+    reserved[reserved_count].first = 0;
+    reserved[reserved_count].last = (1024ULL * 1024ULL) / FRAME_SIZE;
+    reserved_count++;
+
+    uint64_t kstart = (uint64_t)(uintptr_t)&_kernel_start;
+    uint64_t kend = (uint64_t)(uintptr_t)&_kernel_end;
+    if (kend > kstart) {
+        reserved[reserved_count].first = kstart / FRAME_SIZE;
+        reserved[reserved_count].last = (kend + FRAME_SIZE - 1) / FRAME_SIZE;
+        reserved_count++;
     }
 
-    memset(frame_bitmap, 0xFF, sizeof(frame_bitmap));
-    used_frames = total_frames;
+    if (boot_info_range.last > boot_info_range.first) {
+        reserved[reserved_count++] = boot_info_range;
+    }
 
-    tag = (struct multiboot_tag *)(mb + 8);
-    while ((uint8_t *)tag < mb + mb_total_size && tag->type != MULTIBOOT_TAG_TYPE_END) {
-        if (tag->type == MULTIBOOT_TAG_TYPE_MMAP) {
-            struct multiboot_tag_mmap *mmap = (struct multiboot_tag_mmap *)tag;
-            uint8_t *entry_ptr = (uint8_t *)mmap + sizeof(struct multiboot_tag_mmap);
-            uint8_t *entry_end = (uint8_t *)tag + tag->size;
+    /* If no region can hold the maps, track less memory rather than none. */
+    while (total_frames > 0) {
+        uint64_t bytes = zones_layout(total_frames) * sizeof(uint64_t);
+        metadata_frames = (bytes + FRAME_SIZE - 1) / FRAME_SIZE;
+        meta_first = carve_frames(sorted, count, reserved, reserved_count, metadata_frames,
+                                  vmm_direct_map_limit() / FRAME_SIZE);
+        if (meta_first != PMM_NOT_FOUND) {
+            break;
+        }
+        total_frames /= 2;
+    }
+    if (meta_first == PMM_NOT_FOUND) {
+        metadata_phys = 0;
+        metadata_frames = 0;
+        total_frames = 0;
+        (void)zones_layout(0);
+        return;
+    }
 
-            while (entry_ptr < entry_end) {
-                struct multiboot_mmap_entry *entry = (struct multiboot_mmap_entry *)entry_ptr;
-                if (entry->type == MULTIBOOT_MEMORY_AVAILABLE) {
-                    mark_region(entry->addr, entry->len, true);
-                }
-                entry_ptr += mmap->entry_size;
+    metadata_phys = meta_first * FRAME_SIZE;
+    reserved[reserved_count].first = meta_first;
+    reserved[reserved_count].last = meta_first + metadata_frames;
+    reserved_count++;
+
+    pool = (uint64_t *)vmm_phys_to_virt(metadata_phys);
+    for (unsigned int zi = 0; zi < PMM_ZONE_COUNT; zi++) {
+        pmm_zone_t *z = &zones[zi];
+        uint64_t span = z->end_frame - z->start_frame;
+
+        z->managed_frames = 0;
+        z->free_frames = 0;
+        for (unsigned int k = 0; k <= PMM_MAX_ORDER; k++) {
+            if (span > 0) {
+                bitmap_setup(&z->free_maps[k], (span + (1ULL << k) - 1) >> k, &pool);
+            } else {
+                memset(&z->free_maps[k], 0, sizeof(z->free_maps[k]));
             }
+            z->alloc_hint[k] = 0;
         }
+    }
 
-        tag = (struct multiboot_tag *)((uint8_t *)tag + ((tag->size + 7) & ~7U));
+    for (size_t i = 0; i < count; i++) {
+        /* Only whole frames inside a region are usable. */
+        uint64_t first = (sorted[i].base + FRAME_SIZE - 1) / FRAME_SIZE;
+        uint64_t last = (sorted[i].base + sorted[i].length) / FRAME_SIZE;
+        if (last > total_frames) {
+            last = total_frames;
+        }
+        seed_range(first, last, reserved, reserved_count);
     }
+}
 
-    mark_region(0, 1024ULL * 1024ULL, false);
+/*
+ * Highest eligible zone first, so constrained memory is the last to go.
+ * Zones entirely below the limit take any block; the zone straddling the
+ * limit does a bounded first-fit.
+ */
+static uint64_t zones_take(unsigned int order, uint64_t max_frame) {
+    for (int zi = PMM_ZONE_COUNT - 1; zi >= 0; zi--) {
+        pmm_zone_t *z = &zones[zi];
+        uint64_t rel;
 
-    uint64_t kstart = (uint64_t)(uintptr_t)&_kernel_start;
-    uint64_t kend = (uint64_t)(uintptr_t)&_kernel_end;
-    mark_region(kstart, kend - kstart, false);
+        if (z->start_frame >= max_frame || z->free_frames < (1ULL << order)) {
+            continue;
+        }
+
+        if (z->end_frame <= max_frame) {
+            rel = buddy_take(z, order);
+        } else {
+            rel = buddy_take_below(z, order, max_frame - z->start_frame);
+        }
+        if (rel != PMM_NOT_FOUND) {
+            return z->start_frame + rel;
+        }
+    }
+
+    return PMM_NOT_FOUND;
 }
 
-uint64_t pmm_alloc_frame(void) {
-    for (uint64_t frame = 0; frame < total_frames; frame++) {
-        if (!bitmap_test(frame)) {
-            bitmap_set(frame);
-            return frame * FRAME_SIZE;
+static void zones_give(uint64_t frame, unsigned int order) {
+    pmm_zone_t *z = zone_for_frame(frame);
+    buddy_insert(z, frame - z->start_frame, order);
+}
+
+static bool frame_is_valid(uint64_t phys_addr, unsigned int order) {
+    uint64_t frame = phys_addr / FRAME_SIZE;
+    pmm_zone_t *z = zone_for_frame(frame);
+
+    return order <= PMM_MAX_ORDER && (phys_addr % FRAME_SIZE) == 0 &&
+           (frame & ((1ULL << order) - 1)) == 0 &&
+           frame + (1ULL << order) <= z->end_frame &&
+           !block_is_free(z, frame - z->start_frame, order);
+}
+
+/* Refill and drain run with the magazine's lock held. */
+static void magazine_refill(pmm_magazine_t *mag) {
+    mcs_node_t node;
+    uint64_t flags = mcs_lock_irqsave(&zone_lock, &node);
+    uint64_t block = zones_take(PMM_MAG_BATCH_ORDER, UINT64_MAX);
+
+    mag->refills++;
+    if (block != PMM_NOT_FOUND) {
+        /* Stack the block so pops hand frames out in ascending order. */
+        for (uint32_t i = PMM_MAG_BATCH; i > 0; i--) {
+            mag->frames[mag->count++] = block + i - 1;
+        }
+    } else {
+        while (mag->count < PMM_MAG_BATCH) {
+            uint64_t frame = zones_take(0, UINT64_MAX);
+            if (frame == PMM_NOT_FOUND) {
+                break;
+            }
+            mag->frames[mag->count++] = frame;
         }
     }
-    return 0;
+    mcs_unlock_irqrestore(&zone_lock, &node, flags);
 }
 
-uint64_t pmm_alloc_frame_low(uint64_t max_phys_addr) {
-    uint64_t max_frame = max_phys_addr / FRAME_SIZE;
-    if (max_frame > total_frames) {
-        max_frame = total_frames;
+/* Also needs zone_lock. */
+static void magazine_drain_locked(pmm_magazine_t *mag, uint32_t keep) {
+    mag->drains++;
+    while (mag->count > keep) {
+        zones_give(mag->frames[--mag->count], 0);
+    }
+}
+
+static void magazine_drain(pmm_magazine_t *mag, uint32_t keep) {
+    mcs_node_t node;
+    uint64_t flags;
+
+    if (mag->count <= keep) {
+        return;
     }
+    flags = mcs_lock_irqsave(&zone_lock, &node);
+    magazine_drain_locked(mag, keep);
+    mcs_unlock_irqrestore(&zone_lock, &node, flags);
+}
 
-    for (uint64_t frame = 0; frame < max_frame; frame++) {
-        if (!bitmap_test(frame)) {
-            bitmap_set(frame);
-            return frame * FRAME_SIZE;
+static bool magazine_holds(const pmm_magazine_t *mag, uint64_t first, uint64_t last) {
+    for (uint32_t i = 0; i < mag->count; i++) {
+        if (mag->frames[i] >= first && mag->frames[i] < last) {
+            return true;
         }
     }
+    return false;
+}
+
+static uint64_t cached_frames(void) {
+    uint64_t frames = zero_pool_count;
+    for (unsigned int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        frames += magazines[cpu].count;
+    }
+    return frames;
+}
+
+static bool zero_pool_holds(uint64_t first, uint64_t last) {
+    for (uint32_t i = 0; i < zero_pool_count; i++) {
+        if (zero_pool[i] >= first && zero_pool[i] < last) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void pmm_cache_drain(void) {
+    mcs_node_t node;
+    uint64_t flags;
+
+    for (unsigned int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        pmm_magazine_t *mag = &magazines[cpu];
+
+        flags = spin_lock_irqsave(&mag->lock);
+        magazine_drain(mag, 0);
+        spin_unlock_irqrestore(&mag->lock, flags);
+    }
+    flags = mcs_lock_irqsave(&zone_lock, &node);
+    while (zero_pool_count > 0) {
+        zones_give(zero_pool[--zero_pool_count], 0);
+    }
+    mcs_unlock_irqrestore(&zone_lock, &node, flags);
+}
+
+static void zero_frame(uint64_t phys_addr) {
+    void *dst = vmm_phys_to_virt(phys_addr);
+    uint64_t count = FRAME_SIZE / sizeof(uint64_t);
+
+    __asm__ volatile ("rep stosq" : "+D"(dst), "+c"(count) : "a"(0ULL) : "memory");
+}
+
+static uint64_t zones_take_locked(unsigned int order, uint64_t max_frame) {
+    mcs_node_t node;
+    uint64_t flags = mcs_lock_irqsave(&zone_lock, &node);
+    uint64_t frame = zones_take(order, max_frame);
+
+    mcs_unlock_irqrestore(&zone_lock, &node, flags);
+    return frame;
+}
+
+/* Frames are zeroed outside the zone lock; only the pool push is locked. */
+bool pmm_zero_pool_refill(unsigned int budget) {
+    uint64_t limit_frame = vmm_direct_map_limit() / FRAME_SIZE;
+    mcs_node_t node;
+    uint64_t flags;
+
+    while (budget > 0 && zero_pool_count < PMM_ZERO_POOL_SIZE) {
+        uint64_t frame = zones_take_locked(0, limit_frame);
+        if (frame == PMM_NOT_FOUND) {
+            return false;
+        }
+        zero_frame(frame * FRAME_SIZE);
+        flags = mcs_lock_irqsave(&zone_lock, &node);
+        if (zero_pool_count < PMM_ZERO_POOL_SIZE) {
+            zero_pool[zero_pool_count++] = frame;
+        } else {
+            zones_give(frame, 0);
+        }
+        mcs_unlock_irqrestore(&zone_lock, &node, flags);
+        budget--;
+    }
+
+    return zero_pool_count < PMM_ZERO_POOL_SIZE;
+}
+
+static uint64_t alloc_pages_low(unsigned int order, uint64_t max_frame) {
+    uint64_t frame = zones_take_locked(order, max_frame);
+
+    if (frame == PMM_NOT_FOUND && cached_frames() != 0) {
+        /* Cached frames may complete a block or sit below the limit. */
+        pmm_cache_drain();
+        frame = zones_take_locked(order, max_frame);
+    }
+    return (frame == PMM_NOT_FOUND) ? 0 : frame * FRAME_SIZE;
+}
+
+/* Interrupts stay off so the caller cannot migrate off its magazine. */
+static uint64_t alloc_frame_cached(void) {
+    uint64_t flags = irq_save();
+    pmm_magazine_t *mag = this_magazine();
+    uint64_t phys;
+
+    spin_lock(&mag->lock);
+    if (mag->count != 0) {
+        mag->hits++;
+    } else {
+        mag->misses++;
+        magazine_refill(mag);
+        if (mag->count == 0) {
+            spin_unlock_irqrestore(&mag->lock, flags);
+            return alloc_pages_low(0, UINT64_MAX);
+        }
+    }
+
+    phys = mag->frames[--mag->count] * FRAME_SIZE;
+    spin_unlock_irqrestore(&mag->lock, flags);
+    return phys;
+}
+
+uint64_t pmm_alloc_pages_low(unsigned int order, uint64_t max_phys_addr) {
+    uint64_t start = rdtsc();
+
+    if (order > PMM_MAX_ORDER) {
+        invalid_ops++;
+        return 0;
+    }
 
-    return 0;
+    return stats_record_alloc(start, alloc_pages_low(order, max_phys_addr / FRAME_SIZE));
 }
 
+uint64_t pmm_alloc_pages(unsigned int order) {
+    if (order == 0) {
+        return pmm_alloc_frame();
+    }
+    return pmm_alloc_pages_low(order, UINT64_MAX);
+}
+
+void pmm_free_pages(uint64_t phys_addr, unsigned int order) {
+    uint64_t frame = phys_addr / FRAME_SIZE;
+    pmm_magazine_t *mag;
+    mcs_node_t node;
+    uint64_t flags;
+
+    if (order == 0) {
+        pmm_free_frame(phys_addr);
+        return;
+    }
+
+    flags = irq_save();
+    mag = this_magazine();
+    spin_lock(&mag->lock);
+    mcs_lock(&zone_lock, &node);
+    if (!frame_is_valid(phys_addr, order) ||
+        magazine_holds(mag, frame, frame + (1ULL << order)) ||
+        zero_pool_holds(frame, frame + (1ULL << order))) {
+        invalid_ops++;
+    } else {
+        mag->frees++;
+        zones_give(frame, order);
+    }
+    mcs_unlock(&zone_lock, &node);
+    spin_unlock_irqrestore(&mag->lock, flags);
+}
+
+uint64_t pmm_alloc_frame(void) {
+    uint64_t start = rdtsc();
+    return stats_record_alloc(start, alloc_frame_cached());
+}
+
+uint64_t pmm_alloc_frame_low(uint64_t max_phys_addr) {
+    return pmm_alloc_pages_low(0, max_phys_addr);
+}
+
+uint64_t pmm_alloc_zeroed_frame(void) {
+    uint64_t start = rdtsc();
+    uint64_t frame = 0;
+    pmm_magazine_t *mag;
+    mcs_node_t node;
+    uint64_t flags;
+
+    flags = irq_save();
+    mag = this_magazine();
+    mcs_lock(&zone_lock, &node);
+    if (zero_pool_count > 0) {
+        frame = zero_pool[--zero_pool_count] * FRAME_SIZE;
+    }
+    mcs_unlock(&zone_lock, &node);
+    if (frame != 0) {
+        mag->zero_hits++;
+        irq_restore(flags);
+        return stats_record_alloc(start, frame);
+    }
+    mag->zero_misses++;
+    irq_restore(flags);
+
+    frame = alloc_pages_low(0, vmm_direct_map_limit() / FRAME_SIZE);
+    if (frame != 0) {
+        zero_frame(frame);
+    }
+    return stats_record_alloc(start, frame);
+}
+
+/*
+ * The double-free checks read the zone bitmaps and the zero pool, so they
+ * run under zone_lock together with the push: another CPU cannot free or
+ * take the frame between the check and the free.
+ */
 void pmm_free_frame(uint64_t phys_addr) {
-    bitmap_clear(phys_addr / FRAME_SIZE);
+    uint64_t flags = irq_save();
+    pmm_magazine_t *mag = this_magazine();
+    uint64_t frame = phys_addr / FRAME_SIZE;
+    mcs_node_t node;
+
+    spin_lock(&mag->lock);
+    mcs_lock(&zone_lock, &node);
+    if (!frame_is_valid(phys_addr, 0) || magazine_holds(mag, frame, frame + 1) ||
+        zero_pool_holds(frame, frame + 1)) {
+        invalid_ops++;
+    } else {
+        mag->frees++;
+        if (mag->count == PMM_MAG_SIZE) {
+            magazine_drain_locked(mag, PMM_MAG_SIZE - PMM_MAG_BATCH);
+        }
+        mag->frames[mag->count++] = frame;
+    }
+    mcs_unlock(&zone_lock, &node);
+    spin_unlock_irqrestore(&mag->lock, flags);
+}
+
+static uint64_t free_frames_total(void) {
+    uint64_t frames = cached_frames();
+    for (unsigned int z = 0; z < PMM_ZONE_COUNT; z++) {
+        frames += zones[z].free_frames;
+    }
+    return frames;
 }
 
 uint64_t pmm_total_kib(void) {
@@ -169,12 +933,132 @@ uint64_t pmm_total_kib(void) {
 }
 
 uint64_t pmm_used_kib(void) {
-    return (used_frames * FRAME_SIZE) / 1024ULL;
+    uint64_t free_frames = free_frames_total();
+    if (free_frames > total_frames) {
+        return 0;
+    }
+    return ((total_frames - free_frames) * FRAME_SIZE) / 1024ULL;
 }
 
 uint64_t pmm_free_kib(void) {
-    if (used_frames > total_frames) {
+    return (free_frames_total() * FRAME_SIZE) / 1024ULL;
+}
+
+uint64_t pmm_free_blocks(unsigned int order) {
+    uint64_t count = 0;
+
+    if (order > PMM_MAX_ORDER) {
         return 0;
     }
-    return ((total_frames - used_frames) * FRAME_SIZE) / 1024ULL;
+    for (unsigned int z = 0; z < PMM_ZONE_COUNT; z++) {
+        const pmm_bitmap_t *map = &zones[z].free_maps[order];
+        for (uint64_t w = 0; w < map->words[0]; w++) {
+            count += (uint64_t)__builtin_popcountll(map->level[0][w]);
+        }
+    }
+    return count;
+}
+
+uint64_t pmm_invalid_ops(void) {
+    return invalid_ops;
+}
+
+uint64_t pmm_metadata_kib(void) {
+    return (metadata_frames * FRAME_SIZE) / 1024ULL;
+}
+
+bool pmm_zone_info(unsigned int zone, pmm_zone_info_t *out) {
+    const pmm_zone_t *z;
+
+    if (zone >= PMM_ZONE_COUNT || !out) {
+        return false;
+    }
+
+    z = &zones[zone];
+    out->name = z->name;
+    out->base = z->start_frame * FRAME_SIZE;
+    out->end = z->end_frame * FRAME_SIZE;
+    out->managed_kib = (z->managed_frames * FRAME_SIZE) / 1024ULL;
+    out->free_kib = (z->free_frames * FRAME_SIZE) / 1024ULL;
+    return true;
+}
+
+void pmm_cache_stats(pmm_cache_stats_t *out) {
+    if (!out) {
+        return;
+    }
+
+    memset(out, 0, sizeof(*out));
+    for (unsigned int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        out->hits += magazines[cpu].hits;
+        out->misses += magazines[cpu].misses;
+        out->refills += magazines[cpu].refills;
+        out->drains += magazines[cpu].drains;
+        out->cached_frames += magazines[cpu].count;
+        out->zero_hits += magazines[cpu].zero_hits;
+        out->zero_misses += magazines[cpu].zero_misses;
+    }
+    out->zeroed_frames = zero_pool_count;
+}
+
+static uint64_t latency_percentile(const pmm_stats_t *stats, uint64_t total, unsigned int permille) {
+    uint64_t target = (total * permille + 999) / 1000;
+    uint64_t seen = 0;
+
+    for (unsigned int b = 0; b < PMM_LATENCY_BUCKETS; b++) {
+        seen += stats->latency_hist[b];
+        if (seen >= target && seen != 0) {
+            uint64_t bound = (2ULL << b) - 1;
+            return (bound < stats->latency_max) ? bound : stats->latency_max;
+        }
+    }
+    return stats->latency_max;
+}
+
+void pmm_stats(pmm_stats_t *out) {
+    uint64_t free_frames = 0;
+    uint64_t samples = 0;
+
+    if (!out) {
+        return;
+    }
+
+    memset(out, 0, sizeof(*out));
+    for (unsigned int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        const pmm_magazine_t *mag = &magazines[cpu];
+
+        out->allocs += mag->allocs;
+        out->alloc_failures += mag->alloc_failures;
+        out->frees += mag->frees;
+        if (mag->latency_max > out->latency_max) {
+            out->latency_max = mag->latency_max;
+        }
+        for (unsigned int b = 0; b < PMM_LATENCY_BUCKETS; b++) {
+            out->latency_hist[b] += mag->latency_hist[b];
+        }
+    }
+
+    for (unsigned int k = 0; k <= PMM_MAX_ORDER; k++) {
+        out->free_blocks[k] = pmm_free_blocks(k);
+        free_frames += out->free_blocks[k] << k;
+    }
+
+    /*
+     * Unusable free space index: the share of free memory sitting in blocks
+     * too small to satisfy an order-k request. 0 is perfectly compact.
+     */
+    for (unsigned int k = 0; k <= PMM_MAX_ORDER; k++) {
+        uint64_t usable = 0;
+        for (unsigned int j = k; j <= PMM_MAX_ORDER; j++) {
+            usable += out->free_blocks[j] << j;
+        }
+        out->unusable_permille[k] = (free_frames == 0) ? 1000 :
+            (uint32_t)(((free_frames - usable) * 1000) / free_frames);
+    }
+
+    for (unsigned int b = 0; b < PMM_LATENCY_BUCKETS; b++) {
+        samples += out->latency_hist[b];
+    }
+    out->latency_p50 = latency_percentile(out, samples, 500);
+    out->latency_p99 = latency_percentile(out, samples, 990);
 }
@@ -1,53 +1,40 @@
+#include <kernel/lock.h>
 #include <kernel/pty.h>
+#include <kernel/ring.h>
 #include <kernel/string.h>
+#include <kernel/waitqueue.h>
 
 #define PTY_MAX 8
-#define PTY_QUEUE_SIZE 2048
+/* 2048 bytes each way. */
+#define PTY_QUEUE_ORDER 11
+
+RING_DEFINE(pty_ring, uint8_t, PTY_QUEUE_ORDER)
 
 typedef struct {
     bool allocated;
-    uint8_t m2s[PTY_QUEUE_SIZE];
-    size_t m2s_head;
-    size_t m2s_tail;
-    uint8_t s2m[PTY_QUEUE_SIZE];
-    size_t s2m_head;
-    size_t s2m_tail;
+    pty_ring_t m2s;
+    pty_ring_t s2m;
+    /* Slave readers wait for m2s data, master readers for s2m data. */
+    wait_queue_t slave_wait;
+    wait_queue_t master_wait;
 } pty_slot_t;
 
 static pty_slot_t g_ptys[PTY_MAX];
+/* Guards slot allocation, and serialises each ring's writers and readers down to one of each. */
+static spinlock_t g_pty_lock;
 static uint64_t g_pty_dropped_bytes = 0;
 static uint64_t g_pty_invalid_ops = 0;
 
-static size_t pty_queue_write(uint8_t *queue, size_t *head, size_t *tail, const uint8_t *buf, size_t len) {
-    size_t written = 0;
-
-    while (written < len) {
-        size_t next = (*head + 1) % PTY_QUEUE_SIZE;
-        if (next == *tail) {
-            g_pty_dropped_bytes += (len - written);
-            break;
-        }
-        queue[*head] = buf[written];
-        *head = next;
-        written++;
-    }
+static size_t pty_queue_write(pty_ring_t *queue, const uint8_t *buf, size_t len) {
+    size_t written = pty_ring_push_n(queue, buf, len);
 
+    g_pty_dropped_bytes += len - written;
     return written;
 }
 
-static size_t pty_queue_read(uint8_t *queue, size_t *head, size_t *tail, uint8_t *buf, size_t len) {
-    size_t read = 0;
-
-    while (read < len && *tail != *head) {
-        buf[read++] = queue[*tail];
-        *tail = (*tail + 1) % PTY_QUEUE_SIZE;
-    }
-
-    return read;
-}
-
 void pty_init(void) {
     memset(g_ptys, 0, sizeof(g_ptys));
+    spin_init(&g_pty_lock, "pty");
     g_pty_dropped_bytes = 0;
     g_pty_invalid_ops = 0;
 }
@@ -57,49 +44,100 @@ bool pty_is_valid(int pty_id) {
 }
 
 int pty_alloc(void) {
+    uint64_t flags = spin_lock_irqsave(&g_pty_lock);
+    int id = -1;
+
     for (int i = 0; i < PTY_MAX; i++) {
         if (!g_ptys[i].allocated) {
             g_ptys[i].allocated = true;
-            g_ptys[i].m2s_head = 0;
-            g_ptys[i].m2s_tail = 0;
-            g_ptys[i].s2m_head = 0;
-            g_ptys[i].s2m_tail = 0;
-            return i;
+            pty_ring_init(&g_ptys[i].m2s);
+            pty_ring_init(&g_ptys[i].s2m);
+            wait_queue_init(&g_ptys[i].slave_wait, "pty-slave-wait");
+            wait_queue_init(&g_ptys[i].master_wait, "pty-master-wait");
+            id = i;
+            break;
         }
     }
-    return -1;
+    spin_unlock_irqrestore(&g_pty_lock, flags);
+    return id;
 }
 
 size_t pty_master_write(int pty_id, const uint8_t *buf, size_t len) {
+    uint64_t flags;
+    size_t done;
+
     if (!pty_is_valid(pty_id) || !buf) {
         g_pty_invalid_ops++;
         return 0;
     }
-    return pty_queue_write(g_ptys[pty_id].m2s, &g_ptys[pty_id].m2s_head, &g_ptys[pty_id].m2s_tail, buf, len);
+    flags = spin_lock_irqsave(&g_pty_lock);
+    done = pty_queue_write(&g_ptys[pty_id].m2s, buf, len);
+    spin_unlock_irqrestore(&g_pty_lock, flags);
+    if (done > 0) {
+        wake_up_all(&g_ptys[pty_id].slave_wait);
+    }
+    return done;
 }
 
 size_t pty_master_read(int pty_id, uint8_t *buf, size_t len) {
+    uint64_t flags;
+    size_t done;
+
     if (!pty_is_valid(pty_id) || !buf) {
         g_pty_invalid_ops++;
         return 0;
     }
-    return pty_queue_read(g_ptys[pty_id].s2m, &g_ptys[pty_id].s2m_head, &g_ptys[pty_id].s2m_tail, buf, len);
+    flags = spin_lock_irqsave(&g_pty_lock);
+    done = pty_ring_pop_n(&g_ptys[pty_id].s2m, buf, len);
+    spin_unlock_irqrestore(&g_pty_lock, flags);
+    return done;
 }
 
 size_t pty_slave_write(int pty_id, const uint8_t *buf, size_t len) {
+    uint64_t flags;
+    size_t done;
+
     if (!pty_is_valid(pty_id) || !buf) {
         g_pty_invalid_ops++;
         return 0;
     }
-    return pty_queue_write(g_ptys[pty_id].s2m, &g_ptys[pty_id].s2m_head, &g_ptys[pty_id].s2m_tail, buf, len);
+    flags = spin_lock_irqsave(&g_pty_lock);
+    done = pty_queue_write(&g_ptys[pty_id].s2m, buf, len);
+    spin_unlock_irqrestore(&g_pty_lock, flags);
+    if (done > 0) {
+        wake_up_all(&g_ptys[pty_id].master_wait);
+    }
+    return done;
 }
 
 size_t pty_slave_read(int pty_id, uint8_t *buf, size_t len) {
+    uint64_t flags;
+    size_t done;
+
     if (!pty_is_valid(pty_id) || !buf) {
         g_pty_invalid_ops++;
         return 0;
     }
-    return pty_queue_read(g_ptys[pty_id].m2s, &g_ptys[pty_id].m2s_head, &g_ptys[pty_id].m2s_tail, buf, len);
+    flags = spin_lock_irqsave(&g_pty_lock);
+    done = pty_ring_pop_n(&g_ptys[pty_id].m2s, buf, len);
+    spin_unlock_irqrestore(&g_pty_lock, flags);
+    return done;
+}
+
+bool pty_slave_readable(int pty_id) {
+    return pty_is_valid(pty_id) && !pty_ring_empty(&g_ptys[pty_id].m2s);
+}
+
+bool pty_master_readable(int pty_id) {
+    return pty_is_valid(pty_id) && !pty_ring_empty(&g_ptys[pty_id].s2m);
+}
+
+wait_queue_t *pty_slave_wait_queue(int pty_id) {
+    return pty_is_valid(pty_id) ? &g_ptys[pty_id].slave_wait : 0;
+}
+
+wait_queue_t *pty_master_wait_queue(int pty_id) {
+    return pty_is_valid(pty_id) ? &g_ptys[pty_id].master_wait : 0;
 }
 
 uint64_t pty_dropped_bytes(void) {
@@ -0,0 +1,564 @@
+#include <kernel/apic.h>
+#include <kernel/clock.h>
+#include <kernel/cpuidle.h>
+#include <kernel/io.h>
+#include <kernel/lock.h>
+#include <kernel/pmm.h>
+#include <kernel/sched.h>
+#include <kernel/smp.h>
+#include <kernel/softirq.h>
+#include <kernel/vmm.h>
+
+struct thread {
+    uint64_t rsp;
+    uint32_t id;
+    const char *name;
+    volatile thread_state_t state;
+    int32_t affinity;
+    uint32_t cpu;
+    /* Still running on (or switching off) a CPU; nobody else may pick it. */
+    volatile bool on_cpu;
+    bool used;
+    bool idle;
+    uint64_t stack_phys;
+    thread_fn fn;
+    void *arg;
+    uint64_t cycles;
+    uint64_t switches;
+    uint64_t preemptions;
+    struct thread *next;
+};
+
+/*
+ * Per-CPU run queue. Only the owning CPU runs its threads; other CPUs touch
+ * it to enqueue a wakeup or steal a ready thread, always under `lock` with
+ * interrupts off.
+ */
+typedef struct {
+    spinlock_t lock;
+    volatile bool started;
+    volatile bool need_resched;
+    thread_t *volatile current;
+    thread_t *idle;
+    thread_t *head;
+    thread_t *tail;
+    volatile uint32_t ready;
+    /* Ready threads without CPU affinity, i.e. candidates for stealing. */
+    volatile uint32_t stealable;
+    uint32_t ready_max;
+    uint64_t ready_sum;
+    uint64_t samples;
+    uint64_t switch_tsc;
+    uint64_t slice_start;
+    uint64_t switches;
+    uint64_t preemptions;
+    uint64_t steals;
+} __attribute__((aligned(64))) sched_cpu_t;
+
+thread_t *sched_switch(uint64_t *save_rsp, uint64_t next_rsp, thread_t *prev);
+void sched_thread_start(void);
+void sched_thread_bootstrap(thread_t *prev);
+
+static thread_t threads[SCHED_MAX_THREADS];
+static sched_cpu_t rqs[SMP_MAX_CPUS];
+static spinlock_t table_lock;
+static uint32_t next_thread_id = 0;
+static uint64_t slice_cycles = 1;
+
+static const char *const state_names[] = {
+    [THREAD_READY] = "ready",
+    [THREAD_RUNNING] = "running",
+    [THREAD_BLOCKED] = "blocked",
+    [THREAD_DEAD] = "dead",
+};
+
+static sched_cpu_t *this_rq(void) {
+    return &rqs[smp_cpu_id()];
+}
+
+static void enqueue(sched_cpu_t *rq, thread_t *thread) {
+    thread->next = 0;
+    if (rq->tail) {
+        rq->tail->next = thread;
+    } else {
+        rq->head = thread;
+    }
+    rq->tail = thread;
+    rq->ready++;
+    if (thread->affinity == SCHED_CPU_ANY) {
+        rq->stealable++;
+    }
+    if (rq->ready > rq->ready_max) {
+        rq->ready_max = rq->ready;
+    }
+}
+
+/*
+ * Unlink the first thread that may run here: not still on another CPU
+ * (`self` is the caller's own outgoing thread), and unpinned when stealing.
+ */
+static thread_t *take_ready(sched_cpu_t *rq, thread_t *self, bool steal) {
+    thread_t *prev = 0;
+
+    for (thread_t *thread = rq->head; thread; prev = thread, thread = thread->next) {
+        if ((thread->on_cpu && thread != self) || (steal && thread->affinity != SCHED_CPU_ANY)) {
+            continue;
+        }
+        if (prev) {
+            prev->next = thread->next;
+        } else {
+            rq->head = thread->next;
+        }
+        if (rq->tail == thread) {
+            rq->tail = prev;
+        }
+        rq->ready--;
+        if (thread->affinity == SCHED_CPU_ANY) {
+            rq->stealable--;
+        }
+        thread->on_cpu = true;
+        return thread;
+    }
+    return 0;
+}
+
+static thread_t *steal(sched_cpu_t *self) {
+    for (unsigned int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        sched_cpu_t *victim = &rqs[cpu];
+        thread_t *thread;
+
+        if (victim == self || !victim->started || victim->stealable == 0 || !spin_trylock(&victim->lock)) {
+            continue;
+        }
+        thread = take_ready(victim, 0, true);
+        spin_unlock(&victim->lock);
+        if (thread) {
+            self->steals++;
+            return thread;
+        }
+    }
+    return 0;
+}
+
+static void kick(unsigned int cpu) {
+    cpu_t *target = smp_cpu(cpu);
+
+    if (cpu != smp_cpu_id() && target && apic_enabled()) {
+        cpuidle_kick(cpu);
+        lapic_send_ipi(target->apic_id, APIC_IPI_FIXED | SCHED_IPI_VECTOR);
+    }
+}
+
+/* Pinned threads go home; others to the least loaded CPU, preferring the last one. */
+static unsigned int pick_cpu(const thread_t *thread) {
+    unsigned int best;
+    uint32_t best_load = UINT32_MAX;
+
+    if (thread->affinity != SCHED_CPU_ANY) {
+        return (unsigned int)thread->affinity;
+    }
+    best = rqs[thread->cpu].started ? thread->cpu : 0;
+    for (unsigned int i = 0; i < SMP_MAX_CPUS; i++) {
+        unsigned int cpu = (thread->cpu + i) % SMP_MAX_CPUS;
+        sched_cpu_t *rq = &rqs[cpu];
+        uint32_t load;
+
+        if (!rq->started) {
+            continue;
+        }
+        load = rq->ready + (rq->current != rq->idle ? 1U : 0U);
+        if (load < best_load) {
+            best = cpu;
+            best_load = load;
+        }
+    }
+    return best;
+}
+
+static void finish_switch(thread_t *prev) {
+    __atomic_store_n(&prev->on_cpu, false, __ATOMIC_RELEASE);
+}
+
+/* Pick the next thread for this CPU and switch to it. Interrupts must be off. */
+static void schedule(bool preempted) {
+    sched_cpu_t *rq = this_rq();
+    thread_t *prev = rq->current;
+    thread_t *next;
+    uint64_t now;
+
+    spin_lock(&rq->lock);
+    rq->need_resched = false;
+    if (prev->state == THREAD_RUNNING && !prev->idle) {
+        prev->state = THREAD_READY;
+        enqueue(rq, prev);
+    }
+    next = take_ready(rq, prev, false);
+    spin_unlock(&rq->lock);
+
+    if (!next) {
+        next = steal(rq);
+    }
+    if (!next) {
+        next = rq->idle;
+    }
+
+    now = rdtsc();
+    next->state = THREAD_RUNNING;
+    next->cpu = smp_cpu_id();
+    if (next == prev) {
+        return;
+    }
+
+    if (prev->idle) {
+        prev->state = THREAD_READY;
+    }
+    if (preempted) {
+        prev->preemptions++;
+        rq->preemptions++;
+    }
+    prev->cycles += now - rq->switch_tsc;
+    rq->switch_tsc = now;
+    rq->slice_start = now;
+    rq->switches++;
+    next->switches++;
+    next->on_cpu = true;
+    rq->current = next;
+
+    prev = sched_switch(&prev->rsp, next->rsp, prev);
+    finish_switch(prev);
+}
+
+static thread_t *claim_slot(void) {
+    thread_t *thread = 0;
+
+    spin_lock(&table_lock);
+    for (uint32_t i = 0; i < SCHED_MAX_THREADS; i++) {
+        thread_t *slot = &threads[i];
+        if (!slot->used || (slot->state == THREAD_DEAD && !slot->on_cpu)) {
+            thread = slot;
+            break;
+        }
+    }
+    if (thread) {
+        thread->used = true;
+        thread->state = THREAD_BLOCKED;
+        thread->id = next_thread_id++;
+        thread->cycles = 0;
+        thread->switches = 0;
+        thread->preemptions = 0;
+        thread->next = 0;
+    }
+    spin_unlock(&table_lock);
+    return thread;
+}
+
+/* Adopt the running boot context as this CPU's idle thread. */
+void sched_init_cpu(void) {
+    sched_cpu_t *rq = this_rq();
+    uint64_t flags = irq_save();
+    thread_t *idle = claim_slot();
+
+    spin_init(&rq->lock, "runqueue");
+
+    if (idle) {
+        idle->name = "idle";
+        idle->idle = true;
+        idle->affinity = (int32_t)smp_cpu_id();
+        idle->cpu = smp_cpu_id();
+        idle->state = THREAD_RUNNING;
+        idle->on_cpu = true;
+        rq->idle = idle;
+        rq->current = idle;
+        rq->switch_tsc = rdtsc();
+        rq->slice_start = rq->switch_tsc;
+        __atomic_store_n(&rq->started, true, __ATOMIC_RELEASE);
+    }
+    irq_restore(flags);
+}
+
+/* Boot CPU, after clock_init() and before the APs start. */
+void sched_init(void) {
+    spin_init(&table_lock, "threads");
+    slice_cycles = clock_ns_to_cycles(SCHED_SLICE_NS);
+    if (slice_cycles == 0) {
+        slice_cycles = 1;
+    }
+    sched_init_cpu();
+}
+
+void sched_thread_bootstrap(thread_t *prev) {
+    thread_t *self;
+
+    finish_switch(prev);
+    self = this_rq()->current;
+    sti();
+    self->fn(self->arg);
+    thread_exit();
+}
+
+/*
+ * Start `fn(arg)` on a fresh 16 KiB stack. `affinity` pins the thread to
+ * one CPU, or SCHED_CPU_ANY lets it be placed and stolen anywhere.
+ */
+thread_t *thread_create(const char *name, thread_fn fn, void *arg, int affinity) {
+    thread_t *thread;
+    uint64_t *sp;
+    uint64_t flags;
+
+    if (!fn || affinity >= (int)SMP_MAX_CPUS || affinity < SCHED_CPU_ANY ||
+        (affinity != SCHED_CPU_ANY && !rqs[affinity].started)) {
+        return 0;
+    }
+
+    flags = irq_save();
+    thread = claim_slot();
+    if (thread && thread->stack_phys == 0) {
+        thread->stack_phys = pmm_alloc_pages(SCHED_STACK_ORDER);
+        if (thread->stack_phys == 0) {
+            thread->used = false;
+            thread = 0;
+        }
+    }
+    irq_restore(flags);
+    if (!thread) {
+        return 0;
+    }
+
+    thread->name = name;
+    thread->idle = false;
+    thread->affinity = affinity;
+    thread->cpu = (affinity == SCHED_CPU_ANY) ? smp_cpu_id() : (uint32_t)affinity;
+    thread->fn = fn;
+    thread->arg = arg;
+
+    /* sched_switch() pops six callee-saved registers, then returns into sched_thread_start. */
+    sp = (uint64_t *)((uint8_t *)vmm_phys_to_virt(thread->stack_phys) + (4096ULL << SCHED_STACK_ORDER));
+    *--sp = (uint64_t)(uintptr_t)sched_thread_start;
+    for (int i = 0; i < 6; i++) {
+        *--sp = 0;
+    }
+    thread->rsp = (uint64_t)(uintptr_t)sp;
+
+    sched_wake(thread);
+    return thread;
+}
+
+void thread_exit(void) {
+    cli();
+    this_rq()->current->state = THREAD_DEAD;
+    schedule(false);
+    for (;;) {
+        hlt();
+    }
+}
+
+thread_t *sched_current(void) {
+    return this_rq()->current;
+}
+
+void sched_yield(void) {
+    uint64_t flags = irq_save();
+    schedule(false);
+    irq_restore(flags);
+}
+
+/*
+ * Sleep until sched_wake(). Check the wake condition with interrupts off
+ * (or under the waker's lock) before calling, or a wakeup can be lost.
+ */
+void sched_block(void) {
+    uint64_t flags = irq_save();
+    thread_t *self = this_rq()->current;
+
+    /* Left alone when sched_prepare_block() already ran, or a wakeup followed it. */
+    if (self->state == THREAD_RUNNING) {
+        self->state = THREAD_BLOCKED;
+    }
+    schedule(false);
+    irq_restore(flags);
+}
+
+/*
+ * Mark the current thread blocked before publishing it on a wait queue, so
+ * a wakeup between the publish and sched_block() is not lost. Interrupts
+ * stay off until sched_block() or sched_cancel_block().
+ */
+void sched_prepare_block(void) {
+    this_rq()->current->state = THREAD_BLOCKED;
+}
+
+/* The condition turned out true after sched_prepare_block(): keep running. */
+void sched_cancel_block(void) {
+    thread_t *self = this_rq()->current;
+    thread_state_t blocked = THREAD_BLOCKED;
+
+    if (!__atomic_compare_exchange_n(&self->state, &blocked, THREAD_RUNNING, false,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        /* Already woken and queued; pass through the run queue to consume that. */
+        schedule(false);
+    }
+}
+
+void sched_wake(thread_t *thread) {
+    thread_state_t blocked = THREAD_BLOCKED;
+    sched_cpu_t *rq;
+    unsigned int cpu;
+    uint64_t flags;
+
+    if (!thread || !__atomic_compare_exchange_n(&thread->state, &blocked, THREAD_READY, false,
+                                                __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+
+    flags = irq_save();
+    cpu = pick_cpu(thread);
+    rq = &rqs[cpu];
+    spin_lock(&rq->lock);
+    enqueue(rq, thread);
+    spin_unlock(&rq->lock);
+    if (rq->current == rq->idle) {
+        kick(cpu);
+    } else if (rqs[0].current == rqs[0].idle) {
+        /*
+         * The thread waits for a slice to expire, which only CPU 0's tick
+         * notices, and an idle CPU 0 may have stopped ticking.
+         */
+        kick(0);
+    }
+    irq_restore(flags);
+}
+
+/* True when this CPU has a ready thread or another CPU has one to steal. */
+bool sched_has_work(void) {
+    sched_cpu_t *self = this_rq();
+
+    if (self->ready > 0) {
+        return true;
+    }
+    for (unsigned int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        if (&rqs[cpu] != self && rqs[cpu].started && rqs[cpu].stealable > 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Slices are only enforced while some CPU has a thread waiting to run. */
+bool sched_needs_tick(void) {
+    for (unsigned int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        if (rqs[cpu].started && rqs[cpu].ready > 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Timer tick on the boot CPU: sample queue lengths, flag expired slices
+ * (kicking remote CPUs), and wake idle CPUs when there is work to steal.
+ */
+void sched_tick(void) {
+    uint64_t now = rdtsc();
+    bool stealable = false;
+
+    for (unsigned int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        sched_cpu_t *rq = &rqs[cpu];
+
+        if (!rq->started) {
+            continue;
+        }
+        rq->ready_sum += rq->ready;
+        rq->samples++;
+        if (rq->stealable > 0) {
+            stealable = true;
+        }
+        if (rq->ready > 0 && rq->current != rq->idle && now - rq->slice_start >= slice_cycles) {
+            rq->need_resched = true;
+            kick(cpu);
+        }
+    }
+
+    if (stealable) {
+        for (unsigned int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+            if (rqs[cpu].started && rqs[cpu].current == rqs[cpu].idle) {
+                kick(cpu);
+            }
+        }
+    }
+}
+
+/*
+ * Last step of every interrupt: preempt if the slice ran out. The idle thread is never preempted here; its loop
+ * yields by itself, so idle-time work such as zeroing frames is not
+ * interrupted half way.
+ */
+void sched_irq_exit(void) {
+    sched_cpu_t *rq = this_rq();
+
+    if (!rq->started) {
+        return;
+    }
+    if (rq->need_resched && rq->current != rq->idle && !softirq_active()) {
+        schedule(true);
+    }
+}
+
+/* Idle loop of an application processor: run or steal work, else idle until kicked. */
+void sched_idle(void) {
+    for (;;) {
+        if (sched_has_work()) {
+            sched_yield();
+            continue;
+        }
+        cli();
+        if (!sched_has_work()) {
+            cpuidle_enter(UINT64_MAX);
+        }
+        sti();
+    }
+}
+
+bool sched_thread_info(size_t index, sched_thread_info_t *out) {
+    for (uint32_t i = 0; i < SCHED_MAX_THREADS; i++) {
+        thread_t *thread = &threads[i];
+        if (!thread->used) {
+            continue;
+        }
+        if (index-- > 0) {
+            continue;
+        }
+        out->id = thread->id;
+        out->name = thread->name;
+        out->state = thread->state;
+        out->cpu = thread->cpu;
+        out->affinity = thread->affinity;
+        out->cpu_ns = clock_cycles_to_ns(thread->cycles);
+        out->switches = thread->switches;
+        out->preemptions = thread->preemptions;
+        return true;
+    }
+    return false;
+}
+
+bool sched_cpu_info(unsigned int cpu, sched_cpu_info_t *out) {
+    sched_cpu_t *rq;
+
+    if (cpu >= SMP_MAX_CPUS || !rqs[cpu].started) {
+        return false;
+    }
+    rq = &rqs[cpu];
+    out->current = rq->current->name;
+    out->ready = rq->ready;
+    out->ready_max = rq->ready_max;
+    out->ready_sum = rq->ready_sum;
+    out->samples = rq->samples;
+    out->switches = rq->switches;
+    out->preemptions = rq->preemptions;
+    out->steals = rq->steals;
+    out->idle_ns = clock_cycles_to_ns(rq->idle->cycles);
+    return true;
+}
+
+const char *sched_state_name(thread_state_t state) {
+    return ((unsigned int)state < sizeof(state_names) / sizeof(state_names[0])) ? state_names[state] : "?";
+}
@@ -1,3 +1,4 @@
+#include <kernel/lock.h>
 #include <kernel/pty.h>
 #include <kernel/session.h>
 #include <kernel/string.h>
@@ -14,6 +15,7 @@ typedef struct {
 static session_entry_t g_sessions[SESSION_MAX];
 static int g_active_session_id = -1;
 static uint64_t g_session_invalid_ops = 0;
+static spinlock_t g_session_lock;
 
 static session_entry_t *session_find(int session_id) {
     for (int i = 0; i < SESSION_MAX; i++) {
@@ -26,22 +28,30 @@ static session_entry_t *session_find(int session_id) {
 
 void session_init(void) {
     memset(g_sessions, 0, sizeof(g_sessions));
+    spin_init(&g_session_lock, "session");
     g_active_session_id = -1;
     g_session_invalid_ops = 0;
 }
 
 int session_create(uint32_t leader_pid) {
+    uint64_t flags = spin_lock_irqsave(&g_session_lock);
+    int id = -1;
+
     for (int i = 0; i < SESSION_MAX; i++) {
         if (!g_sessions[i].in_use) {
             g_sessions[i].in_use = true;
             g_sessions[i].id = i + 1;
             g_sessions[i].leader_pid = leader_pid;
             g_sessions[i].controlling_pty = -1;
-            return g_sessions[i].id;
+            id = g_sessions[i].id;
+            break;
         }
     }
-    g_session_invalid_ops++;
-    return -1;
+    if (id < 0) {
+        g_session_invalid_ops++;
+    }
+    spin_unlock_irqrestore(&g_session_lock, flags);
+    return id;
 }
 
 bool session_set_controlling_pty(int session_id, int pty_id) {
@@ -1,15 +1,27 @@
+#include <kernel/clock.h>
 #include <kernel/console.h>
+#include <kernel/cpuidle.h>
+#include <kernel/irq.h>
 #include <kernel/keyboard.h>
-#include <kernel/pit.h>
+#include <kernel/ktimer.h>
+#include <kernel/lock.h>
 #include <kernel/pmm.h>
 #include <kernel/pty.h>
 #include <kernel/rust.h>
+#include <kernel/sched.h>
 #include <kernel/session.h>
 #include <kernel/shell.h>
+#include <kernel/slab.h>
+#include <kernel/smp.h>
+#include <kernel/softirq.h>
 #include <kernel/string.h>
+#include <kernel/timer.h>
 #include <kernel/tty.h>
+#include <kernel/video.h>
+#include <kernel/vmm.h>
 
 #define SHELL_LINE_MAX 128
+#define LOCKSTAT_TOP 10
 
 static char shell_line[SHELL_LINE_MAX];
 static size_t shell_len = 0;
@@ -27,12 +39,24 @@ static void cmd_help(void) {
     console_write("  ttyinfo  - show tty RX/drop counters\n");
     console_write("  session  - show active session and controlling pty\n");
     console_write("  health   - show subsystem fault/overflow counters\n");
+    console_write("  pmmstat  - show PMM fragmentation/latency stats\n");
+    console_write("  pmmstat serial - dump PMM stats to COM1\n");
+    console_write("  fbbench  - time framebuffer redraw with UC/WT/WC mappings\n");
+    console_write("  slabinfo - show kernel heap caches\n");
+    console_write("  irqstat  - show per-line IRQ and softirq counts and handler times\n");
+    console_write("  sched    - show threads, CPU time and run queue lengths\n");
+    console_write("  lockstat - show the most contended locks\n");
+    console_write("  cpuidle [state] - show idle residency/wakeup latency, or pick the idle state\n");
     console_write("  selftest - run input/pty stress self-test\n");
     console_write("  ansi     - print ANSI color demo\n");
     console_write("  echo ... - print text\n");
 }
 
 static void cmd_meminfo(void) {
+    timer_stats_t timer;
+    ktimer_stats_t wheel;
+    clock_info_t clock;
+
     console_write("Memory total: ");
     console_write_dec(pmm_total_kib());
     console_write(" KiB\n");
@@ -45,8 +69,81 @@ static void cmd_meminfo(void) {
     console_write_dec(pmm_free_kib());
     console_write(" KiB\n");
 
+    console_write("Memory meta : ");
+    console_write_dec(pmm_metadata_kib());
+    console_write(" KiB\n");
+
+    console_write("Page tables : ");
+    console_write_dec(vmm_table_kib());
+    console_write(" KiB\n");
+
+    for (unsigned int z = 0; z < PMM_ZONE_COUNT; z++) {
+        pmm_zone_info_t zone;
+        if (!pmm_zone_info(z, &zone) || zone.managed_kib == 0) {
+            continue;
+        }
+        console_write("Zone ");
+        console_write(zone.name);
+        console_write(": free ");
+        console_write_dec(zone.free_kib);
+        console_write(" KiB, used ");
+        console_write_dec(zone.managed_kib - zone.free_kib);
+        console_write(" KiB\n");
+    }
+
+    for (size_t i = 0;; i++) {
+        vmm_region_info_t region;
+        if (!vmm_region_info(i, &region)) {
+            break;
+        }
+        console_write("Lazy ");
+        console_write(region.name);
+        console_write(": ");
+        console_write_dec(region.resident_kib);
+        console_write("/");
+        console_write_dec(region.size / 1024);
+        console_write(" KiB resident, ");
+        console_write_dec(region.minor_faults);
+        console_write(" minor faults\n");
+    }
+
+    clock_info(&clock);
+    console_write("Uptime      : ");
+    console_write_dec(clock_monotonic_ns());
+    console_write(" ns (");
+    console_write(clock_source_name(clock.source));
+    console_write(clock.tsc_invariant ? ", invariant TSC " : ", TSC ");
+    console_write_dec(clock.tsc_hz / 1000U);
+    console_write(" kHz)\n");
+
+    timer_stats(&timer);
     console_write("Timer ticks : ");
-    console_write_dec(pit_ticks());
+    console_write_dec(timer_ticks());
+    console_write("\n");
+
+    console_write("Timer mode  : ");
+    console_write(timer_mode_name(timer.mode));
+    console_write(", ");
+    console_write_dec(timer.interrupts);
+    console_write(" irqs, ");
+    console_write_dec(timer.ticks_suppressed);
+    console_write(" idle ticks skipped\n");
+
+    ktimer_stats(&wheel);
+    console_write("Timer wheel : ");
+    console_write_dec(wheel.pending);
+    console_write(" pending, ");
+    console_write_dec(wheel.fired);
+    console_write(" fired, ");
+    console_write_dec(wheel.cancelled);
+    console_write(" cancelled, ");
+    console_write_dec(wheel.cascaded);
+    console_write(" cascaded\n");
+
+    console_write("CPUs online : ");
+    console_write_dec(smp_online_cpus());
+    console_write(" of ");
+    console_write_dec(smp_possible_cpus());
     console_write("\n");
 
     console_write("Rust history entries: ");
@@ -128,9 +225,15 @@ static void cmd_ttyinfo(void) {
 }
 
 static void cmd_health(void) {
+    pmm_cache_stats_t cache;
+    vmm_tlb_stats_t tlb;
+
     console_write("KBD scancodes : ");
     console_write_dec(keyboard_rx_scancodes());
     console_write("\n");
+    console_write("KBD drop scan : ");
+    console_write_dec(keyboard_dropped_scancodes());
+    console_write("\n");
     console_write("KBD drop byte : ");
     console_write_dec(keyboard_dropped_bytes());
     console_write("\n");
@@ -146,11 +249,450 @@ static void cmd_health(void) {
     console_write("PTY invalid   : ");
     console_write_dec(pty_invalid_ops());
     console_write("\n");
+    console_write("PMM invalid   : ");
+    console_write_dec(pmm_invalid_ops());
+    console_write("\n");
+    pmm_cache_stats(&cache);
+    console_write("PMM mag hit   : ");
+    console_write_dec(cache.hits);
+    console_write("\n");
+    console_write("PMM mag miss  : ");
+    console_write_dec(cache.misses);
+    console_write("\n");
+    console_write("PMM mag refill: ");
+    console_write_dec(cache.refills);
+    console_write("\n");
+    console_write("PMM mag drain : ");
+    console_write_dec(cache.drains);
+    console_write("\n");
+    console_write("PMM mag cached: ");
+    console_write_dec(cache.cached_frames);
+    console_write("\n");
+    console_write("PMM zero hit  : ");
+    console_write_dec(cache.zero_hits);
+    console_write("\n");
+    console_write("PMM zero miss : ");
+    console_write_dec(cache.zero_misses);
+    console_write("\n");
+    console_write("PMM zero pool : ");
+    console_write_dec(cache.zeroed_frames);
+    console_write("\n");
+    console_write("Slab invalid  : ");
+    console_write_dec(slab_invalid_ops());
+    console_write("\n");
+    vmm_tlb_stats(&tlb);
+    console_write("TLB page flush: ");
+    console_write_dec(tlb.page_flushes);
+    console_write("\n");
+    console_write("TLB full flush: ");
+    console_write_dec(tlb.full_flushes);
+    console_write("\n");
+    console_write("TLB batches   : ");
+    console_write_dec(tlb.batches);
+    console_write(" (");
+    console_write_dec(tlb.deferred);
+    console_write(" deferred)\n");
+    console_write("TLB shootdowns: ");
+    console_write_dec(tlb.shootdowns);
+    console_write("\n");
+    console_write("TLB PCID      : ");
+    console_write(tlb.pcid ? "on" : "off");
+    console_write(tlb.invpcid ? ", INVPCID\n" : "\n");
     console_write("Session invalid: ");
     console_write_dec(session_invalid_ops());
     console_write("\n");
 }
 
+static void write_permille(uint64_t permille) {
+    console_write_dec(permille / 10);
+    console_putc('.');
+    console_write_dec(permille % 10);
+    console_putc('%');
+}
+
+static void cmd_pmmstat(void) {
+    pmm_stats_t stats;
+
+    pmm_stats(&stats);
+    console_write("Allocs      : ");
+    console_write_dec(stats.allocs);
+    console_write(" (failed ");
+    console_write_dec(stats.alloc_failures);
+    console_write(")\n");
+    console_write("Frees       : ");
+    console_write_dec(stats.frees);
+    console_write("\n");
+    console_write("Alloc cycles: p50 ");
+    console_write_dec(stats.latency_p50);
+    console_write(", p99 ");
+    console_write_dec(stats.latency_p99);
+    console_write(", max ");
+    console_write_dec(stats.latency_max);
+    console_write("\n");
+    console_write("Order  free blocks  unusable\n");
+    for (unsigned int k = 0; k <= PMM_MAX_ORDER; k++) {
+        console_write(k < 10 ? "   " : "  ");
+        console_write_dec(k);
+        console_write("  ");
+        console_write_dec(stats.free_blocks[k]);
+        console_write("  ");
+        write_permille(stats.unusable_permille[k]);
+        console_write("\n");
+    }
+}
+
+/* One key=value line on COM1 so host tooling can track fragmentation. */
+static void cmd_pmmstat_serial(void) {
+    pmm_stats_t stats;
+
+    pmm_stats(&stats);
+    console_serial_write("pmmstat allocs=");
+    console_serial_write_dec(stats.allocs);
+    console_serial_write(" failed=");
+    console_serial_write_dec(stats.alloc_failures);
+    console_serial_write(" frees=");
+    console_serial_write_dec(stats.frees);
+    console_serial_write(" p50=");
+    console_serial_write_dec(stats.latency_p50);
+    console_serial_write(" p99=");
+    console_serial_write_dec(stats.latency_p99);
+    console_serial_write(" max=");
+    console_serial_write_dec(stats.latency_max);
+    for (unsigned int k = 0; k <= PMM_MAX_ORDER; k++) {
+        console_serial_write(" free");
+        console_serial_write_dec(k);
+        console_serial_write("=");
+        console_serial_write_dec(stats.free_blocks[k]);
+        console_serial_write(" unusable");
+        console_serial_write_dec(k);
+        console_serial_write("=");
+        console_serial_write_dec(stats.unusable_permille[k]);
+    }
+    console_serial_write(" lat=");
+    for (unsigned int b = 0; b < PMM_LATENCY_BUCKETS; b++) {
+        if (b != 0) {
+            console_serial_write(",");
+        }
+        console_serial_write_dec(stats.latency_hist[b]);
+    }
+    console_serial_write("\n");
+    console_write("pmmstat written to COM1\n");
+}
+
+static uint64_t fb_redraw_avg(uint64_t cache) {
+    uint64_t total = 0;
+
+    if (!video_set_framebuffer_cache(cache)) {
+        return 0;
+    }
+    for (int i = 0; i < 4; i++) {
+        total += console_redraw_cycles();
+    }
+    return total / 4;
+}
+
+static void cmd_fbbench(void) {
+    static const struct {
+        const char *name;
+        uint64_t cache;
+    } modes[] = {
+        { "UC", VMM_CACHE_UC },
+        { "WT", VMM_CACHE_WT },
+        { "WC", VMM_CACHE_WC },
+    };
+    uint64_t cycles[3];
+
+    if (console_redraw_cycles() == 0) {
+        console_write("fbbench: framebuffer console not active\n");
+        return;
+    }
+
+    for (int i = 0; i < 3; i++) {
+        cycles[i] = fb_redraw_avg(modes[i].cache);
+    }
+    /* The console always runs write-combining outside the benchmark. */
+    (void)video_set_framebuffer_cache(VMM_CACHE_WC);
+
+    for (int i = 0; i < 3; i++) {
+        console_write("Redraw ");
+        console_write(modes[i].name);
+        console_write(": ");
+        console_write_dec(cycles[i]);
+        console_write(" cycles");
+        if (cycles[i] != 0 && cycles[0] != 0) {
+            console_write(" (");
+            console_write_dec(cycles[0] / cycles[i]);
+            console_write("x vs UC)");
+        }
+        console_write("\n");
+    }
+}
+
+static void cmd_slabinfo(void) {
+    kmem_cache_info_t info;
+
+    console_write("Cache            size  active  total  slabs  mag hit/miss\n");
+    for (size_t i = 0; kmem_cache_info(i, &info); i++) {
+        size_t len = strlen(info.name);
+        console_write(info.name);
+        for (; len < 16; len++) {
+            console_putc(' ');
+        }
+        console_write_dec(info.object_size);
+        console_write("  ");
+        console_write_dec(info.active_objects);
+        console_write("  ");
+        console_write_dec(info.total_objects);
+        console_write("  ");
+        console_write_dec(info.slabs);
+        console_write("  ");
+        console_write_dec(info.mag_hits);
+        console_putc('/');
+        console_write_dec(info.mag_misses);
+        console_write("\n");
+    }
+}
+
+static void cmd_irqstat(void) {
+    irq_stats_t stats;
+    softirq_stats_t soft;
+
+    console_write("Line vec  handlers  count  spurious  min/avg/max ns\n");
+    for (uint8_t line = 0; line < IRQ_LINES; line++) {
+        if (!irq_stats(line, &stats) || (stats.handlers == 0 && stats.count == 0)) {
+            continue;
+        }
+        console_write_dec(line);
+        console_write(line < 10 ? "    " : "   ");
+        console_write_hex(IRQ_VECTOR_BASE + line);
+        console_write("  ");
+        console_write_dec(stats.handlers);
+        console_write("  ");
+        console_write_dec(stats.count);
+        console_write("  ");
+        console_write_dec(stats.spurious);
+        console_write("  ");
+        if (stats.count > 0) {
+            console_write_dec(clock_cycles_to_ns(stats.cycles_min));
+            console_putc('/');
+            console_write_dec(clock_cycles_to_ns(stats.cycles_total / stats.count));
+            console_putc('/');
+            console_write_dec(clock_cycles_to_ns(stats.cycles_max));
+        } else {
+            console_write("-");
+        }
+        console_write("\n");
+        for (uint32_t b = 0; b < IRQ_HIST_BUCKETS; b++) {
+            if (stats.hist[b] == 0) {
+                continue;
+            }
+            console_write("      <");
+            console_write_dec(clock_cycles_to_ns(2ULL << b));
+            console_write(" ns: ");
+            console_write_dec(stats.hist[b]);
+            console_write("\n");
+        }
+    }
+    console_write("LAPIC spurious vectors: ");
+    console_write_dec(irq_spurious_vectors());
+    console_write("\n");
+
+    console_write("Softirq   raised  runs  avg/max ns\n");
+    for (unsigned int nr = 0; nr < SOFTIRQ_MAX; nr++) {
+        size_t len;
+        if (!softirq_stats((softirq_nr_t)nr, &soft)) {
+            continue;
+        }
+        len = strlen(soft.name);
+        console_write(soft.name);
+        for (; len < 10; len++) {
+            console_putc(' ');
+        }
+        console_write_dec(soft.raised);
+        console_write("  ");
+        console_write_dec(soft.runs);
+        console_write("  ");
+        console_write_dec(soft.runs ? clock_cycles_to_ns(soft.cycles_total / soft.runs) : 0);
+        console_putc('/');
+        console_write_dec(clock_cycles_to_ns(soft.cycles_max));
+        console_write("\n");
+    }
+}
+
+static void write_padded(const char *text, size_t width) {
+    size_t len = strlen(text);
+
+    console_write(text);
+    for (; len < width; len++) {
+        console_putc(' ');
+    }
+}
+
+static void cmd_sched(void) {
+    sched_cpu_info_t cpu;
+    sched_thread_info_t thread;
+    uint64_t avg;
+
+    console_write("CPU  current   ready max avg  switches preempt steals  idle ms\n");
+    for (unsigned int id = 0; id < SMP_MAX_CPUS; id++) {
+        if (!sched_cpu_info(id, &cpu)) {
+            continue;
+        }
+        console_write_dec(id);
+        console_write(id < 10 ? "    " : "   ");
+        write_padded(cpu.current, 10);
+        console_write_dec(cpu.ready);
+        console_putc(' ');
+        console_write_dec(cpu.ready_max);
+        console_putc(' ');
+        avg = cpu.samples ? (cpu.ready_sum * 100U) / cpu.samples : 0;
+        console_write_dec(avg / 100U);
+        console_write((avg % 100U) < 10U ? ".0" : ".");
+        console_write_dec(avg % 100U);
+        console_write("  ");
+        console_write_dec(cpu.switches);
+        console_putc(' ');
+        console_write_dec(cpu.preemptions);
+        console_putc(' ');
+        console_write_dec(cpu.steals);
+        console_write("  ");
+        console_write_dec(cpu.idle_ns / 1000000U);
+        console_write("\n");
+    }
+
+    console_write("TID  name      state    cpu  cpu ms  switches preempt\n");
+    for (size_t i = 0; sched_thread_info(i, &thread); i++) {
+        console_write_dec(thread.id);
+        console_write(thread.id < 10 ? "    " : "   ");
+        write_padded(thread.name, 10);
+        write_padded(sched_state_name(thread.state), 9);
+        console_write_dec(thread.cpu);
+        console_write(thread.affinity < 0 ? "    " : "*   ");
+        console_write_dec(thread.cpu_ns / 1000000U);
+        console_write("  ");
+        console_write_dec(thread.switches);
+        console_putc(' ');
+        console_write_dec(thread.preemptions);
+        console_write("\n");
+    }
+}
+
+static void cmd_cpuidle(const char *arg) {
+    cpuidle_state_t state;
+    cpuidle_cpu_info_t info;
+
+    if (arg) {
+        unsigned int index = 0;
+
+        while (cpuidle_state_info(index, &state) && strcmp(arg, state.name) != 0) {
+            index++;
+        }
+        if (!cpuidle_select(index)) {
+            console_write("cpuidle: unknown state ");
+            console_write(arg);
+            console_putc('\n');
+            return;
+        }
+    }
+
+    console_write("States:");
+    for (unsigned int i = 0; cpuidle_state_info(i, &state); i++) {
+        console_putc(' ');
+        console_write(state.name);
+        if (i == cpuidle_selected()) {
+            console_putc('*');
+        }
+    }
+    console_putc('\n');
+
+    console_write("CPU  state  entries  resident ms\n");
+    for (unsigned int id = 0; id < SMP_MAX_CPUS; id++) {
+        if (!cpuidle_cpu_info(id, &info)) {
+            continue;
+        }
+        for (unsigned int i = 0; cpuidle_state_info(i, &state); i++) {
+            if (info.entries[i] == 0) {
+                continue;
+            }
+            console_write_dec(id);
+            console_write(id < 10 ? "    " : "   ");
+            write_padded(state.name, 7);
+            console_write_dec(info.entries[i]);
+            console_write("  ");
+            console_write_dec(info.residency_ns[i] / 1000000U);
+            console_putc('\n');
+        }
+    }
+
+    console_write("CPU  timed wakeups  avg ns  max ns\n");
+    for (unsigned int id = 0; id < SMP_MAX_CPUS; id++) {
+        if (!cpuidle_cpu_info(id, &info)) {
+            continue;
+        }
+        console_write_dec(id);
+        console_write(id < 10 ? "    " : "   ");
+        console_write_dec(info.timed_wakeups);
+        console_write("  ");
+        console_write_dec(info.timed_wakeups ? info.latency_sum_ns / info.timed_wakeups : 0);
+        console_write("  ");
+        console_write_dec(info.latency_max_ns);
+        console_putc('\n');
+    }
+}
+
+/* Hottest first: most cycles spent spinning, then most contended acquires. */
+static bool lock_hotter(const lock_info_t *a, const lock_info_t *b) {
+    if (a->spin_cycles != b->spin_cycles) {
+        return a->spin_cycles > b->spin_cycles;
+    }
+    return a->contended > b->contended;
+}
+
+static void cmd_lockstat(void) {
+    lock_info_t top[LOCKSTAT_TOP];
+    lock_info_t info;
+    size_t count = 0;
+    size_t total = 0;
+
+    for (; lock_info(total, &info); total++) {
+        size_t pos = count;
+        if (count == LOCKSTAT_TOP && !lock_hotter(&info, &top[count - 1])) {
+            continue;
+        }
+        if (count < LOCKSTAT_TOP) {
+            count++;
+        } else {
+            pos--;
+        }
+        for (; pos > 0 && lock_hotter(&info, &top[pos - 1]); pos--) {
+            top[pos] = top[pos - 1];
+        }
+        top[pos] = info;
+    }
+
+    console_write("Lock             kind    acquired  contended  spin ns  max hold ns\n");
+    for (size_t i = 0; i < count; i++) {
+        write_padded(top[i].name, 17);
+        write_padded(lock_kind_name(top[i].kind), 8);
+        console_write_dec(top[i].acquisitions);
+        console_write("  ");
+        console_write_dec(top[i].contended);
+        console_write("  ");
+        console_write_dec(clock_cycles_to_ns(top[i].spin_cycles));
+        console_write("  ");
+        console_write_dec(clock_cycles_to_ns(top[i].hold_max_cycles));
+        console_write("\n");
+    }
+    console_write_dec(total);
+    console_write(" locks tracked");
+    if (lock_untracked() != 0) {
+        console_write(", ");
+        console_write_dec(lock_untracked());
+        console_write(" untracked");
+    }
+    console_write("\n");
+}
+
 static void cmd_session(void) {
     console_write("Session active: ");
     console_write_dec((uint64_t)(session_active_id() < 0 ? 0 : session_active_id()));
@@ -178,6 +720,7 @@ static void cmd_selftest(void) {
     size_t total_read = 0;
     uint64_t over_before;
     uint8_t line_buf[900];
+    uint64_t lazy;
     bool ok = true;
 
     for (size_t i = 0; i < sizeof(write_buf); i++) {
@@ -217,6 +760,30 @@ static void cmd_selftest(void) {
 
     drain_active_pty();
 
+    /* Sparse lazy region: only the pages touched get backed. */
+    lazy = vmm_region_create("selftest", 64ULL * 1024ULL * 1024ULL, VMM_FLAG_WRITABLE | VMM_FLAG_NX);
+    if (lazy == 0) {
+        ok = false;
+    } else {
+        volatile uint8_t *bytes = (volatile uint8_t *)(uintptr_t)lazy;
+        vmm_region_info_t region;
+        size_t index = 0;
+
+        bytes[0] = 1;
+        bytes[5000] = 2;
+        bytes[(64ULL * 1024ULL * 1024ULL) - 1] = bytes[4097];
+        while (vmm_region_info(index, &region) && region.base != lazy) {
+            index++;
+        }
+        if (region.base != lazy || region.minor_faults != 3 || region.resident_kib != 12 ||
+            bytes[0] != 1 || bytes[4096] != 0) {
+            ok = false;
+        }
+        if (!vmm_region_destroy(lazy)) {
+            ok = false;
+        }
+    }
+
     console_write("selftest: ");
     console_write(ok ? "PASS\n" : "FAIL\n");
 }
@@ -267,6 +834,51 @@ static void execute_command(char *line) {
         return;
     }
 
+    if (strcmp(line, "pmmstat") == 0) {
+        cmd_pmmstat();
+        return;
+    }
+
+    if (strcmp(line, "pmmstat serial") == 0) {
+        cmd_pmmstat_serial();
+        return;
+    }
+
+    if (strcmp(line, "fbbench") == 0) {
+        cmd_fbbench();
+        return;
+    }
+
+    if (strcmp(line, "slabinfo") == 0) {
+        cmd_slabinfo();
+        return;
+    }
+
+    if (strcmp(line, "irqstat") == 0) {
+        cmd_irqstat();
+        return;
+    }
+
+    if (strcmp(line, "sched") == 0) {
+        cmd_sched();
+        return;
+    }
+
+    if (strcmp(line, "lockstat") == 0) {
+        cmd_lockstat();
+        return;
+    }
+
+    if (strcmp(line, "cpuidle") == 0) {
+        cmd_cpuidle(0);
+        return;
+    }
+
+    if (strncmp(line, "cpuidle ", 8) == 0) {
+        cmd_cpuidle(line + 8);
+        return;
+    }
+
     if (strcmp(line, "session") == 0) {
         cmd_session();
         return;
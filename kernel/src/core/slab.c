@@ -0,0 +1,512 @@
+#include <kernel/io.h>
+#include <kernel/lock.h>
+#include <kernel/pmm.h>
+#include <kernel/slab.h>
+#include <kernel/smp.h>
+#include <kernel/string.h>
+#include <kernel/vmm.h>
+
+#define SLAB_PAGE_SIZE 4096ULL
+#define SLAB_MAGIC 0x51AB0C0DU
+#define SLAB_HEADER_SIZE 64U
+#define SLAB_MAX_ORDER 3U
+#define SLAB_MIN_OBJECTS 8U
+#define SLAB_MAG_SIZE 16U
+#define SLAB_MAG_BATCH 8U
+
+/* kmalloc size classes: 16 B .. 1 KiB; larger requests take whole pages. */
+#define KMALLOC_MIN_SHIFT 4U
+#define KMALLOC_MAX_SHIFT 10U
+#define KMALLOC_CLASSES (KMALLOC_MAX_SHIFT - KMALLOC_MIN_SHIFT + 1U)
+
+/*
+ * Every slab is 2^order pages, aligned to its size, with this header at the
+ * start; an object finds its slab by masking its address. Free objects are
+ * chained through a link word: at the start of the object, or after it when
+ * the cache has a constructor, so constructed state survives a free.
+ * Page-sized kmalloc blocks carry the same header with cache == 0.
+ */
+typedef struct slab {
+    uint32_t magic;
+    uint16_t order;
+    uint16_t inuse;
+    kmem_cache_t *cache;
+    struct slab *prev;
+    struct slab *next;
+    void *free;
+} slab_t;
+
+_Static_assert(sizeof(slab_t) <= SLAB_HEADER_SIZE, "slab header too large");
+
+/*
+ * Per-CPU object stack in front of the slab lists, as in the PMM. The owner
+ * touches it with interrupts off, so it cannot be preempted onto another CPU
+ * halfway through, and under its lock, which kmem_cache_shrink() takes to
+ * empty other CPUs' magazines. The lock stays out of the lock registry: there
+ * are SMP_MAX_CPUS of them per cache. Lock order is magazine, then cache.
+ */
+typedef struct {
+    spinlock_t lock;
+    void *objects[SLAB_MAG_SIZE];
+    uint32_t count;
+    uint64_t hits;
+    uint64_t misses;
+} __attribute__((aligned(64))) slab_magazine_t;
+
+struct kmem_cache {
+    const char *name;
+    size_t size;
+    size_t stride;
+    size_t align;
+    size_t link_offset;
+    size_t first_offset;
+    kmem_ctor_t ctor;
+    unsigned int order;
+    uint32_t objects_per_slab;
+    slab_t *partial;
+    slab_t *full;
+    uint64_t slabs;
+    uint64_t empty_slabs;
+    uint64_t inuse;
+    kmem_cache_t *next_cache;
+    /* Slab lists and counters; magazine refills queue up here in FIFO order. */
+    ticketlock_t lock;
+    slab_magazine_t mags[SMP_MAX_CPUS];
+};
+
+/* Descriptors for every other cache come from this statically allocated one. */
+static kmem_cache_t cache_cache;
+static kmem_cache_t *cache_list = 0;
+static kmem_cache_t *kmalloc_caches[KMALLOC_CLASSES];
+static spinlock_t cache_list_lock;
+/* Per CPU, summed on read, like the magazine counters. */
+static uint64_t invalid_ops[SMP_MAX_CPUS];
+
+static const char *const kmalloc_names[KMALLOC_CLASSES] = {
+    "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+    "kmalloc-256", "kmalloc-512", "kmalloc-1024",
+};
+
+static inline size_t align_up(size_t value, size_t align) {
+    return (value + align - 1) & ~(align - 1);
+}
+
+static inline uint64_t slab_bytes(const kmem_cache_t *cache) {
+    return SLAB_PAGE_SIZE << cache->order;
+}
+
+static slab_magazine_t *this_magazine(kmem_cache_t *cache) {
+    return &cache->mags[smp_cpu_id()];
+}
+
+static void count_invalid(void) {
+    uint64_t flags = irq_save();
+    invalid_ops[smp_cpu_id()]++;
+    irq_restore(flags);
+}
+
+static inline void **link_of(const kmem_cache_t *cache, void *obj) {
+    return (void **)((uint8_t *)obj + cache->link_offset);
+}
+
+static void list_push(slab_t **head, slab_t *slab) {
+    slab->prev = 0;
+    slab->next = *head;
+    if (*head) {
+        (*head)->prev = slab;
+    }
+    *head = slab;
+}
+
+static void list_remove(slab_t **head, slab_t *slab) {
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    } else {
+        *head = slab->next;
+    }
+    if (slab->next) {
+        slab->next->prev = slab->prev;
+    }
+    slab->prev = 0;
+    slab->next = 0;
+}
+
+static bool cache_setup(kmem_cache_t *cache, const char *name, size_t size, size_t align,
+                        kmem_ctor_t ctor, unsigned int max_order) {
+    if (size == 0 || align > SLAB_PAGE_SIZE || (align & (align - 1)) != 0) {
+        return false;
+    }
+    if (align < sizeof(void *)) {
+        align = sizeof(void *);
+    }
+
+    memset(cache, 0, sizeof(*cache));
+    cache->name = name;
+    cache->size = size;
+    cache->align = align;
+    cache->ctor = ctor;
+    if (ctor) {
+        cache->link_offset = align_up(size, sizeof(void *));
+        cache->stride = align_up(cache->link_offset + sizeof(void *), align);
+    } else {
+        cache->link_offset = 0;
+        cache->stride = align_up(size < sizeof(void *) ? sizeof(void *) : size, align);
+    }
+    cache->first_offset = align_up(SLAB_HEADER_SIZE, align);
+
+    /* Smallest slab holding SLAB_MIN_OBJECTS, or as many as the largest allows. */
+    for (cache->order = 0; cache->order <= max_order; cache->order++) {
+        uint64_t bytes = slab_bytes(cache);
+        if (bytes <= cache->first_offset) {
+            continue;
+        }
+        cache->objects_per_slab = (uint32_t)((bytes - cache->first_offset) / cache->stride);
+        if (cache->objects_per_slab >= SLAB_MIN_OBJECTS ||
+            (cache->order == max_order && cache->objects_per_slab > 0)) {
+            break;
+        }
+    }
+    if (cache->order > max_order || cache->objects_per_slab == 0) {
+        return false;
+    }
+
+    ticket_init(&cache->lock, name);
+    spin_lock(&cache_list_lock);
+    cache->next_cache = cache_list;
+    cache_list = cache;
+    spin_unlock(&cache_list_lock);
+    return true;
+}
+
+static slab_t *slab_grow(kmem_cache_t *cache) {
+    uint64_t phys = pmm_alloc_pages(cache->order);
+    slab_t *slab;
+    uint8_t *obj;
+
+    if (phys == 0) {
+        return 0;
+    }
+
+    slab = (slab_t *)vmm_phys_to_virt(phys);
+    slab->magic = SLAB_MAGIC;
+    slab->order = (uint16_t)cache->order;
+    slab->inuse = 0;
+    slab->cache = cache;
+    slab->free = 0;
+
+    /* Chain back to front so allocation walks the slab in address order. */
+    obj = (uint8_t *)slab + cache->first_offset + (size_t)(cache->objects_per_slab - 1) * cache->stride;
+    for (uint32_t i = 0; i < cache->objects_per_slab; i++, obj -= cache->stride) {
+        if (cache->ctor) {
+            cache->ctor(obj);
+        }
+        *link_of(cache, obj) = slab->free;
+        slab->free = obj;
+    }
+
+    list_push(&cache->partial, slab);
+    cache->slabs++;
+    cache->empty_slabs++;
+    return slab;
+}
+
+static void slab_release(kmem_cache_t *cache, slab_t *slab) {
+    list_remove(&cache->partial, slab);
+    slab->magic = 0;
+    cache->slabs--;
+    cache->empty_slabs--;
+    pmm_free_pages(vmm_direct_to_phys(slab), cache->order);
+}
+
+static void *slab_take(kmem_cache_t *cache) {
+    slab_t *slab = cache->partial;
+    void *obj;
+
+    if (!slab) {
+        slab = slab_grow(cache);
+        if (!slab) {
+            return 0;
+        }
+    }
+
+    obj = slab->free;
+    slab->free = *link_of(cache, obj);
+    if (slab->inuse++ == 0) {
+        cache->empty_slabs--;
+    }
+    if (!slab->free) {
+        list_remove(&cache->partial, slab);
+        list_push(&cache->full, slab);
+    }
+    cache->inuse++;
+    return obj;
+}
+
+static slab_t *slab_of(const kmem_cache_t *cache, const void *obj) {
+    slab_t *slab = (slab_t *)((uintptr_t)obj & ~(uintptr_t)(slab_bytes(cache) - 1));
+    uintptr_t offset = (uintptr_t)obj - (uintptr_t)slab;
+
+    if (slab->magic != SLAB_MAGIC || slab->cache != cache ||
+        offset < cache->first_offset ||
+        (offset - cache->first_offset) % cache->stride != 0 ||
+        (offset - cache->first_offset) / cache->stride >= cache->objects_per_slab) {
+        return 0;
+    }
+    return slab;
+}
+
+static void slab_put(kmem_cache_t *cache, void *obj) {
+    slab_t *slab = slab_of(cache, obj);
+
+    if (!slab || slab->inuse == 0) {
+        count_invalid();
+        return;
+    }
+
+    if (!slab->free) {
+        list_remove(&cache->full, slab);
+        list_push(&cache->partial, slab);
+    }
+    *link_of(cache, obj) = slab->free;
+    slab->free = obj;
+    cache->inuse--;
+
+    /* Keep one empty slab around to absorb alloc/free ping-pong. */
+    if (--slab->inuse == 0 && ++cache->empty_slabs > 1) {
+        slab_release(cache, slab);
+    }
+}
+
+/* Interrupts must be off and the magazine's lock held. */
+static void magazine_flush(kmem_cache_t *cache, slab_magazine_t *mag, uint32_t keep) {
+    ticket_lock(&cache->lock);
+    while (mag->count > keep) {
+        slab_put(cache, mag->objects[--mag->count]);
+    }
+    ticket_unlock(&cache->lock);
+}
+
+void slab_init(void) {
+    cache_list = 0;
+    memset(invalid_ops, 0, sizeof(invalid_ops));
+    spin_init(&cache_list_lock, "slab_caches");
+    (void)cache_setup(&cache_cache, "kmem_cache", sizeof(kmem_cache_t), 64, 0, SLAB_MAX_ORDER);
+
+    /* Single-page slabs, so kfree() finds the header by masking to the page. */
+    for (unsigned int i = 0; i < KMALLOC_CLASSES; i++) {
+        size_t size = (size_t)1 << (KMALLOC_MIN_SHIFT + i);
+        kmem_cache_t *cache = kmem_cache_alloc(&cache_cache);
+        if (cache && !cache_setup(cache, kmalloc_names[i], size, size < 64 ? size : 64, 0, 0)) {
+            kmem_cache_free(&cache_cache, cache);
+            cache = 0;
+        }
+        kmalloc_caches[i] = cache;
+    }
+}
+
+kmem_cache_t *kmem_cache_create(const char *name, size_t size, size_t align, kmem_ctor_t ctor) {
+    kmem_cache_t *cache = kmem_cache_alloc(&cache_cache);
+
+    if (!cache) {
+        return 0;
+    }
+    if (!cache_setup(cache, name, size, align, ctor, SLAB_MAX_ORDER)) {
+        kmem_cache_free(&cache_cache, cache);
+        count_invalid();
+        return 0;
+    }
+    return cache;
+}
+
+void *kmem_cache_alloc(kmem_cache_t *cache) {
+    slab_magazine_t *mag;
+    void *obj = 0;
+    uint64_t flags;
+
+    if (!cache) {
+        count_invalid();
+        return 0;
+    }
+
+    flags = irq_save();
+    mag = this_magazine(cache);
+    spin_lock(&mag->lock);
+    if (mag->count != 0) {
+        mag->hits++;
+        obj = mag->objects[--mag->count];
+        spin_unlock_irqrestore(&mag->lock, flags);
+        return obj;
+    }
+
+    mag->misses++;
+    ticket_lock(&cache->lock);
+    while (mag->count < SLAB_MAG_BATCH) {
+        obj = slab_take(cache);
+        if (!obj) {
+            break;
+        }
+        mag->objects[mag->count++] = obj;
+    }
+    ticket_unlock(&cache->lock);
+    obj = (mag->count != 0) ? mag->objects[--mag->count] : 0;
+    spin_unlock_irqrestore(&mag->lock, flags);
+    return obj;
+}
+
+void kmem_cache_free(kmem_cache_t *cache, void *obj) {
+    slab_magazine_t *mag;
+    uint64_t flags;
+
+    if (!cache || !obj || !slab_of(cache, obj)) {
+        count_invalid();
+        return;
+    }
+
+    flags = irq_save();
+    mag = this_magazine(cache);
+    spin_lock(&mag->lock);
+    if (mag->count == SLAB_MAG_SIZE) {
+        magazine_flush(cache, mag, SLAB_MAG_SIZE - SLAB_MAG_BATCH);
+    }
+    mag->objects[mag->count++] = obj;
+    spin_unlock_irqrestore(&mag->lock, flags);
+}
+
+void kmem_cache_shrink(kmem_cache_t *cache) {
+    slab_t *slab;
+    uint64_t flags;
+
+    if (!cache) {
+        return;
+    }
+
+    flags = irq_save();
+    for (unsigned int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        slab_magazine_t *mag = &cache->mags[cpu];
+
+        spin_lock(&mag->lock);
+        magazine_flush(cache, mag, 0);
+        spin_unlock(&mag->lock);
+    }
+
+    ticket_lock(&cache->lock);
+    slab = cache->partial;
+    while (slab) {
+        slab_t *next = slab->next;
+        if (slab->inuse == 0) {
+            slab_release(cache, slab);
+        }
+        slab = next;
+    }
+    ticket_unlock(&cache->lock);
+    irq_restore(flags);
+}
+
+bool kmem_cache_info(size_t index, kmem_cache_info_t *out) {
+    kmem_cache_t *cache = cache_list;
+    uint64_t cached = 0;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+
+    while (cache && index > 0) {
+        cache = cache->next_cache;
+        index--;
+    }
+    if (!cache || !out) {
+        return false;
+    }
+
+    for (unsigned int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        cached += cache->mags[cpu].count;
+        hits += cache->mags[cpu].hits;
+        misses += cache->mags[cpu].misses;
+    }
+
+    out->name = cache->name;
+    out->object_size = cache->size;
+    out->active_objects = cache->inuse - cached;
+    out->total_objects = cache->slabs * cache->objects_per_slab;
+    out->slabs = cache->slabs;
+    out->mag_hits = hits;
+    out->mag_misses = misses;
+    return true;
+}
+
+void *kmalloc(size_t size) {
+    uint64_t phys;
+    unsigned int order = 0;
+    slab_t *block;
+
+    if (size == 0) {
+        return 0;
+    }
+
+    if (size <= ((size_t)1 << KMALLOC_MAX_SHIFT)) {
+        unsigned int shift = KMALLOC_MIN_SHIFT;
+        while (((size_t)1 << shift) < size) {
+            shift++;
+        }
+        return kmem_cache_alloc(kmalloc_caches[shift - KMALLOC_MIN_SHIFT]);
+    }
+
+    while ((SLAB_PAGE_SIZE << order) < size + SLAB_HEADER_SIZE) {
+        if (++order > PMM_MAX_ORDER) {
+            return 0;
+        }
+    }
+
+    phys = pmm_alloc_pages(order);
+    if (phys == 0) {
+        return 0;
+    }
+
+    block = (slab_t *)vmm_phys_to_virt(phys);
+    memset(block, 0, sizeof(*block));
+    block->magic = SLAB_MAGIC;
+    block->order = (uint16_t)order;
+    return (uint8_t *)block + SLAB_HEADER_SIZE;
+}
+
+void *kzalloc(size_t size) {
+    void *ptr = kmalloc(size);
+    if (ptr) {
+        memset(ptr, 0, size);
+    }
+    return ptr;
+}
+
+/* Only for kmalloc() memory; typed caches use kmem_cache_free(). */
+void kfree(void *ptr) {
+    slab_t *slab;
+
+    if (!ptr) {
+        return;
+    }
+
+    slab = (slab_t *)((uintptr_t)ptr & ~(uintptr_t)(SLAB_PAGE_SIZE - 1));
+    if (slab->magic != SLAB_MAGIC) {
+        count_invalid();
+        return;
+    }
+
+    if (slab->cache) {
+        kmem_cache_free(slab->cache, ptr);
+        return;
+    }
+
+    if ((uint8_t *)ptr != (uint8_t *)slab + SLAB_HEADER_SIZE) {
+        count_invalid();
+        return;
+    }
+    slab->magic = 0;
+    pmm_free_pages(vmm_direct_to_phys(slab), slab->order);
+}
+
+uint64_t slab_invalid_ops(void) {
+    uint64_t total = 0;
+
+    for (unsigned int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        total += invalid_ops[cpu];
+    }
+    return total;
+}
@@ -0,0 +1,204 @@
+#include <stddef.h>
+
+#include <kernel/acpi.h>
+#include <kernel/apic.h>
+#include <kernel/clock.h>
+#include <kernel/idt.h>
+#include <kernel/io.h>
+#include <kernel/pmm.h>
+#include <kernel/sched.h>
+#include <kernel/smp.h>
+#include <kernel/string.h>
+#include <kernel/vmm.h>
+
+/* Must match TRAMPOLINE_PHYS in trampoline.S; the PMM never hands out low memory. */
+#define SMP_TRAMPOLINE_PHYS 0x8000ULL
+#define TRAMP_PML4_PHYS (SMP_TRAMPOLINE_PHYS + 0x1000ULL)
+#define TRAMP_PDPT_PHYS (SMP_TRAMPOLINE_PHYS + 0x2000ULL)
+#define TRAMP_PD_PHYS (SMP_TRAMPOLINE_PHYS + 0x3000ULL)
+
+#define MSR_EFER 0xC0000080U
+#define MSR_GS_BASE 0xC0000101U
+#define EFER_LME (1ULL << 8)
+#define EFER_NXE (1ULL << 11)
+
+#define TABLE_PRESENT_RW 0x03ULL
+#define TABLE_HUGE 0x80ULL
+
+/* Intel MP spec timings for INIT-SIPI-SIPI, plus a generous wait for the AP. */
+#define AP_INIT_DELAY_US 10000U
+#define AP_SIPI_DELAY_US 200U
+#define AP_ONLINE_TIMEOUT_US 100000U
+
+extern uint8_t smp_trampoline_start[];
+extern uint8_t smp_trampoline_end[];
+extern uint8_t smp_trampoline_cr3[];
+extern uint8_t smp_trampoline_efer[];
+extern uint8_t smp_trampoline_stack[];
+extern uint8_t smp_trampoline_entry[];
+extern uint8_t smp_trampoline_arg[];
+extern uint8_t stack_top[];
+
+static cpu_t cpus[SMP_MAX_CPUS];
+static unsigned int possible_cpus = 1;
+static volatile unsigned int online_cpus = 1;
+
+static void delay_us(uint64_t us) {
+    uint64_t end = clock_monotonic_ns() + us * 1000ULL;
+
+    while (clock_monotonic_ns() < end) {
+        __asm__ volatile ("pause");
+    }
+}
+
+/* Load this CPU's GDT/TSS and point GS at its data area. */
+static void cpu_setup(cpu_t *cpu) {
+    cpu->self = cpu;
+    gdt_load_cpu(&cpu->gdt, cpu->stack_top);
+    wrmsr(MSR_GS_BASE, (uint64_t)(uintptr_t)cpu);
+}
+
+/* Must run first in kernel_main: the allocators index per-CPU state through GS. */
+void smp_init_bsp(void) {
+    cpu_t *cpu = &cpus[0];
+
+    cpu->id = 0;
+    cpu->stack_top = (uint64_t)(uintptr_t)stack_top;
+    cpu_setup(cpu);
+    cpu->online = true;
+}
+
+unsigned int smp_cpu_id(void) {
+    uint32_t id;
+
+    __asm__ volatile ("movl %%gs:%c1, %0" : "=r"(id) : "i"(offsetof(cpu_t, id)));
+    return id;
+}
+
+cpu_t *smp_this_cpu(void) {
+    cpu_t *cpu;
+
+    __asm__ volatile ("movq %%gs:0, %0" : "=r"(cpu));
+    return cpu;
+}
+
+cpu_t *smp_cpu(unsigned int id) {
+    if (id >= possible_cpus || !cpus[id].online) {
+        return 0;
+    }
+    return &cpus[id];
+}
+
+unsigned int smp_online_cpus(void) {
+    return online_cpus;
+}
+
+unsigned int smp_possible_cpus(void) {
+    return possible_cpus;
+}
+
+/* First C code on an AP, on its own stack but still on the trampoline tables. */
+static void ap_main(cpu_t *cpu) {
+    vmm_init_cpu();
+    cpu_setup(cpu);
+    idt_load();
+    apic_init_ap();
+
+    sched_init_cpu();
+
+    __atomic_store_n(&cpu->online, true, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&online_cpus, 1, __ATOMIC_RELEASE);
+    sched_idle();
+}
+
+static uint64_t *trampoline_param(uint8_t *symbol) {
+    return vmm_phys_to_virt(SMP_TRAMPOLINE_PHYS + (uint64_t)(symbol - smp_trampoline_start));
+}
+
+/*
+ * Copy the startup code below 1 MiB and build its page tables: the low
+ * 2 MiB identity-mapped for the switch to long mode, plus the kernel half.
+ */
+static void trampoline_setup(void) {
+    uint64_t *pml4 = vmm_phys_to_virt(TRAMP_PML4_PHYS);
+    uint64_t *pdpt = vmm_phys_to_virt(TRAMP_PDPT_PHYS);
+    uint64_t *pd = vmm_phys_to_virt(TRAMP_PD_PHYS);
+    const uint64_t *kernel = vmm_phys_to_virt(vmm_kernel_pml4());
+
+    memcpy(vmm_phys_to_virt(SMP_TRAMPOLINE_PHYS), smp_trampoline_start,
+           (size_t)(smp_trampoline_end - smp_trampoline_start));
+
+    memset(pml4, 0, 4096);
+    memset(pdpt, 0, 4096);
+    memset(pd, 0, 4096);
+    for (unsigned int i = 256; i < 512; i++) {
+        pml4[i] = kernel[i];
+    }
+    pml4[0] = TRAMP_PDPT_PHYS | TABLE_PRESENT_RW;
+    pdpt[0] = TRAMP_PD_PHYS | TABLE_PRESENT_RW;
+    pd[0] = TABLE_HUGE | TABLE_PRESENT_RW;
+
+    *trampoline_param(smp_trampoline_cr3) = TRAMP_PML4_PHYS;
+    *trampoline_param(smp_trampoline_efer) = rdmsr(MSR_EFER) & (EFER_LME | EFER_NXE);
+    *trampoline_param(smp_trampoline_entry) = (uint64_t)(uintptr_t)ap_main;
+}
+
+static bool start_ap(cpu_t *cpu) {
+    uint64_t waited = 0;
+
+    *trampoline_param(smp_trampoline_stack) = cpu->stack_top;
+    *trampoline_param(smp_trampoline_arg) = (uint64_t)(uintptr_t)cpu;
+
+    lapic_send_ipi(cpu->apic_id, APIC_IPI_INIT);
+    delay_us(AP_INIT_DELAY_US);
+    for (unsigned int attempt = 0; attempt < 2 && !cpu->online; attempt++) {
+        lapic_send_ipi(cpu->apic_id, APIC_IPI_STARTUP | (uint32_t)(SMP_TRAMPOLINE_PHYS >> 12));
+        delay_us(AP_SIPI_DELAY_US);
+    }
+    while (!__atomic_load_n(&cpu->online, __ATOMIC_ACQUIRE) && waited < AP_ONLINE_TIMEOUT_US) {
+        delay_us(100);
+        waited += 100;
+    }
+    return cpu->online;
+}
+
+/*
+ * Start every enabled CPU in the MADT, one at a time since they share the
+ * trampoline. Needs the LAPIC and clock; returns the online CPU count.
+ */
+unsigned int smp_boot_aps(void) {
+    const acpi_madt_info_t *madt = acpi_madt();
+    uint32_t bsp_apic_id;
+
+    if (!madt || !apic_enabled()) {
+        return online_cpus;
+    }
+
+    bsp_apic_id = lapic_id();
+    cpus[0].apic_id = bsp_apic_id;
+    trampoline_setup();
+
+    for (uint32_t i = 0; i < madt->cpu_count && possible_cpus < SMP_MAX_CPUS; i++) {
+        uint32_t apic_id = madt->cpu_apic_ids[i];
+        cpu_t *cpu = &cpus[possible_cpus];
+        uint64_t stack;
+
+        /* xAPIC mode only addresses 8-bit APIC IDs. */
+        if (apic_id == bsp_apic_id || (!apic_x2apic() && apic_id > 0xFFU)) {
+            continue;
+        }
+        stack = pmm_alloc_pages(SMP_STACK_ORDER);
+        if (stack == 0) {
+            break;
+        }
+
+        memset(cpu, 0, sizeof(*cpu));
+        cpu->id = possible_cpus;
+        cpu->apic_id = apic_id;
+        cpu->stack_top = (uint64_t)(uintptr_t)vmm_phys_to_virt(stack) + (4096ULL << SMP_STACK_ORDER);
+        /* A CPU that misses the timeout may still wake later, so its slot and stack stay claimed. */
+        (void)start_ap(cpu);
+        possible_cpus++;
+    }
+    return online_cpus;
+}
@@ -0,0 +1,112 @@
+#include <kernel/io.h>
+#include <kernel/smp.h>
+#include <kernel/softirq.h>
+
+/* Passes over newly raised work before leaving the rest to the next exit or the idle loop. */
+#define SOFTIRQ_MAX_RESTART 10U
+
+typedef struct {
+    softirq_fn fn;
+    softirq_stats_t stats;
+} softirq_action_t;
+
+/* Handlers and stats are shared; pending work and the running flag are per CPU. */
+static softirq_action_t actions[SOFTIRQ_MAX];
+
+bool softirq_register(softirq_nr_t nr, const char *name, softirq_fn fn) {
+    if ((unsigned int)nr >= SOFTIRQ_MAX || !fn || actions[nr].fn) {
+        return false;
+    }
+    actions[nr].stats.name = name;
+    actions[nr].fn = fn;
+    return true;
+}
+
+/* Safe from any context; the work runs on this CPU's next IRQ exit or idle pass. */
+void softirq_raise(softirq_nr_t nr) {
+    uint64_t flags;
+
+    if ((unsigned int)nr >= SOFTIRQ_MAX) {
+        return;
+    }
+    flags = irq_save();
+    __atomic_fetch_or(&smp_this_cpu()->softirq_pending, 1U << nr, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&actions[nr].stats.raised, 1U, __ATOMIC_RELAXED);
+    irq_restore(flags);
+}
+
+/*
+ * True while this CPU runs softirq handlers; an interrupt nested in them
+ * must not switch threads. Call with interrupts disabled.
+ */
+bool softirq_active(void) {
+    return smp_this_cpu()->softirq_running;
+}
+
+/* Call with interrupts disabled. */
+bool softirq_pending(void) {
+    return smp_this_cpu()->softirq_pending != 0;
+}
+
+static void record_run(softirq_stats_t *stats, uint64_t cycles) {
+    uint64_t max = __atomic_load_n(&stats->cycles_max, __ATOMIC_RELAXED);
+
+    __atomic_fetch_add(&stats->runs, 1U, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&stats->cycles_total, cycles, __ATOMIC_RELAXED);
+    while (cycles > max && !__atomic_compare_exchange_n(&stats->cycles_max, &max, cycles, true,
+                                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+/*
+ * Call with interrupts disabled. Handlers run with interrupts enabled, and a
+ * nested interrupt only raises more work instead of recursing in here.
+ * softirq_active() keeps the thread from being preempted onto another CPU
+ * meanwhile. Returns with interrupts disabled.
+ */
+void softirq_run(void) {
+    cpu_t *cpu = smp_this_cpu();
+    uint32_t restarts = SOFTIRQ_MAX_RESTART;
+
+    if (cpu->softirq_running || cpu->softirq_pending == 0) {
+        return;
+    }
+    cpu->softirq_running = true;
+
+    while (cpu->softirq_pending != 0 && restarts-- > 0) {
+        uint32_t work = __atomic_exchange_n(&cpu->softirq_pending, 0U, __ATOMIC_ACQ_REL);
+        sti();
+
+        while (work != 0) {
+            unsigned int nr = (unsigned int)__builtin_ctz(work);
+            softirq_action_t *action = &actions[nr];
+            uint64_t start;
+            uint64_t cycles;
+
+            work &= work - 1;
+            if (!action->fn) {
+                continue;
+            }
+            start = rdtsc();
+            action->fn();
+            cycles = rdtsc() - start;
+            record_run(&action->stats, cycles);
+        }
+
+        cli();
+    }
+
+    cpu->softirq_running = false;
+}
+
+bool softirq_stats(softirq_nr_t nr, softirq_stats_t *out) {
+    uint64_t flags;
+
+    if ((unsigned int)nr >= SOFTIRQ_MAX || !actions[nr].fn) {
+        return false;
+    }
+    flags = irq_save();
+    *out = actions[nr].stats;
+    irq_restore(flags);
+    return true;
+}
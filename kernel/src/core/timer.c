@@ -0,0 +1,239 @@
+#include <kernel/apic.h>
+#include <kernel/clock.h>
+#include <kernel/cpuidle.h>
+#include <kernel/io.h>
+#include <kernel/irq.h>
+#include <kernel/ktimer.h>
+#include <kernel/pit.h>
+#include <kernel/sched.h>
+#include <kernel/smp.h>
+#include <kernel/softirq.h>
+#include <kernel/timer.h>
+
+/* LAPIC timer calibration window, timed with the calibrated TSC. */
+#define CALIBRATE_NS 10000000ULL
+#define PIT_MAX_COUNT 0xFFFFU
+
+static timer_stats_t stats;
+static uint64_t boot_tsc = 0;
+static uint64_t cycles_per_tick = 1;
+/* TSC cycles per LAPIC timer count (bus clock / 16). */
+static uint64_t cycles_per_lapic = 1;
+
+static bool ticking = false;
+static uint64_t next_tick_tsc = 0;
+static uint64_t idle_start_tsc = 0;
+/* When the one-shot will fire, UINT64_MAX while stopped. */
+static uint64_t armed_tsc = UINT64_MAX;
+
+static void calibrate_lapic(void) {
+    uint64_t window = clock_ns_to_cycles(CALIBRATE_NS);
+    uint64_t tsc_start;
+    uint32_t lapic_left;
+
+    lapic_timer_oneshot(0xFFFFFFFFU);
+    tsc_start = rdtsc();
+    while (rdtsc() - tsc_start < window) {
+    }
+    lapic_left = lapic_timer_current();
+    lapic_timer_stop();
+
+    if (lapic_left < 0xFFFFFFFFU) {
+        cycles_per_lapic = window / (0xFFFFFFFFULL - lapic_left);
+    }
+    if (cycles_per_lapic == 0) {
+        cycles_per_lapic = 1;
+    }
+}
+
+/* Program the hardware to interrupt at TSC value `deadline`. */
+static void program(uint64_t deadline) {
+    uint64_t now = rdtsc();
+    uint64_t delta = (deadline > now) ? deadline - now : 1;
+
+    switch (stats.mode) {
+    case TIMER_MODE_TSC_DEADLINE:
+        lapic_timer_deadline(deadline);
+        break;
+    case TIMER_MODE_LAPIC_ONESHOT: {
+        uint64_t count = delta / cycles_per_lapic;
+        lapic_timer_oneshot((uint32_t)(count == 0 ? 1 : (count > 0xFFFFFFFFULL ? 0xFFFFFFFFULL : count)));
+        break;
+    }
+    default: {
+        /* Longer waits wake early at the PIT's 55 ms limit and re-arm. */
+        uint64_t max_delta = (stats.tsc_hz * PIT_MAX_COUNT) / PIT_FREQUENCY_HZ;
+        uint64_t count;
+        if (delta > max_delta) {
+            delta = max_delta;
+        }
+        count = (delta * PIT_FREQUENCY_HZ) / stats.tsc_hz;
+        pit_oneshot((uint16_t)(count == 0 ? 1 : count));
+        break;
+    }
+    }
+    armed_tsc = now + delta;
+}
+
+static void stop(void) {
+    armed_tsc = UINT64_MAX;
+    if (stats.mode == TIMER_MODE_PIT_ONESHOT) {
+        pit_stop();
+    } else {
+        lapic_timer_stop();
+    }
+}
+
+/*
+ * Arm for the earlier of the next tick (when ticking) and the timer wheel's
+ * next deadline. Due wheel work is handed to the timer softirq, which
+ * re-arms when done; until then the wheel is only polled once per tick.
+ */
+static void rearm(void) {
+    uint64_t deadline = UINT64_MAX;
+    uint64_t wheel_ns = ktimer_next_deadline_ns();
+
+    if (ticking) {
+        deadline = next_tick_tsc;
+    }
+    if (wheel_ns != UINT64_MAX) {
+        uint64_t now_ns = clock_monotonic_ns();
+        uint64_t wheel_tsc;
+
+        if (wheel_ns <= now_ns) {
+            softirq_raise(SOFTIRQ_TIMER);
+            stats.events++;
+            wheel_ns = now_ns + KTIMER_TICK_NS;
+        }
+        wheel_tsc = rdtsc() + clock_ns_to_cycles(wheel_ns - now_ns);
+        if (wheel_tsc < deadline) {
+            deadline = wheel_tsc;
+        }
+    }
+
+    if (deadline == UINT64_MAX) {
+        stop();
+    } else {
+        program(deadline);
+    }
+}
+
+static uint64_t next_tick_after(uint64_t now) {
+    return boot_tsc + ((now - boot_tsc) / cycles_per_tick + 1) * cycles_per_tick;
+}
+
+static bool timer_irq(void *ctx) {
+    uint64_t now = rdtsc();
+
+    (void)ctx;
+
+    stats.interrupts++;
+    if (ticking && now >= next_tick_tsc) {
+        stats.ticks++;
+        next_tick_tsc = next_tick_after(now);
+        sched_tick();
+    }
+    rearm();
+    return true;
+}
+
+/*
+ * Pick the best one-shot source: TSC-deadline, else the LAPIC timer, else
+ * PIT mode 0. Call after apic_init() and clock_init(), interrupts disabled.
+ */
+void timer_init(void) {
+    bool lapic = apic_enabled();
+
+    stats.tsc_hz = clock_tsc_hz();
+    if (lapic) {
+        calibrate_lapic();
+    }
+    boot_tsc = rdtsc();
+    cycles_per_tick = stats.tsc_hz / TIMER_HZ;
+    if (cycles_per_tick == 0) {
+        cycles_per_tick = 1;
+    }
+
+    if (lapic_has_tsc_deadline()) {
+        stats.mode = TIMER_MODE_TSC_DEADLINE;
+    } else if (lapic) {
+        stats.mode = TIMER_MODE_LAPIC_ONESHOT;
+    } else {
+        stats.mode = TIMER_MODE_PIT_ONESHOT;
+    }
+
+    if (stats.mode != TIMER_MODE_PIT_ONESHOT) {
+        /* The PIT line is no longer needed once the LAPIC timer drives TIMER_VECTOR. */
+        ioapic_mask_irq(0);
+        lapic_timer_setup(TIMER_VECTOR, stats.mode == TIMER_MODE_TSC_DEADLINE);
+    }
+
+    irq_register(0, timer_irq, 0);
+    ticking = true;
+    next_tick_tsc = next_tick_after(boot_tsc);
+    rearm();
+}
+
+/* Called with interrupts disabled right before hlt: stop the periodic tick. */
+void timer_idle_enter(void) {
+    ticking = false;
+    idle_start_tsc = rdtsc();
+    stats.idle_entries++;
+    rearm();
+}
+
+void timer_idle_exit(void) {
+    uint64_t now = rdtsc();
+
+    stats.ticks_suppressed += (now - idle_start_tsc) / cycles_per_tick;
+    ticking = true;
+    next_tick_tsc = next_tick_after(now);
+    rearm();
+}
+
+/*
+ * The timer wheel's earliest deadline moved. The timer interrupt lives on
+ * CPU 0, so another CPU sends it TIMER_VECTOR to re-arm from timer_irq().
+ */
+void timer_reprogram(void) {
+    uint64_t flags;
+
+    if (stats.tsc_hz == 0) {
+        return;
+    }
+    if (smp_cpu_id() != 0) {
+        cpu_t *boot = smp_cpu(0);
+        if (boot && apic_enabled()) {
+            cpuidle_kick(0);
+            lapic_send_ipi(boot->apic_id, APIC_IPI_FIXED | TIMER_VECTOR);
+        }
+        return;
+    }
+    flags = irq_save();
+    rearm();
+    irq_restore(flags);
+}
+
+/* TIMER_HZ ticks since timer_init(), counted from the TSC so idle gaps are included. */
+uint64_t timer_ticks(void) {
+    return (rdtsc() - boot_tsc) / cycles_per_tick;
+}
+
+uint64_t timer_deadline_tsc(void) {
+    return armed_tsc;
+}
+
+void timer_stats(timer_stats_t *out) {
+    *out = stats;
+}
+
+const char *timer_mode_name(timer_mode_t mode) {
+    switch (mode) {
+    case TIMER_MODE_TSC_DEADLINE:
+        return "tsc-deadline";
+    case TIMER_MODE_LAPIC_ONESHOT:
+        return "lapic-oneshot";
+    default:
+        return "pit-oneshot";
+    }
+}
@@ -1,16 +1,22 @@
 #include <kernel/console.h>
+#include <kernel/io.h>
 #include <kernel/keyboard.h>
 #include <kernel/pty.h>
+#include <kernel/ring.h>
+#include <kernel/sched.h>
 #include <kernel/tty.h>
+#include <kernel/waitqueue.h>
 
 #include <stddef.h>
 
-#define TTY_READ_QUEUE_SIZE 2048
+/* 2048-byte read queue. */
+#define TTY_READ_QUEUE_ORDER 11
 #define TTY_LINE_BUFFER_SIZE 512
+#define TTY_POLL_CHUNK 64
 
-static volatile uint8_t tty_read_queue[TTY_READ_QUEUE_SIZE];
-static volatile unsigned int tty_read_head = 0;
-static volatile unsigned int tty_read_tail = 0;
+RING_DEFINE(tty_read_ring, uint8_t, TTY_READ_QUEUE_ORDER)
+
+static tty_read_ring_t tty_read_queue;
 
 static uint8_t tty_line_buffer[TTY_LINE_BUFFER_SIZE];
 static size_t tty_line_len = 0;
@@ -27,31 +33,20 @@ static bool tty_line_truncated = false;
 static int tty_session_id = -1;
 static int tty_session_pty = -1;
 
-static bool tty_enqueue_read(uint8_t byte) {
-    if (tty_session_pty >= 0 && pty_is_valid(tty_session_pty)) {
-        size_t wrote = pty_master_write(tty_session_pty, &byte, 1);
-        if (wrote == 1) {
-            return true;
-        }
-        tty_drop_count++;
-        return false;
-    }
+/* Hand bytes to the session's PTY, or to the local read queue without one. */
+static void tty_enqueue_read(const uint8_t *buf, size_t len) {
+    size_t wrote;
 
-    unsigned int next = (tty_read_head + 1) % TTY_READ_QUEUE_SIZE;
-    if (next == tty_read_tail) {
-        tty_drop_count++;
-        return false;
+    if (tty_session_pty >= 0 && pty_is_valid(tty_session_pty)) {
+        wrote = pty_master_write(tty_session_pty, buf, len);
+    } else {
+        wrote = tty_read_ring_push_n(&tty_read_queue, buf, len);
     }
-
-    tty_read_queue[tty_read_head] = byte;
-    tty_read_head = next;
-    return true;
+    tty_drop_count += len - wrote;
 }
 
 static void tty_flush_line_buffer(void) {
-    for (size_t i = 0; i < tty_line_len; i++) {
-        tty_enqueue_read(tty_line_buffer[i]);
-    }
+    tty_enqueue_read(tty_line_buffer, tty_line_len);
     tty_line_len = 0;
 }
 
@@ -98,7 +93,7 @@ static void tty_handle_canonical(uint8_t byte) {
 
     if (byte == 0x03) {
         tty_line_len = 0;
-        tty_enqueue_read(byte);
+        tty_enqueue_read(&byte, 1);
         if (tty_echo) {
             console_write("^C\n");
         }
@@ -106,7 +101,7 @@ static void tty_handle_canonical(uint8_t byte) {
     }
 
     if (byte == 0x0C) {
-        tty_enqueue_read(byte);
+        tty_enqueue_read(&byte, 1);
         return;
     }
 
@@ -140,7 +135,7 @@ static void tty_handle_canonical(uint8_t byte) {
 
     if (byte == 0x04) {
         if (tty_line_len == 0) {
-            tty_enqueue_read(byte);
+            tty_enqueue_read(&byte, 1);
         } else {
             tty_flush_line_buffer();
         }
@@ -168,15 +163,14 @@ static void tty_handle_canonical(uint8_t byte) {
 }
 
 static void tty_handle_noncanonical(uint8_t byte) {
-    tty_enqueue_read(byte);
+    tty_enqueue_read(&byte, 1);
     if (tty_echo) {
         console_putc((char)byte);
     }
 }
 
 void tty_init(void) {
-    tty_read_head = 0;
-    tty_read_tail = 0;
+    tty_read_ring_init(&tty_read_queue);
     tty_line_len = 0;
     tty_canonical = true;
     tty_echo = true;
@@ -191,26 +185,71 @@ void tty_init(void) {
 }
 
 void tty_poll_input(void) {
-    char c;
-
-    while (keyboard_pop_char(&c)) {
-        uint8_t byte = (uint8_t)c;
-        tty_rx_count++;
-        if (tty_canonical) {
-            tty_handle_canonical(byte);
-        } else {
-            tty_handle_noncanonical(byte);
+    char chunk[TTY_POLL_CHUNK];
+    size_t len;
+
+    while ((len = keyboard_read(chunk, sizeof(chunk))) > 0) {
+        for (size_t i = 0; i < len; i++) {
+            uint8_t byte = (uint8_t)chunk[i];
+            tty_rx_count++;
+            if (tty_canonical) {
+                tty_handle_canonical(byte);
+            } else {
+                tty_handle_noncanonical(byte);
+            }
         }
     }
 }
 
+static bool tty_input_ready(void) {
+    if (keyboard_has_input()) {
+        return true;
+    }
+    if (tty_session_pty >= 0 && pty_is_valid(tty_session_pty)) {
+        return pty_slave_readable(tty_session_pty);
+    }
+    return !tty_read_ring_empty(&tty_read_queue);
+}
+
+/*
+ * Sleep until there is something for tty_poll_input() or the reader to
+ * consume: raw keyboard bytes, or data on the attached PTY slave (the
+ * read queue without a session). Producers wake us; no polling.
+ */
+void tty_wait_input(void) {
+    wait_queue_t *pty_wait = 0;
+    wait_entry_t kbd_entry;
+    wait_entry_t pty_entry;
+    uint64_t flags = irq_save();
+
+    if (tty_session_pty >= 0) {
+        pty_wait = pty_slave_wait_queue(tty_session_pty);
+    }
+
+    sched_prepare_block();
+    wait_queue_add(keyboard_wait_queue(), &kbd_entry);
+    if (pty_wait) {
+        wait_queue_add(pty_wait, &pty_entry);
+    }
+    if (tty_input_ready()) {
+        sched_cancel_block();
+    } else {
+        sched_block();
+    }
+    if (pty_wait) {
+        wait_queue_remove(pty_wait, &pty_entry);
+    }
+    wait_queue_remove(keyboard_wait_queue(), &kbd_entry);
+    irq_restore(flags);
+}
+
 bool tty_pop_char(char *out) {
-    if (tty_read_tail == tty_read_head) {
+    uint8_t byte;
+
+    if (!tty_read_ring_pop(&tty_read_queue, &byte)) {
         return false;
     }
-
-    *out = (char)tty_read_queue[tty_read_tail];
-    tty_read_tail = (tty_read_tail + 1) % TTY_READ_QUEUE_SIZE;
+    *out = (char)byte;
     return true;
 }
 
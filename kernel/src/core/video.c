@@ -3,21 +3,12 @@
 #include <kernel/video.h>
 #include <kernel/vmm.h>
 
-#define HUGE_PAGE_SIZE (2ULL * 1024ULL * 1024ULL)
 #define FRAMEBUFFER_MAP_MAX_BYTES (256ULL * 1024ULL * 1024ULL)
 
 static video_framebuffer_info_t g_fb;
 
-static uint64_t align_down_2m(uint64_t value) {
-    return value & ~(HUGE_PAGE_SIZE - 1ULL);
-}
-
-static uint64_t align_up_2m(uint64_t value) {
-    return (value + HUGE_PAGE_SIZE - 1ULL) & ~(HUGE_PAGE_SIZE - 1ULL);
-}
-
 void video_probe_multiboot(uint32_t multiboot_info_addr) {
-    uint8_t *mb = (uint8_t *)(uintptr_t)multiboot_info_addr;
+    uint8_t *mb = (uint8_t *)vmm_phys_to_virt(multiboot_info_addr);
     uint32_t mb_total_size;
     struct multiboot_tag *tag = (struct multiboot_tag *)(mb + 8);
 
@@ -69,9 +60,6 @@ void video_probe_multiboot(uint32_t multiboot_info_addr) {
 }
 
 bool video_map_framebuffer(void) {
-    uint64_t map_start;
-    uint64_t map_end;
-
     if (!g_fb.present || g_fb.size_bytes == 0) {
         return false;
     }
@@ -80,21 +68,24 @@ bool video_map_framebuffer(void) {
         return false;
     }
 
-    map_start = align_down_2m(g_fb.phys_addr);
-    map_end = align_up_2m(g_fb.phys_addr + g_fb.size_bytes);
-    if (map_end <= map_start) {
-        return false;
-    }
+    /* Write-combining lets pixel stores stream instead of one bus write each. */
+    g_fb.virt_addr = vmm_map_mmio(g_fb.phys_addr, g_fb.size_bytes,
+                                  VMM_FLAG_WRITABLE | VMM_FLAG_NX | VMM_CACHE_WC);
+    g_fb.mapped = g_fb.virt_addr != 0;
+    return g_fb.mapped;
+}
 
-    for (uint64_t addr = map_start; addr < map_end; addr += HUGE_PAGE_SIZE) {
-        if (!vmm_map_2m(addr, addr, VMM_FLAG_WRITABLE)) {
-            g_fb.mapped = false;
-            return false;
-        }
+bool video_set_framebuffer_cache(uint64_t cache) {
+    uint64_t first;
+    uint64_t end;
+
+    if (!g_fb.mapped) {
+        return false;
     }
 
-    g_fb.mapped = true;
-    return true;
+    first = g_fb.virt_addr & ~0xFFFULL;
+    end = (g_fb.virt_addr + g_fb.size_bytes + 0xFFFULL) & ~0xFFFULL;
+    return vmm_protect(first, end - first, VMM_FLAG_WRITABLE | VMM_FLAG_NX | (cache & VMM_CACHE_MASK));
 }
 
 const video_framebuffer_info_t *video_framebuffer_info(void) {
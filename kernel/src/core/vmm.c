@@ -1,75 +1,1341 @@
+#include <kernel/apic.h>
 #include <kernel/io.h>
+#include <kernel/lock.h>
+#include <kernel/multiboot2.h>
 #include <kernel/pmm.h>
+#include <kernel/smp.h>
 #include <kernel/string.h>
 #include <kernel/vmm.h>
 
 #define PAGE_PRESENT (1ULL << 0)
 #define PAGE_WRITABLE (1ULL << 1)
 #define PAGE_USER (1ULL << 2)
+#define PAGE_PWT (1ULL << 3)
+#define PAGE_PCD (1ULL << 4)
+#define PAGE_ACCESSED (1ULL << 5)
+#define PAGE_DIRTY (1ULL << 6)
 #define PAGE_HUGE (1ULL << 7)
+#define PAGE_PAT_4K (1ULL << 7)
+#define PAGE_GLOBAL (1ULL << 8)
+#define PAGE_PAT_HUGE (1ULL << 12)
 #define PAGE_NX (1ULL << 63)
 
-#define IDENTITY_WINDOW_LIMIT (1024ULL * 1024ULL * 1024ULL)
+#define PAGE_SIZE_4K 0x1000ULL
+#define PAGE_SIZE_2M 0x200000ULL
+#define PAGE_SIZE_1G 0x40000000ULL
+#define PAGE_SIZE_512G 0x8000000000ULL
 
-extern uint64_t pml4_table[];
+#define ENTRY_ADDR_MASK 0x000FFFFFFFFFF000ULL
+#define ENTRY_HUGE_ADDR_MASK 0x000FFFFFFFE00000ULL
+#define ENTRY_1G_ADDR_MASK 0x000FFFFFC0000000ULL
+#define ENTRY_FLAGS_MASK (~ENTRY_ADDR_MASK)
+/* Bits the CPU updates behind our back; ignored when comparing entries. */
+#define ENTRY_STATUS_MASK (PAGE_ACCESSED | PAGE_DIRTY)
+
+#define MSR_EFER 0xC0000080U
+#define EFER_NXE (1ULL << 11)
+#define MSR_PAT 0x277U
+
+#define CR4_PGE (1ULL << 7)
+#define CR4_PCIDE (1ULL << 17)
+#define INVPCID_ALL_GLOBAL 2ULL
+
+/*
+ * A batch queues up to this many invlpg addresses, then falls back to one
+ * full flush. Each invlpg serialises and costs a later page walk, so past a
+ * few dozen pages they add up to more than a flush plus refilling the
+ * kernel's small working set; 32 also keeps the queue a 256-byte array.
+ */
+#define TLB_FLUSH_CEILING 32U
+
+/*
+ * PAT entries, selected by PAT:PCD:PWT in each leaf. Index 0 stays WB and
+ * index 3 stays UC, matching the power-on layout that boot.S relies on.
+ * 0: WB  1: WC  2: UC-  3: UC  4: WB  5: WT  6: UC-  7: UC
+ */
+#define PAT_LAYOUT 0x0007040600070106ULL
+
+/* Page-fault error code bits. */
+#define PF_PRESENT (1ULL << 0)
+#define PF_WRITE (1ULL << 1)
+#define PF_USER (1ULL << 2)
+#define PF_INSTR (1ULL << 4)
+
+#define VMM_MAX_REGIONS 16
+/* Unmapped page left between lazy regions to catch overruns. */
+#define REGION_GUARD PAGE_SIZE_4K
+
+/* boot.S maps the first 1 GiB at VMM_DIRECT_MAP_BASE before vmm_init() runs. */
+#define BOOT_DIRECT_MAP_LIMIT (1024ULL * 1024ULL * 1024ULL)
+/* Real-mode memory and ROMs below 1 MiB, always in the direct map. */
+#define LEGACY_AREA_END (1024ULL * 1024ULL)
+
+extern uint8_t _kernel_start;
+extern uint8_t _kernel_end;
+
+static uint64_t *pml4_table = 0;
+static uint64_t kernel_pml4_phys = 0;
+/* PAGE_NX once EFER.NXE is enabled; the bit is reserved before that. */
+static uint64_t nx_mask = 0;
+static bool has_1g_pages = false;
+static bool has_pat = false;
+static uint64_t direct_map_limit = BOOT_DIRECT_MAP_LIMIT;
+static uint64_t mmio_next = VMM_MMIO_BASE;
+static uint64_t table_frames = 0;
+
+typedef struct {
+    const char *name;
+    uint64_t base;
+    uint64_t size;
+    uint64_t flags;
+    uint64_t resident_pages;
+    uint64_t minor_faults;
+    bool used;
+} vmm_region_t;
+
+static vmm_region_t regions[VMM_MAX_REGIONS];
+
+/*
+ * Kernel page tables, the region table and the MMIO window cursor. Every
+ * change happens inside a flush batch, so the lock is only ever taken with
+ * interrupts off and TLB shootdowns are sent after it is dropped.
+ */
+static spinlock_t vmm_lock;
+
+static bool has_pcid = false;
+static bool has_invpcid = false;
+
+/*
+ * A CPU's open flush batch: queued invlpg addresses and frames held until
+ * the flush. The batch keeps interrupts off, so its owner cannot migrate
+ * while it is open.
+ */
+typedef struct {
+    uint32_t depth;
+    uint64_t irq_flags;
+    uint64_t pending[TLB_FLUSH_CEILING];
+    uint32_t count;
+    bool overflow;
+    uint64_t deferred_head;
+    uint64_t deferred_count;
+    vmm_tlb_stats_t stats;
+} __attribute__((aligned(64))) flush_batch_t;
+
+static flush_batch_t batches[SMP_MAX_CPUS];
+
+/*
+ * One TLB shootdown in flight at a time. The sender fills this in under
+ * shootdown_lock, sets `acks` to the number of targets, marks them and
+ * IPIs them; each target invalidates the same pages and counts down. A CPU
+ * spinning here with interrupts off keeps answering requests aimed at it,
+ * so two CPUs shooting at each other cannot deadlock.
+ */
+static struct {
+    uint64_t pages[TLB_FLUSH_CEILING];
+    uint32_t count;
+    bool full;
+    volatile uint32_t acks;
+    volatile bool wanted[SMP_MAX_CPUS];
+} shootdown;
+
+static spinlock_t shootdown_lock;
 
 static inline uint64_t *phys_to_virt(uint64_t phys_addr) {
-    return (uint64_t *)(uintptr_t)phys_addr;
+    return (uint64_t *)(uintptr_t)(VMM_DIRECT_MAP_BASE + phys_addr);
 }
 
-static bool ensure_table(uint64_t *parent, uint16_t index, uint64_t **out_child) {
-    if ((parent[index] & PAGE_PRESENT) == 0) {
-        uint64_t frame = pmm_alloc_frame_low(IDENTITY_WINDOW_LIMIT);
-        if (frame == 0) {
+void *vmm_phys_to_virt(uint64_t phys_addr) {
+    return phys_to_virt(phys_addr);
+}
+
+uint64_t vmm_direct_to_phys(const void *virt_addr) {
+    return (uint64_t)(uintptr_t)virt_addr - VMM_DIRECT_MAP_BASE;
+}
+
+uint64_t vmm_direct_map_limit(void) {
+    return direct_map_limit;
+}
+
+static inline uint16_t pml4_index(uint64_t virt_addr) {
+    return (uint16_t)((virt_addr >> 39) & 0x1FF);
+}
+
+static inline uint16_t pdpt_index(uint64_t virt_addr) {
+    return (uint16_t)((virt_addr >> 30) & 0x1FF);
+}
+
+static inline uint16_t pd_index(uint64_t virt_addr) {
+    return (uint16_t)((virt_addr >> 21) & 0x1FF);
+}
+
+static inline uint16_t pt_index(uint64_t virt_addr) {
+    return (uint16_t)((virt_addr >> 12) & 0x1FF);
+}
+
+/* First `align` boundary strictly above value. */
+static inline uint64_t next_boundary(uint64_t value, uint64_t align) {
+    return (value + align) & ~(align - 1);
+}
+
+/* Interrupts are off whenever this is used, so the CPU cannot change under it. */
+static flush_batch_t *this_batch(void) {
+    return &batches[smp_cpu_id()];
+}
+
+/* Drop every TLB entry, global ones and those of other PCIDs included. */
+static void flush_all_now(flush_batch_t *batch) {
+    if (has_invpcid) {
+        invpcid(INVPCID_ALL_GLOBAL, 0, 0);
+    } else {
+        uint64_t cr4 = read_cr4();
+        write_cr4(cr4 & ~CR4_PGE);
+        write_cr4(cr4);
+    }
+    batch->stats.full_flushes++;
+}
+
+static void flush_pages_now(flush_batch_t *batch, const uint64_t *pages, uint32_t count, bool full) {
+    if (full) {
+        flush_all_now(batch);
+        return;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        invlpg((void *)(uintptr_t)pages[i]);
+    }
+    batch->stats.page_flushes += count;
+}
+
+/* Only called inside a batch: every CPU must drop the entry before it is reused. */
+static void flush_page(uint64_t virt_addr) {
+    flush_batch_t *batch = this_batch();
+
+    batch->stats.deferred++;
+    if (batch->overflow || (batch->count != 0 && batch->pending[batch->count - 1] == virt_addr)) {
+        return;
+    }
+    if (batch->count == TLB_FLUSH_CEILING) {
+        batch->overflow = true;
+        return;
+    }
+    batch->pending[batch->count++] = virt_addr;
+}
+
+/*
+ * Return an unmapped frame to the PMM once the batch is flushed; until then
+ * some TLB may still reference it, so it is chained through its own first word.
+ */
+static void release_frame(uint64_t phys_addr) {
+    flush_batch_t *batch = this_batch();
+
+    *phys_to_virt(phys_addr) = batch->deferred_head;
+    batch->deferred_head = phys_addr;
+    batch->deferred_count++;
+}
+
+/* Apply the shootdown in flight if it targets this CPU. Interrupts must be off. */
+static void shootdown_poll(void) {
+    unsigned int cpu = smp_cpu_id();
+
+    if (!__atomic_load_n(&shootdown.wanted[cpu], __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    flush_pages_now(&batches[cpu], shootdown.pages, shootdown.count, shootdown.full);
+    __atomic_store_n(&shootdown.wanted[cpu], false, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&shootdown.acks, 1U, __ATOMIC_RELEASE);
+}
+
+/* Invalidate the batch's pages on every other online CPU and wait until they have. */
+static void shootdown_others(flush_batch_t *batch) {
+    unsigned int self = smp_cpu_id();
+    cpu_t *targets[SMP_MAX_CPUS];
+    uint32_t count = 0;
+
+    if (smp_online_cpus() < 2) {
+        return;
+    }
+
+    while (!spin_trylock(&shootdown_lock)) {
+        shootdown_poll();
+        cpu_relax();
+    }
+
+    for (uint32_t i = 0; i < batch->count; i++) {
+        shootdown.pages[i] = batch->pending[i];
+    }
+    shootdown.count = batch->count;
+    shootdown.full = batch->overflow;
+    for (unsigned int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        cpu_t *target = smp_cpu(cpu);
+        if (cpu != self && target) {
+            targets[count++] = target;
+        }
+    }
+    __atomic_store_n(&shootdown.acks, count, __ATOMIC_RELEASE);
+
+    for (uint32_t i = 0; i < count; i++) {
+        __atomic_store_n(&shootdown.wanted[targets[i]->id], true, __ATOMIC_RELEASE);
+        lapic_send_ipi(targets[i]->apic_id, APIC_IPI_FIXED | VMM_SHOOTDOWN_VECTOR);
+    }
+    while (__atomic_load_n(&shootdown.acks, __ATOMIC_ACQUIRE) != 0) {
+        cpu_relax();
+    }
+    batch->stats.shootdowns++;
+    spin_unlock(&shootdown_lock);
+}
+
+/* VMM_SHOOTDOWN_VECTOR handler. */
+void vmm_shootdown_irq(void) {
+    shootdown_poll();
+}
+
+/* PAT index for a VMM_CACHE_* type, as PAT(bit 2):PCD(bit 1):PWT(bit 0). */
+static uint64_t cache_pat_index(uint64_t flags) {
+    switch (flags & VMM_CACHE_MASK) {
+    case VMM_CACHE_WC:
+        return 1;
+    case VMM_CACHE_UC:
+        return 3;
+    case VMM_CACHE_WT:
+        return 5;
+    default:
+        return 0;
+    }
+}
+
+static uint64_t entry_flags(uint64_t flags, bool huge) {
+    uint64_t pat = cache_pat_index(flags);
+    uint64_t entry = PAGE_PRESENT;
+
+    if (pat & 1) {
+        entry |= PAGE_PWT;
+    }
+    if (pat & 2) {
+        entry |= PAGE_PCD;
+    }
+    if (pat & 4) {
+        entry |= huge ? PAGE_PAT_HUGE : PAGE_PAT_4K;
+    }
+    if (flags & VMM_FLAG_WRITABLE) {
+        entry |= PAGE_WRITABLE;
+    }
+    if (flags & VMM_FLAG_USER) {
+        entry |= PAGE_USER;
+    } else {
+        /* Kernel mappings are shared by every address space. */
+        entry |= PAGE_GLOBAL;
+    }
+    if (flags & VMM_FLAG_NX) {
+        entry |= nx_mask;
+    }
+    return entry;
+}
+
+/* Leaf flags of a 2 MiB entry as 4 KiB entry flags (the PAT bit moves). */
+static uint64_t huge_to_4k_flags(uint64_t huge) {
+    uint64_t flags = huge & ENTRY_FLAGS_MASK & ~PAGE_HUGE;
+    if (huge & PAGE_PAT_HUGE) {
+        flags |= PAGE_PAT_4K;
+    }
+    return flags;
+}
+
+static uint64_t pte_to_huge_flags(uint64_t pte) {
+    uint64_t flags = pte & ENTRY_FLAGS_MASK & ~ENTRY_STATUS_MASK & ~PAGE_PAT_4K;
+    if (pte & PAGE_PAT_4K) {
+        flags |= PAGE_PAT_HUGE;
+    }
+    return flags | PAGE_HUGE;
+}
+
+static bool same_mapping(uint64_t a, uint64_t b) {
+    return (a & ~ENTRY_STATUS_MASK) == (b & ~ENTRY_STATUS_MASK);
+}
+
+/* The bootstrap tables live in the kernel image and never go back to the PMM. */
+static bool is_boot_table(uint64_t phys_addr) {
+    return phys_addr >= (uint64_t)(uintptr_t)&_kernel_start &&
+           phys_addr < (uint64_t)(uintptr_t)&_kernel_end;
+}
+
+static uint64_t *alloc_table(uint64_t *out_phys) {
+    uint64_t frame = pmm_alloc_zeroed_frame();
+    if (frame == 0) {
+        return 0;
+    }
+
+    table_frames++;
+    *out_phys = frame;
+    return phys_to_virt(frame);
+}
+
+static void free_table(uint64_t phys_addr) {
+    if (is_boot_table(phys_addr)) {
+        return;
+    }
+    table_frames--;
+    release_frame(phys_addr);
+}
+
+static bool table_empty(const uint64_t *table) {
+    for (int i = 0; i < 512; i++) {
+        if (table[i] & PAGE_PRESENT) {
             return false;
         }
+    }
+    return true;
+}
+
+/* Child table behind a non-leaf entry, or null when absent or a leaf. */
+static uint64_t *next_table(uint64_t entry) {
+    if ((entry & PAGE_PRESENT) == 0 || (entry & PAGE_HUGE) != 0) {
+        return 0;
+    }
+    return phys_to_virt(entry & ENTRY_ADDR_MASK);
+}
+
+static uint64_t *ensure_table(uint64_t *parent, uint16_t index, uint64_t flags) {
+    uint64_t table_flags = PAGE_PRESENT | PAGE_WRITABLE;
+
+    if (flags & VMM_FLAG_USER) {
+        table_flags |= PAGE_USER;
+    }
+
+    if ((parent[index] & PAGE_PRESENT) == 0) {
+        uint64_t frame;
+        if (!alloc_table(&frame)) {
+            return 0;
+        }
+        parent[index] = frame | table_flags;
+    } else if (parent[index] & PAGE_HUGE) {
+        return 0;
+    }
+
+    parent[index] |= table_flags;
+    return phys_to_virt(parent[index] & ENTRY_ADDR_MASK);
+}
+
+static bool is_leaf(uint64_t entry) {
+    return (entry & (PAGE_PRESENT | PAGE_HUGE)) == (PAGE_PRESENT | PAGE_HUGE);
+}
+
+/*
+ * Replace the 1 GiB leaf at pdpt[index] by a page directory of 2 MiB leaves
+ * with the same mapping. Both leaf sizes keep PAT in bit 12.
+ */
+static uint64_t *split_1g(uint64_t *pdpt, uint16_t index, uint64_t virt_addr) {
+    uint64_t huge = pdpt[index];
+    uint64_t base = huge & ENTRY_1G_ADDR_MASK;
+    uint64_t flags = huge & ~ENTRY_1G_ADDR_MASK & ~ENTRY_STATUS_MASK;
+    uint64_t frame;
+    uint64_t *pd = alloc_table(&frame);
+
+    if (!pd) {
+        return 0;
+    }
+
+    for (uint64_t i = 0; i < 512; i++) {
+        pd[i] = (base + i * PAGE_SIZE_2M) | flags;
+    }
+    pdpt[index] = frame | PAGE_PRESENT | PAGE_WRITABLE | (huge & PAGE_USER);
+    flush_page(virt_addr);
+    return pd;
+}
+
+static uint64_t *walk_pd(uint64_t virt_addr, bool create, uint64_t flags) {
+    uint64_t *pdpt;
+    uint16_t pdpt_i = pdpt_index(virt_addr);
+
+    if (!create) {
+        pdpt = next_table(pml4_table[pml4_index(virt_addr)]);
+        return pdpt ? next_table(pdpt[pdpt_i]) : 0;
+    }
+
+    pdpt = ensure_table(pml4_table, pml4_index(virt_addr), flags);
+    if (!pdpt) {
+        return 0;
+    }
+    if (is_leaf(pdpt[pdpt_i]) && !split_1g(pdpt, pdpt_i, virt_addr)) {
+        return 0;
+    }
+    return ensure_table(pdpt, pdpt_i, flags);
+}
+
+/* Replace the 2 MiB leaf at pd[index] by a page table with the same mapping. */
+static uint64_t *split_2m(uint64_t *pd, uint16_t index, uint64_t virt_addr) {
+    uint64_t huge = pd[index];
+    uint64_t base = huge & ENTRY_HUGE_ADDR_MASK;
+    uint64_t flags = huge_to_4k_flags(huge);
+    uint64_t frame;
+    uint64_t *pt = alloc_table(&frame);
+
+    if (!pt) {
+        return 0;
+    }
+
+    for (uint64_t i = 0; i < 512; i++) {
+        pt[i] = (base + i * PAGE_SIZE_4K) | flags;
+    }
+    pd[index] = frame | PAGE_PRESENT | PAGE_WRITABLE | (huge & PAGE_USER);
+    flush_page(virt_addr);
+    return pt;
+}
+
+/* Fold a page table back into a 2 MiB leaf when it maps one contiguous, aligned block. */
+static void try_merge_2m(uint64_t *pd, uint16_t index, uint64_t virt_addr) {
+    uint64_t *pt = next_table(pd[index]);
+    uint64_t pt_phys = pd[index] & ENTRY_ADDR_MASK;
+    uint64_t first;
+    uint64_t base;
+
+    if (!pt) {
+        return;
+    }
+
+    first = pt[0];
+    base = first & ENTRY_ADDR_MASK;
+    if ((first & PAGE_PRESENT) == 0 || (base & (PAGE_SIZE_2M - 1)) != 0) {
+        return;
+    }
+
+    for (uint64_t i = 1; i < 512; i++) {
+        if (!same_mapping(pt[i], first + i * PAGE_SIZE_4K)) {
+            return;
+        }
+    }
+
+    pd[index] = base | pte_to_huge_flags(first);
+    flush_page(virt_addr & ~(PAGE_SIZE_2M - 1));
+    free_table(pt_phys);
+}
+
+/* Release the page table, page directory and PDPT covering virt_addr once empty. */
+static void reclaim_tables(uint64_t virt_addr) {
+    uint64_t *pml4e = &pml4_table[pml4_index(virt_addr)];
+    uint64_t *pdpt = next_table(*pml4e);
+    uint64_t *pd = pdpt ? next_table(pdpt[pdpt_index(virt_addr)]) : 0;
+    uint64_t *pt = pd ? next_table(pd[pd_index(virt_addr)]) : 0;
+    bool changed = false;
 
-        memset((void *)(uintptr_t)frame, 0, 4096);
-        parent[index] = frame | PAGE_PRESENT | PAGE_WRITABLE;
+    if (pt && table_empty(pt)) {
+        free_table(pd[pd_index(virt_addr)] & ENTRY_ADDR_MASK);
+        pd[pd_index(virt_addr)] = 0;
+        changed = true;
     }
+    if (pd && table_empty(pd)) {
+        free_table(pdpt[pdpt_index(virt_addr)] & ENTRY_ADDR_MASK);
+        pdpt[pdpt_index(virt_addr)] = 0;
+        changed = true;
+    }
+    if (pdpt && table_empty(pdpt)) {
+        free_table(*pml4e & ENTRY_ADDR_MASK);
+        *pml4e = 0;
+        changed = true;
+    }
+
+    if (changed) {
+        /* Drops paging-structure cache entries for the freed tables too. */
+        flush_page(virt_addr);
+    }
+}
+
+/* Map [phys, end) at its direct-map address with the largest pages that fit. */
+static bool direct_map_range(uint64_t *slots, uint64_t phys, uint64_t end) {
+    uint64_t leaf = PAGE_PRESENT | PAGE_WRITABLE | PAGE_GLOBAL | nx_mask;
+
+    phys &= ~(PAGE_SIZE_4K - 1);
+    while (phys < end) {
+        uint64_t virt = VMM_DIRECT_MAP_BASE + phys;
+        uint64_t *pdpt = ensure_table(slots, pml4_index(virt), 0);
+        uint64_t *pd;
+        uint64_t *pt;
+
+        if (!pdpt) {
+            return false;
+        }
+        /* Ranges may overlap; a leaf already in place covers this part. */
+        if (is_leaf(pdpt[pdpt_index(virt)])) {
+            phys = next_boundary(phys, PAGE_SIZE_1G);
+            continue;
+        }
+        if (has_1g_pages && (phys & (PAGE_SIZE_1G - 1)) == 0 && end - phys >= PAGE_SIZE_1G &&
+            (pdpt[pdpt_index(virt)] & PAGE_PRESENT) == 0) {
+            pdpt[pdpt_index(virt)] = phys | leaf | PAGE_HUGE;
+            phys += PAGE_SIZE_1G;
+            continue;
+        }
+
+        pd = ensure_table(pdpt, pdpt_index(virt), 0);
+        if (!pd) {
+            return false;
+        }
+        if (is_leaf(pd[pd_index(virt)])) {
+            phys = next_boundary(phys, PAGE_SIZE_2M);
+            continue;
+        }
+        if ((phys & (PAGE_SIZE_2M - 1)) == 0 && end - phys >= PAGE_SIZE_2M &&
+            (pd[pd_index(virt)] & PAGE_PRESENT) == 0) {
+            pd[pd_index(virt)] = phys | leaf | PAGE_HUGE;
+            phys += PAGE_SIZE_2M;
+            continue;
+        }
 
-    uint64_t child_phys = parent[index] & 0x000FFFFFFFFFF000ULL;
-    *out_child = phys_to_virt(child_phys);
+        pt = ensure_table(pd, pd_index(virt), 0);
+        if (!pt) {
+            return false;
+        }
+        pt[pt_index(virt)] = phys | leaf;
+        phys += PAGE_SIZE_4K;
+    }
     return true;
 }
 
-void vmm_init(void) {
-    /* Keep the bootstrap identity map and extend one extra 2 MiB chunk for tests. */
-    (void)vmm_map_2m(0x40000000ULL, 0x40000000ULL, VMM_FLAG_WRITABLE);
+/*
+ * Map RAM at VMM_DIRECT_MAP_BASE: the loader's usable and ACPI ranges, the
+ * legacy first MiB (VGA text, EBDA, BIOS tables, AP trampoline) and the
+ * boot info. Holes stay unmapped, so the framebuffer and the APIC and HPET
+ * windows never get a write-back alias next to their WC or UC mapping.
+ * boot.S points the direct map and the kernel image window at one page
+ * directory, so the map is built in fresh tables and only swapped in once
+ * complete: later splits of direct-map leaves never touch the image.
+ * Returns the end of the highest range, or 0 on failure.
+ */
+static uint64_t build_direct_map(uint32_t multiboot_info_addr) {
+    uint8_t *mb = (uint8_t *)phys_to_virt(multiboot_info_addr);
+    uint32_t mb_total_size = *(uint32_t *)mb;
+    struct multiboot_tag *tag = (struct multiboot_tag *)(mb + 8);
+    uint64_t slots_phys = pmm_alloc_zeroed_frame();
+    uint64_t *slots;
+    uint64_t limit = LEGACY_AREA_END;
+    bool ok = slots_phys != 0;
+
+    /* Stands in for the PML4 until the new slots are installed. */
+    slots = phys_to_virt(slots_phys);
+    ok = ok && direct_map_range(slots, 0, LEGACY_AREA_END) &&
+         direct_map_range(slots, multiboot_info_addr, (uint64_t)multiboot_info_addr + mb_total_size);
+
+    while (ok && (uint8_t *)tag < mb + mb_total_size && tag->type != MULTIBOOT_TAG_TYPE_END) {
+        if (tag->type == MULTIBOOT_TAG_TYPE_MMAP) {
+            struct multiboot_tag_mmap *mmap = (struct multiboot_tag_mmap *)tag;
+            uint8_t *entry_ptr = (uint8_t *)mmap + sizeof(struct multiboot_tag_mmap);
+            uint8_t *entry_end = (uint8_t *)tag + tag->size;
+
+            while (ok && entry_ptr < entry_end) {
+                struct multiboot_mmap_entry *entry = (struct multiboot_mmap_entry *)entry_ptr;
+                uint64_t base = (entry->addr + PAGE_SIZE_4K - 1) & ~(PAGE_SIZE_4K - 1);
+                uint64_t end = (entry->addr + entry->len) & ~(PAGE_SIZE_4K - 1);
+
+                if ((entry->type == MULTIBOOT_MEMORY_AVAILABLE ||
+                     entry->type == MULTIBOOT_MEMORY_ACPI_RECLAIMABLE ||
+                     entry->type == MULTIBOOT_MEMORY_NVS) &&
+                    end > base) {
+                    ok = direct_map_range(slots, base, end);
+                    if (end > limit) {
+                        limit = end;
+                    }
+                }
+                entry_ptr += mmap->entry_size;
+            }
+        }
+        tag = (struct multiboot_tag *)((uint8_t *)tag + ((tag->size + 7) & ~7U));
+    }
+
+    if (ok) {
+        for (uint16_t i = 0; i < 512; i++) {
+            if (slots[i] & PAGE_PRESENT) {
+                pml4_table[i] = slots[i];
+            }
+        }
+    }
+    if (slots_phys != 0) {
+        pmm_free_frame(slots_phys);
+    }
+    return ok ? limit : 0;
 }
 
-bool vmm_map_2m(uint64_t virt_addr, uint64_t phys_addr, uint64_t flags) {
+/* Paging features every CPU must enable before it touches kernel mappings. */
+static void enable_cpu_features(void) {
+    if (nx_mask) {
+        wrmsr(MSR_EFER, rdmsr(MSR_EFER) | EFER_NXE);
+    }
+    if (has_pat) {
+        /* Only unused entries change, so no cache flush is needed. */
+        wrmsr(MSR_PAT, PAT_LAYOUT);
+    }
+    /* PCIDE needs CR3[11:0] clear, which holds for the boot PML4. */
+    write_cr4(read_cr4() | CR4_PGE | (has_pcid ? CR4_PCIDE : 0));
+}
+
+void vmm_init(uint32_t multiboot_info_addr) {
+    uint32_t a;
+    uint32_t b;
+    uint32_t c;
+    uint32_t d;
+    uint64_t limit;
+
+    spin_init(&vmm_lock, "vmm");
+    spin_init(&shootdown_lock, "tlb_shootdown");
+    kernel_pml4_phys = read_cr3() & ENTRY_ADDR_MASK;
+    pml4_table = phys_to_virt(kernel_pml4_phys);
+
+    cpuid(0x80000000U, 0, &a, &b, &c, &d);
+    if (a >= 0x80000001U) {
+        cpuid(0x80000001U, 0, &a, &b, &c, &d);
+        if (d & (1U << 20)) {
+            nx_mask = PAGE_NX;
+        }
+        has_1g_pages = (d & (1U << 26)) != 0;
+    }
+
+    cpuid(1, 0, &a, &b, &c, &d);
+    has_pat = (d & (1U << 16)) != 0;
+    has_pcid = (c & (1U << 17)) != 0;
+
+    cpuid(0, 0, &a, &b, &c, &d);
+    if (a >= 7) {
+        cpuid(7, 0, &a, &b, &c, &d);
+        has_invpcid = (b & (1U << 10)) != 0;
+    }
+
+    enable_cpu_features();
+
+    limit = build_direct_map(multiboot_info_addr);
+    if (limit != 0) {
+        direct_map_limit = limit;
+    }
+
+    /* Everything runs in the higher half now; drop the boot identity slot. */
+    pml4_table[0] = 0;
+    write_cr3(read_cr3());
+}
+
+/* Move an application processor off the trampoline tables and match the boot CPU. */
+void vmm_init_cpu(void) {
+    write_cr3(kernel_pml4_phys);
+    enable_cpu_features();
+}
+
+uint64_t vmm_kernel_pml4(void) {
+    return kernel_pml4_phys;
+}
+
+static bool map_2m(uint64_t virt_addr, uint64_t phys_addr, uint64_t flags) {
     if ((virt_addr & 0x1FFFFFULL) != 0 || (phys_addr & 0x1FFFFFULL) != 0) {
         return false;
     }
 
-    uint16_t pml4_i = (uint16_t)((virt_addr >> 39) & 0x1FF);
-    uint16_t pdpt_i = (uint16_t)((virt_addr >> 30) & 0x1FF);
-    uint16_t pd_i = (uint16_t)((virt_addr >> 21) & 0x1FF);
+    uint64_t *pd = walk_pd(virt_addr, true, flags);
+    if (!pd) {
+        return false;
+    }
+
+    uint16_t pd_i = pd_index(virt_addr);
+    uint64_t old = pd[pd_i];
+
+    pd[pd_i] = (phys_addr & ENTRY_HUGE_ADDR_MASK) | entry_flags(flags, true) | PAGE_HUGE;
+    /* Not-present entries are never cached, so a fresh slot needs no flush. */
+    if ((old & PAGE_PRESENT) == 0) {
+        return true;
+    }
+    if (old & PAGE_HUGE) {
+        flush_page(virt_addr);
+        return true;
+    }
+
+    /* The old table may have left a 4 KiB entry cached for any page in the range. */
+    for (uint64_t page = 0; page < PAGE_SIZE_2M; page += PAGE_SIZE_4K) {
+        flush_page(virt_addr + page);
+    }
+    free_table(old & ENTRY_ADDR_MASK);
+    return true;
+}
 
-    uint64_t *pdpt = 0;
-    uint64_t *pd = 0;
+static bool map_4k(uint64_t virt_addr, uint64_t phys_addr, uint64_t flags) {
+    if ((virt_addr & 0xFFFULL) != 0 || (phys_addr & 0xFFFULL) != 0) {
+        return false;
+    }
 
-    if (!ensure_table(pml4_table, pml4_i, &pdpt)) {
+    uint64_t *pd = walk_pd(virt_addr, true, flags);
+    if (!pd) {
         return false;
     }
 
-    if (!ensure_table(pdpt, pdpt_i, &pd)) {
+    uint16_t pd_i = pd_index(virt_addr);
+    uint64_t *pt;
+
+    if ((pd[pd_i] & PAGE_PRESENT) != 0 && (pd[pd_i] & PAGE_HUGE) != 0) {
+        pt = split_2m(pd, pd_i, virt_addr);
+    } else {
+        pt = ensure_table(pd, pd_i, flags);
+    }
+    if (!pt) {
         return false;
     }
 
-    uint64_t entry_flags = PAGE_PRESENT | PAGE_HUGE;
-    if (flags & VMM_FLAG_WRITABLE) {
-        entry_flags |= PAGE_WRITABLE;
+    uint64_t *pte = &pt[pt_index(virt_addr)];
+    bool was_present = (*pte & PAGE_PRESENT) != 0;
+
+    *pte = (phys_addr & ENTRY_ADDR_MASK) | entry_flags(flags, false);
+    if (was_present) {
+        flush_page(virt_addr);
     }
-    if (flags & VMM_FLAG_USER) {
-        entry_flags |= PAGE_USER;
+    try_merge_2m(pd, pd_i, virt_addr);
+    return true;
+}
+
+static bool unmap_range(uint64_t virt_addr, uint64_t size) {
+    uint64_t va = virt_addr;
+    uint64_t end = virt_addr + size;
+
+    bool ok = true;
+
+    if ((virt_addr & 0xFFFULL) != 0 || (size & 0xFFFULL) != 0 || end < virt_addr) {
+        return false;
     }
-    if (flags & VMM_FLAG_NX) {
-        entry_flags |= PAGE_NX;
+
+    while (va < end) {
+        uint64_t *pdpt = next_table(pml4_table[pml4_index(va)]);
+        uint64_t *pd;
+        uint64_t *pt;
+        uint16_t pdpt_i;
+        uint16_t pd_i;
+        uint64_t chunk_end;
+
+        if (!pdpt) {
+            va = next_boundary(va, PAGE_SIZE_512G);
+            continue;
+        }
+        pdpt_i = pdpt_index(va);
+        if (is_leaf(pdpt[pdpt_i])) {
+            if ((va & (PAGE_SIZE_1G - 1)) == 0 && va + PAGE_SIZE_1G <= end) {
+                pdpt[pdpt_i] = 0;
+                flush_page(va);
+                reclaim_tables(va);
+                va += PAGE_SIZE_1G;
+                continue;
+            }
+            if (!split_1g(pdpt, pdpt_i, va)) {
+                ok = false;
+                break;
+            }
+        }
+        pd = next_table(pdpt[pdpt_i]);
+        if (!pd) {
+            va = next_boundary(va, PAGE_SIZE_1G);
+            continue;
+        }
+
+        pd_i = pd_index(va);
+        chunk_end = next_boundary(va, PAGE_SIZE_2M);
+        if (chunk_end > end) {
+            chunk_end = end;
+        }
+
+        if ((pd[pd_i] & PAGE_PRESENT) == 0) {
+            va = chunk_end;
+            continue;
+        }
+
+        if (pd[pd_i] & PAGE_HUGE) {
+            if ((va & (PAGE_SIZE_2M - 1)) == 0 && va + PAGE_SIZE_2M <= end) {
+                pd[pd_i] = 0;
+                flush_page(va);
+                reclaim_tables(va);
+                va += PAGE_SIZE_2M;
+                continue;
+            }
+            if (!split_2m(pd, pd_i, va)) {
+                ok = false;
+                break;
+            }
+        }
+
+        pt = next_table(pd[pd_i]);
+        for (uint64_t page = va; page < chunk_end; page += PAGE_SIZE_4K) {
+            if (pt[pt_index(page)] & PAGE_PRESENT) {
+                pt[pt_index(page)] = 0;
+                flush_page(page);
+            }
+        }
+        reclaim_tables(va);
+        va = chunk_end;
+    }
+    return ok;
+}
+
+static bool protect_range(uint64_t virt_addr, uint64_t size, uint64_t flags) {
+    uint64_t va = virt_addr;
+    uint64_t end = virt_addr + size;
+    uint64_t leaf = entry_flags(flags, false);
+    uint64_t leaf_huge = entry_flags(flags, true) | PAGE_HUGE;
+    bool ok = true;
+
+    if ((virt_addr & 0xFFFULL) != 0 || (size & 0xFFFULL) != 0 || end < virt_addr) {
+        return false;
+    }
+
+    /* Unmapped pages inside the range are skipped. */
+    while (va < end) {
+        uint64_t *pdpt = next_table(pml4_table[pml4_index(va)]);
+        uint64_t *pd;
+        uint64_t *pt;
+        uint16_t pdpt_i;
+        uint16_t pd_i;
+        uint64_t chunk_end;
+
+        if (!pdpt) {
+            va = next_boundary(va, PAGE_SIZE_512G);
+            continue;
+        }
+        pdpt_i = pdpt_index(va);
+        if (is_leaf(pdpt[pdpt_i])) {
+            uint64_t huge = (pdpt[pdpt_i] & ENTRY_1G_ADDR_MASK) | leaf_huge;
+            if (same_mapping(pdpt[pdpt_i], huge)) {
+                va = next_boundary(va, PAGE_SIZE_1G);
+                continue;
+            }
+            if ((va & (PAGE_SIZE_1G - 1)) == 0 && va + PAGE_SIZE_1G <= end) {
+                pdpt[pdpt_i] = huge;
+                flush_page(va);
+                va += PAGE_SIZE_1G;
+                continue;
+            }
+            if (!split_1g(pdpt, pdpt_i, va)) {
+                ok = false;
+                break;
+            }
+        }
+        pd = next_table(pdpt[pdpt_i]);
+        if (!pd) {
+            va = next_boundary(va, PAGE_SIZE_1G);
+            continue;
+        }
+
+        pd_i = pd_index(va);
+        chunk_end = next_boundary(va, PAGE_SIZE_2M);
+        if (chunk_end > end) {
+            chunk_end = end;
+        }
+
+        if ((pd[pd_i] & PAGE_PRESENT) == 0) {
+            va = chunk_end;
+            continue;
+        }
+
+        if (pd[pd_i] & PAGE_HUGE) {
+            uint64_t huge = (pd[pd_i] & ENTRY_HUGE_ADDR_MASK) | leaf_huge;
+            if (same_mapping(pd[pd_i], huge)) {
+                va = chunk_end;
+                continue;
+            }
+            if ((va & (PAGE_SIZE_2M - 1)) == 0 && va + PAGE_SIZE_2M <= end) {
+                pd[pd_i] = huge;
+                flush_page(va);
+                va += PAGE_SIZE_2M;
+                continue;
+            }
+            if (!split_2m(pd, pd_i, va)) {
+                ok = false;
+                break;
+            }
+        }
+
+        pt = next_table(pd[pd_i]);
+        for (uint64_t page = va; page < chunk_end; page += PAGE_SIZE_4K) {
+            uint64_t *pte = &pt[pt_index(page)];
+            uint64_t updated = (*pte & ENTRY_ADDR_MASK) | leaf;
+            if ((*pte & PAGE_PRESENT) != 0 && !same_mapping(*pte, updated)) {
+                *pte = updated;
+                flush_page(page);
+            }
+        }
+        try_merge_2m(pd, pd_i, va);
+        va = chunk_end;
     }
+    return ok;
+}
 
-    pd[pd_i] = (phys_addr & 0x000FFFFFFFE00000ULL) | entry_flags;
-    invlpg((void *)(uintptr_t)virt_addr);
+/*
+ * Public entry points that change the tables open a batch (interrupts off)
+ * and then take vmm_lock; the batch is flushed, locally and on the other
+ * CPUs, after the lock is dropped.
+ */
+bool vmm_map_2m(uint64_t virt_addr, uint64_t phys_addr, uint64_t flags) {
+    bool ok;
+
+    vmm_flush_begin();
+    spin_lock(&vmm_lock);
+    ok = map_2m(virt_addr, phys_addr, flags);
+    spin_unlock(&vmm_lock);
+    vmm_flush_end();
+    return ok;
+}
+
+bool vmm_map_4k(uint64_t virt_addr, uint64_t phys_addr, uint64_t flags) {
+    bool ok;
+
+    vmm_flush_begin();
+    spin_lock(&vmm_lock);
+    ok = map_4k(virt_addr, phys_addr, flags);
+    spin_unlock(&vmm_lock);
+    vmm_flush_end();
+    return ok;
+}
+
+bool vmm_unmap(uint64_t virt_addr, uint64_t size) {
+    bool ok;
+
+    vmm_flush_begin();
+    spin_lock(&vmm_lock);
+    ok = unmap_range(virt_addr, size);
+    spin_unlock(&vmm_lock);
+    vmm_flush_end();
+    return ok;
+}
+
+bool vmm_protect(uint64_t virt_addr, uint64_t size, uint64_t flags) {
+    bool ok;
+
+    vmm_flush_begin();
+    spin_lock(&vmm_lock);
+    ok = protect_range(virt_addr, size, flags);
+    spin_unlock(&vmm_lock);
+    vmm_flush_end();
+    return ok;
+}
+
+static bool virt_to_phys(uint64_t virt_addr, uint64_t *out_phys) {
+    uint64_t *pdpt = next_table(pml4_table[pml4_index(virt_addr)]);
+    uint64_t pdpte;
+    uint64_t *pd;
+    uint64_t pde;
+    uint64_t *pt;
+    uint64_t pte;
+
+    if (!pdpt) {
+        return false;
+    }
+    pdpte = pdpt[pdpt_index(virt_addr)];
+    if ((pdpte & PAGE_PRESENT) == 0) {
+        return false;
+    }
+    if (pdpte & PAGE_HUGE) {
+        *out_phys = (pdpte & ENTRY_ADDR_MASK & ~(PAGE_SIZE_1G - 1)) | (virt_addr & (PAGE_SIZE_1G - 1));
+        return true;
+    }
+
+    pd = next_table(pdpte);
+
+    pde = pd[pd_index(virt_addr)];
+    if ((pde & PAGE_PRESENT) == 0) {
+        return false;
+    }
+    if (pde & PAGE_HUGE) {
+        *out_phys = (pde & ENTRY_HUGE_ADDR_MASK) | (virt_addr & (PAGE_SIZE_2M - 1));
+        return true;
+    }
+
+    pt = next_table(pde);
+    pte = pt[pt_index(virt_addr)];
+    if ((pte & PAGE_PRESENT) == 0) {
+        return false;
+    }
+    *out_phys = (pte & ENTRY_ADDR_MASK) | (virt_addr & (PAGE_SIZE_4K - 1));
     return true;
 }
+
+bool vmm_virt_to_phys(uint64_t virt_addr, uint64_t *out_phys) {
+    uint64_t flags = spin_lock_irqsave(&vmm_lock);
+    bool found = virt_to_phys(virt_addr, out_phys);
+
+    spin_unlock_irqrestore(&vmm_lock, flags);
+    return found;
+}
+
+/* True when every page of [phys_addr, phys_addr + size) is in the direct map. */
+bool vmm_is_direct_mapped(uint64_t phys_addr, uint64_t size) {
+    uint64_t end = phys_addr + size;
+    uint64_t phys;
+
+    if (end < phys_addr || end > direct_map_limit) {
+        return false;
+    }
+    for (uint64_t page = phys_addr & ~(PAGE_SIZE_4K - 1); page < end; page += PAGE_SIZE_4K) {
+        if (!vmm_virt_to_phys(VMM_DIRECT_MAP_BASE + page, &phys)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Map a device range into the MMIO window; returns its virtual address or 0. */
+uint64_t vmm_map_mmio(uint64_t phys_addr, uint64_t size, uint64_t flags) {
+    uint64_t first = phys_addr & ~(PAGE_SIZE_4K - 1);
+    uint64_t end = (phys_addr + size + PAGE_SIZE_4K - 1) & ~(PAGE_SIZE_4K - 1);
+    uint64_t base;
+    bool ok = true;
+
+    if (size == 0 || end <= first) {
+        return 0;
+    }
+
+    vmm_flush_begin();
+    spin_lock(&vmm_lock);
+    /* Same offset within 2 MiB as the physical range, so 2 MiB pages line up. */
+    base = mmio_next + (first & (PAGE_SIZE_2M - 1));
+    for (uint64_t phys = first; phys < end && ok;) {
+        uint64_t virt = base + (phys - first);
+        if ((phys & (PAGE_SIZE_2M - 1)) == 0 && phys + PAGE_SIZE_2M <= end) {
+            ok = map_2m(virt, phys, flags);
+            phys += PAGE_SIZE_2M;
+        } else {
+            ok = map_4k(virt, phys, flags);
+            phys += PAGE_SIZE_4K;
+        }
+    }
+    if (ok) {
+        mmio_next = (base + (end - first) + PAGE_SIZE_2M - 1) & ~(PAGE_SIZE_2M - 1);
+    }
+    spin_unlock(&vmm_lock);
+    vmm_flush_end();
+    return ok ? base + (phys_addr - first) : 0;
+}
+
+uint64_t vmm_table_kib(void) {
+    return table_frames * 4;
+}
+
+static vmm_region_t *find_region(uint64_t virt_addr) {
+    for (size_t i = 0; i < VMM_MAX_REGIONS; i++) {
+        vmm_region_t *region = &regions[i];
+        if (region->used && virt_addr >= region->base && virt_addr - region->base < region->size) {
+            return region;
+        }
+    }
+    return 0;
+}
+
+/* First fit in the vmalloc window, keeping a guard page after each region. */
+static uint64_t find_region_gap(uint64_t size) {
+    uint64_t candidate = VMM_VMALLOC_BASE;
+    bool moved = true;
+
+    while (moved) {
+        moved = false;
+        for (size_t i = 0; i < VMM_MAX_REGIONS; i++) {
+            const vmm_region_t *region = &regions[i];
+            uint64_t region_end;
+            if (!region->used) {
+                continue;
+            }
+            region_end = region->base + region->size + REGION_GUARD;
+            if (candidate < region_end && region->base < candidate + size + REGION_GUARD) {
+                candidate = region_end;
+                moved = true;
+            }
+        }
+    }
+
+    if (candidate + size > VMM_VMALLOC_BASE + VMM_VMALLOC_SIZE) {
+        return 0;
+    }
+    return candidate;
+}
+
+/*
+ * Reserve a lazily backed region; nothing is mapped until it is touched.
+ * flags are the VMM_FLAG_* bits every page of the region is mapped with.
+ */
+uint64_t vmm_region_create(const char *name, uint64_t size, uint64_t flags) {
+    vmm_region_t *slot = 0;
+    uint64_t base = 0;
+    uint64_t irq_flags;
+
+    size = (size + PAGE_SIZE_4K - 1) & ~(PAGE_SIZE_4K - 1);
+    if (size == 0 || size > VMM_VMALLOC_SIZE) {
+        return 0;
+    }
+
+    irq_flags = spin_lock_irqsave(&vmm_lock);
+    for (size_t i = 0; i < VMM_MAX_REGIONS; i++) {
+        if (!regions[i].used) {
+            slot = &regions[i];
+            break;
+        }
+    }
+    if (slot) {
+        base = find_region_gap(size);
+    }
+    if (base == 0) {
+        spin_unlock_irqrestore(&vmm_lock, irq_flags);
+        return 0;
+    }
+
+    slot->name = name;
+    slot->base = base;
+    slot->size = size;
+    slot->flags = flags;
+    slot->resident_pages = 0;
+    slot->minor_faults = 0;
+    slot->used = true;
+    spin_unlock_irqrestore(&vmm_lock, irq_flags);
+    return base;
+}
+
+/* Unmap a region and return every page it faulted in to the PMM. */
+bool vmm_region_destroy(uint64_t base) {
+    vmm_region_t *region;
+    bool ok = true;
+
+    vmm_flush_begin();
+    spin_lock(&vmm_lock);
+    region = find_region(base);
+    if (!region || region->base != base) {
+        ok = false;
+        region = 0;
+    }
+    for (uint64_t va = base; region && va < base + region->size && region->resident_pages != 0;
+         va += PAGE_SIZE_4K) {
+        uint64_t phys;
+        if (!virt_to_phys(va, &phys)) {
+            continue;
+        }
+        if (!unmap_range(va, PAGE_SIZE_4K)) {
+            ok = false;
+            break;
+        }
+        release_frame(phys);
+        region->resident_pages--;
+    }
+    if (ok) {
+        region->used = false;
+    }
+    spin_unlock(&vmm_lock);
+    vmm_flush_end();
+    return ok;
+}
+
+bool vmm_region_info(size_t index, vmm_region_info_t *out) {
+    uint64_t flags = spin_lock_irqsave(&vmm_lock);
+    bool found = false;
+
+    for (size_t i = 0; i < VMM_MAX_REGIONS; i++) {
+        const vmm_region_t *region = &regions[i];
+        if (!region->used) {
+            continue;
+        }
+        if (index-- != 0) {
+            continue;
+        }
+        out->name = region->name;
+        out->base = region->base;
+        out->size = region->size;
+        out->resident_kib = region->resident_pages * 4;
+        out->minor_faults = region->minor_faults;
+        found = true;
+        break;
+    }
+    spin_unlock_irqrestore(&vmm_lock, flags);
+    return found;
+}
+
+/*
+ * Called from the #PF handler. Resolves a not-present fault inside a lazy
+ * region by mapping a zeroed frame; anything else is left to the caller.
+ */
+bool vmm_handle_fault(uint64_t fault_addr, uint64_t error_code) {
+    uint64_t page = fault_addr & ~(PAGE_SIZE_4K - 1);
+    vmm_region_t *region;
+    uint64_t phys;
+    bool ok = false;
+
+    /*
+     * Only vmalloc regions fault in lazily. Anything else goes straight to
+     * the panic: a stray #PF taken while vmm_lock or a batch is held must
+     * not spin on them.
+     */
+    if ((error_code & PF_PRESENT) != 0 || fault_addr < VMM_VMALLOC_BASE ||
+        fault_addr - VMM_VMALLOC_BASE >= VMM_VMALLOC_SIZE) {
+        return false;
+    }
+
+    vmm_flush_begin();
+    spin_lock(&vmm_lock);
+    region = find_region(fault_addr);
+    if (!region ||
+        ((error_code & PF_WRITE) != 0 && (region->flags & VMM_FLAG_WRITABLE) == 0) ||
+        ((error_code & PF_USER) != 0 && (region->flags & VMM_FLAG_USER) == 0) ||
+        ((error_code & PF_INSTR) != 0 && (region->flags & VMM_FLAG_NX) != 0)) {
+        ok = false;
+    } else if (virt_to_phys(page, &phys)) {
+        /* Another CPU faulted the same page in first. */
+        ok = true;
+    } else {
+        phys = pmm_alloc_zeroed_frame();
+        if (phys != 0 && map_4k(page, phys, region->flags)) {
+            region->resident_pages++;
+            region->minor_faults++;
+            ok = true;
+        } else if (phys != 0) {
+            pmm_free_frame(phys);
+        }
+    }
+    spin_unlock(&vmm_lock);
+    vmm_flush_end();
+    return ok;
+}
+
+/*
+ * Defer TLB invalidation until the matching vmm_flush_end(). Batches nest
+ * and belong to the CPU that opened them; interrupts stay off until the
+ * outermost end, which issues one invlpg per queued page, or a single full
+ * flush once more than TLB_FLUSH_CEILING pages were touched, here and on
+ * every other online CPU. Must not be called with vmm_lock held.
+ */
+void vmm_flush_begin(void) {
+    uint64_t flags = irq_save();
+    flush_batch_t *batch = this_batch();
+
+    if (batch->depth++ == 0) {
+        batch->irq_flags = flags;
+    }
+}
+
+void vmm_flush_end(void) {
+    flush_batch_t *batch = this_batch();
+
+    if (batch->depth == 0 || --batch->depth != 0) {
+        return;
+    }
+
+    if (batch->count != 0 || batch->overflow) {
+        flush_pages_now(batch, batch->pending, batch->count, batch->overflow);
+        shootdown_others(batch);
+        batch->stats.batches++;
+    }
+    batch->count = 0;
+    batch->overflow = false;
+
+    /* No CPU can reach these frames through a stale entry any more. */
+    while (batch->deferred_count != 0) {
+        uint64_t phys = batch->deferred_head;
+        batch->deferred_head = *phys_to_virt(phys);
+        batch->deferred_count--;
+        pmm_free_frame(phys);
+    }
+    irq_restore(batch->irq_flags);
+}
+
+void vmm_tlb_stats(vmm_tlb_stats_t *out) {
+    memset(out, 0, sizeof(*out));
+    for (unsigned int cpu = 0; cpu < SMP_MAX_CPUS; cpu++) {
+        const vmm_tlb_stats_t *stats = &batches[cpu].stats;
+
+        out->page_flushes += stats->page_flushes;
+        out->full_flushes += stats->full_flushes;
+        out->batches += stats->batches;
+        out->deferred += stats->deferred;
+        out->shootdowns += stats->shootdowns;
+    }
+    out->pcid = has_pcid;
+    out->invpcid = has_invpcid;
+}
@@ -0,0 +1,52 @@
+#include <kernel/waitqueue.h>
+
+void wait_queue_init(wait_queue_t *wq, const char *name) {
+    spin_init(&wq->lock, name);
+    wq->head = 0;
+    wq->sleeps = 0;
+    wq->wakeups = 0;
+}
+
+void wait_queue_add(wait_queue_t *wq, wait_entry_t *entry) {
+    uint64_t flags = spin_lock_irqsave(&wq->lock);
+
+    entry->thread = sched_current();
+    entry->next = wq->head;
+    if (entry->next) {
+        entry->next->pprev = &entry->next;
+    }
+    entry->pprev = &wq->head;
+    wq->head = entry;
+    wq->sleeps++;
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+void wait_queue_remove(wait_queue_t *wq, wait_entry_t *entry) {
+    uint64_t flags = spin_lock_irqsave(&wq->lock);
+
+    if (entry->pprev) {
+        *entry->pprev = entry->next;
+        if (entry->next) {
+            entry->next->pprev = entry->pprev;
+        }
+        entry->pprev = 0;
+    }
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+/*
+ * Entries stay queued until their sleeper removes them, so a thread woken
+ * twice before it runs is simply already ready the second time.
+ */
+size_t wake_up_all(wait_queue_t *wq) {
+    uint64_t flags = spin_lock_irqsave(&wq->lock);
+    size_t woken = 0;
+
+    for (wait_entry_t *entry = wq->head; entry; entry = entry->next) {
+        sched_wake(entry->thread);
+        woken++;
+    }
+    wq->wakeups += woken;
+    spin_unlock_irqrestore(&wq->lock, flags);
+    return woken;
+}
@@ -0,0 +1,80 @@
+#include <kernel/ring.h>
+#include <kernel/string.h>
+
+void ring_init(ring_t *ring, void *data, size_t elem_size, unsigned int order) {
+    ring->head = 0;
+    ring->tail = 0;
+    ring->mask = (1U << order) - 1U;
+    ring->elem_size = (uint32_t)elem_size;
+    ring->data = data;
+}
+
+/* Copy `count` elements between `buf` and the ring at `index`, wrapping at most once. */
+static void copy_in(ring_t *ring, uint32_t index, const void *buf, size_t count) {
+    size_t offset = index & ring->mask;
+    size_t first = ring->mask + 1U - offset;
+
+    if (first > count) {
+        first = count;
+    }
+    memcpy(ring->data + offset * ring->elem_size, buf, first * ring->elem_size);
+    if (count > first) {
+        memcpy(ring->data, (const uint8_t *)buf + first * ring->elem_size, (count - first) * ring->elem_size);
+    }
+}
+
+static void copy_out(const ring_t *ring, uint32_t index, void *buf, size_t count) {
+    size_t offset = index & ring->mask;
+    size_t first = ring->mask + 1U - offset;
+
+    if (first > count) {
+        first = count;
+    }
+    memcpy(buf, ring->data + offset * ring->elem_size, first * ring->elem_size);
+    if (count > first) {
+        memcpy((uint8_t *)buf + first * ring->elem_size, ring->data, (count - first) * ring->elem_size);
+    }
+}
+
+/* Producer side. Pushes as many as fit and returns that number. */
+size_t ring_push_n(ring_t *ring, const void *src, size_t count) {
+    uint32_t head = ring->head;
+    size_t space = ring->mask + 1U - (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE));
+
+    if (count > space) {
+        count = space;
+    }
+    if (count == 0) {
+        return 0;
+    }
+    copy_in(ring, head, src, count);
+    __atomic_store_n(&ring->head, head + (uint32_t)count, __ATOMIC_RELEASE);
+    return count;
+}
+
+/* Consumer side. Pops up to `count` and returns how many there were. */
+size_t ring_pop_n(ring_t *ring, void *dst, size_t count) {
+    uint32_t tail = ring->tail;
+    size_t avail = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - tail;
+
+    if (count > avail) {
+        count = avail;
+    }
+    if (count == 0) {
+        return 0;
+    }
+    copy_out(ring, tail, dst, count);
+    __atomic_store_n(&ring->tail, tail + (uint32_t)count, __ATOMIC_RELEASE);
+    return count;
+}
+
+/* Tail first: it never passes head, so a racing reader cannot see a negative count. */
+size_t ring_count(const ring_t *ring) {
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+
+    return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - tail;
+}
+
+size_t ring_space(const ring_t *ring) {
+    return ring->mask + 1U - ring_count(ring);
+}
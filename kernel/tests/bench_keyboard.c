@@ -0,0 +1,150 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <kernel/io.h>
+#include <kernel/irq.h>
+#include <kernel/keyboard.h>
+#include <kernel/softirq.h>
+
+#define PASSES 20000
+#define HIST_BUCKETS 32
+
+/*
+ * Cycles the keyboard IRQ spends with interrupts off, minus the port read:
+ * "inline decode" is the top half followed by the decode it used to run in
+ * place, "top half" is what keyboard_on_irq() does now.
+ */
+
+static softirq_fn g_keyboard_softirq;
+
+bool softirq_register(softirq_nr_t nr, const char *name, softirq_fn fn) {
+    (void)nr;
+    (void)name;
+    g_keyboard_softirq = fn;
+    return true;
+}
+
+void softirq_raise(softirq_nr_t nr) {
+    (void)nr;
+}
+
+bool irq_register(uint8_t line, irq_handler_t handler, void *ctx) {
+    (void)line;
+    (void)handler;
+    (void)ctx;
+    return true;
+}
+
+void wait_queue_init(wait_queue_t *wq, const char *name) {
+    (void)wq;
+    (void)name;
+}
+
+size_t wake_up_all(wait_queue_t *wq) {
+    (void)wq;
+    return 0;
+}
+
+/* "The Quick brown fox" typed with a shifted capital: make and break codes. */
+static const uint8_t g_typing[] = {
+    0x14, 0x94, 0x23, 0xA3, 0x12, 0x92, 0x39, 0xB9,
+    0x2A, 0x10, 0x90, 0xAA, 0x16, 0x96, 0x17, 0x97, 0x2E, 0xAE, 0x25, 0xA5, 0x39, 0xB9,
+    0x30, 0xB0, 0x13, 0x93, 0x18, 0x98, 0x11, 0x91, 0x31, 0xB1, 0x39, 0xB9,
+    0x21, 0xA1, 0x18, 0x98, 0x2D, 0xAD, 0xE0, 0x48, 0xE0, 0xC8, 0x1C, 0x9C,
+};
+
+typedef struct {
+    uint64_t hist[HIST_BUCKETS];
+    uint64_t total;
+    uint64_t max;
+    uint64_t count;
+} cycle_stats_t;
+
+static void record(cycle_stats_t *stats, uint64_t cycles) {
+    unsigned int bucket = (cycles == 0) ? 0 : (unsigned int)(63 - __builtin_clzll(cycles));
+
+    if (bucket >= HIST_BUCKETS) {
+        bucket = HIST_BUCKETS - 1;
+    }
+    stats->hist[bucket]++;
+    stats->total += cycles;
+    stats->count++;
+    if (cycles > stats->max) {
+        stats->max = cycles;
+    }
+}
+
+/* Upper bound of the log2 bucket holding the permille-th sample. */
+static uint64_t percentile(const cycle_stats_t *stats, unsigned int permille) {
+    uint64_t target = (stats->count * permille + 999) / 1000;
+    uint64_t seen = 0;
+
+    for (unsigned int b = 0; b < HIST_BUCKETS; b++) {
+        seen += stats->hist[b];
+        if (seen >= target && seen != 0) {
+            return (2ULL << b) - 1;
+        }
+    }
+    return stats->max;
+}
+
+static void drain_output(void) {
+    key_event_t event;
+    char buf[64];
+
+    while (keyboard_read(buf, sizeof(buf)) != 0) {
+    }
+    while (keyboard_pop_event(&event)) {
+    }
+}
+
+static void bench(cycle_stats_t *stats, bool inline_decode) {
+    keyboard_init();
+    for (int pass = 0; pass < PASSES; pass++) {
+        for (size_t i = 0; i < sizeof(g_typing); i++) {
+            uint64_t start = rdtsc();
+
+            keyboard_test_inject_scancode(g_typing[i]);
+            if (inline_decode) {
+                g_keyboard_softirq();
+            }
+            record(stats, rdtsc() - start);
+            if (!inline_decode) {
+                g_keyboard_softirq();
+            }
+        }
+        drain_output();
+    }
+}
+
+static void print_row(const char *name, const cycle_stats_t *stats) {
+    printf("%-14s %8.1f %8llu %8llu %8llu\n", name, (double)stats->total / (double)stats->count,
+           (unsigned long long)percentile(stats, 500), (unsigned long long)percentile(stats, 990),
+           (unsigned long long)stats->max);
+}
+
+int main(void) {
+    static cycle_stats_t before;
+    static cycle_stats_t after;
+
+    bench(&before, true);
+    bench(&after, false);
+
+    printf("keyboard bench: %d x %zu scancodes, TSC cycles per IRQ without the port read\n", PASSES,
+           sizeof(g_typing));
+    printf("%-14s %8s %8s %8s %8s\n", "path", "avg", "p50<=", "p99<=", "max");
+    print_row("inline decode", &before);
+    print_row("top half", &after);
+
+    printf("%-14s %14s %14s\n", "cycles", "inline decode", "top half");
+    for (unsigned int b = 0; b < HIST_BUCKETS; b++) {
+        if (before.hist[b] == 0 && after.hist[b] == 0) {
+            continue;
+        }
+        printf("<%-13llu %14llu %14llu\n", (unsigned long long)(2ULL << b),
+               (unsigned long long)before.hist[b], (unsigned long long)after.hist[b]);
+    }
+    return 0;
+}
@@ -0,0 +1,188 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <kernel/pmm.h>
+#include <kernel/vmm.h>
+
+#define FRAME_SIZE 4096ULL
+#define MAP_BYTES (1024ULL * 1024ULL * 1024ULL)
+#define MAP_FRAMES (MAP_BYTES / FRAME_SIZE)
+#define BATCH 4096
+#define ROUNDS 8
+
+#define ARENA_BYTES (4ULL * 1024ULL * 1024ULL)
+
+/* Linker symbols for pmm.c; host addresses fall outside the bench map. */
+uint8_t _kernel_start;
+uint8_t _kernel_end;
+
+/* Host memory standing in for the low physical window the PMM carves. */
+static uint8_t g_arena[ARENA_BYTES];
+
+void *vmm_phys_to_virt(uint64_t phys_addr) {
+    return g_arena + phys_addr;
+}
+
+uint64_t vmm_direct_map_limit(void) {
+    return ARENA_BYTES;
+}
+
+/* Host runs are single-threaded: always the boot CPU. */
+unsigned int smp_cpu_id(void) {
+    return 0;
+}
+
+/* Reference copy of the original byte bitmap and bit-by-bit first-fit scan. */
+static uint8_t legacy_bitmap[MAP_FRAMES / 8];
+
+static int legacy_test(uint64_t frame) {
+    return (legacy_bitmap[frame / 8] & (1U << (frame % 8))) != 0;
+}
+
+static void legacy_set(uint64_t frame) {
+    legacy_bitmap[frame / 8] |= (uint8_t)(1U << (frame % 8));
+}
+
+static void legacy_clear(uint64_t frame) {
+    legacy_bitmap[frame / 8] &= (uint8_t)~(1U << (frame % 8));
+}
+
+static uint64_t legacy_alloc_frame(void) {
+    for (uint64_t frame = 0; frame < MAP_FRAMES; frame++) {
+        if (!legacy_test(frame)) {
+            legacy_set(frame);
+            return frame * FRAME_SIZE;
+        }
+    }
+    return 0;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t xorshift_state = 0x9E3779B97F4A7C15ULL;
+
+static uint64_t xorshift(void) {
+    xorshift_state ^= xorshift_state << 13;
+    xorshift_state ^= xorshift_state >> 7;
+    xorshift_state ^= xorshift_state << 17;
+    return xorshift_state;
+}
+
+/*
+ * Build the same scattered occupancy pattern in both allocators: every frame
+ * is allocated, then a random subset is released until the target fraction
+ * of the map remains in use.
+ */
+static void setup_occupancy(unsigned int percent, uint64_t *scratch) {
+    pmm_region_t region = { 0, MAP_BYTES };
+    uint64_t usable;
+    uint64_t keep = (MAP_FRAMES * percent) / 100;
+    uint64_t n = 0;
+    uint64_t frame;
+
+    pmm_init_regions(&region, 1);
+    usable = pmm_free_kib() / 4;
+    memset(legacy_bitmap, 0xFF, sizeof(legacy_bitmap));
+
+    while ((frame = pmm_alloc_frame()) != 0) {
+        scratch[n++] = frame;
+    }
+
+    for (uint64_t i = n; i > 1; i--) {
+        uint64_t j = xorshift() % i;
+        uint64_t tmp = scratch[i - 1];
+        scratch[i - 1] = scratch[j];
+        scratch[j] = tmp;
+    }
+
+    /* Reserved frames (low 1 MiB, frame database) count as occupied. */
+    if (keep < MAP_FRAMES - usable) {
+        keep = MAP_FRAMES - usable;
+    }
+    for (uint64_t i = 0; i < usable - (keep - (MAP_FRAMES - usable)); i++) {
+        pmm_free_frame(scratch[i]);
+        legacy_clear(scratch[i] / FRAME_SIZE);
+    }
+}
+
+/*
+ * The summary-bitmap search alone: pmm_alloc_frame_low() goes straight to
+ * the zones, and each round's frees are drained back into them.
+ */
+static double bench_bitmap(uint64_t *batch) {
+    uint64_t start = now_ns();
+    for (int r = 0; r < ROUNDS; r++) {
+        for (int i = 0; i < BATCH; i++) {
+            batch[i] = pmm_alloc_frame_low(UINT64_MAX);
+        }
+        for (int i = 0; i < BATCH; i++) {
+            pmm_free_frame(batch[i]);
+        }
+        pmm_cache_drain();
+    }
+    return (double)(now_ns() - start) / (double)(ROUNDS * BATCH);
+}
+
+/* pmm_alloc_frame() as callers see it: per-CPU magazine over the buddy zones. */
+static double bench_magazine(uint64_t *batch) {
+    uint64_t start = now_ns();
+    for (int r = 0; r < ROUNDS; r++) {
+        for (int i = 0; i < BATCH; i++) {
+            batch[i] = pmm_alloc_frame();
+        }
+        for (int i = 0; i < BATCH; i++) {
+            pmm_free_frame(batch[i]);
+        }
+    }
+    return (double)(now_ns() - start) / (double)(ROUNDS * BATCH);
+}
+
+static double bench_legacy(uint64_t *batch) {
+    uint64_t start = now_ns();
+    for (int r = 0; r < ROUNDS; r++) {
+        for (int i = 0; i < BATCH; i++) {
+            batch[i] = legacy_alloc_frame();
+        }
+        for (int i = 0; i < BATCH; i++) {
+            legacy_clear(batch[i] / FRAME_SIZE);
+        }
+    }
+    return (double)(now_ns() - start) / (double)(ROUNDS * BATCH);
+}
+
+int main(void) {
+    static const unsigned int occupancy[] = { 10, 50, 95 };
+    uint64_t *scratch = malloc(sizeof(uint64_t) * MAP_FRAMES);
+    uint64_t batch[BATCH];
+
+    if (!scratch) {
+        return 1;
+    }
+
+    printf("pmm bench: 1 GiB map, %d x %d alloc+free pairs per run\n", ROUNDS, BATCH);
+    printf("%-10s %16s %16s %10s %16s\n", "occupancy", "linear ns/op", "bitmap ns/op", "speedup",
+           "magazine ns/op");
+    for (size_t i = 0; i < sizeof(occupancy) / sizeof(occupancy[0]); i++) {
+        double legacy;
+        double bitmap;
+        double magazine;
+
+        setup_occupancy(occupancy[i], scratch);
+        legacy = bench_legacy(batch);
+        bitmap = bench_bitmap(batch);
+        magazine = bench_magazine(batch);
+        printf("%9u%% %16.1f %16.1f %9.1fx %16.1f\n", occupancy[i], legacy, bitmap, legacy / bitmap,
+               magazine);
+    }
+
+    free(scratch);
+    return 0;
+}
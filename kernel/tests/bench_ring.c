@@ -0,0 +1,130 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <kernel/ring.h>
+
+#define QUEUE_ORDER 11
+#define QUEUE_SIZE (1U << QUEUE_ORDER)
+#define TOTAL_BYTES (256ULL * 1024ULL * 1024ULL)
+
+RING_DEFINE(bench_ring, uint8_t, QUEUE_ORDER)
+
+static bench_ring_t g_ring;
+
+/* Reference copy of the hand-rolled queues: `%` per byte, one byte per call. */
+static volatile uint8_t legacy_queue[QUEUE_SIZE];
+static volatile unsigned int legacy_head = 0;
+static volatile unsigned int legacy_tail = 0;
+
+static size_t legacy_write(const uint8_t *buf, size_t len) {
+    size_t written = 0;
+
+    while (written < len) {
+        unsigned int next = (legacy_head + 1) % QUEUE_SIZE;
+        if (next == legacy_tail) {
+            break;
+        }
+        legacy_queue[legacy_head] = buf[written++];
+        legacy_head = next;
+    }
+    return written;
+}
+
+static size_t legacy_read(uint8_t *buf, size_t len) {
+    size_t read = 0;
+
+    while (read < len && legacy_tail != legacy_head) {
+        buf[read++] = legacy_queue[legacy_tail];
+        legacy_tail = (legacy_tail + 1) % QUEUE_SIZE;
+    }
+    return read;
+}
+
+static size_t ring_write_single(const uint8_t *buf, size_t len) {
+    size_t written = 0;
+
+    while (written < len && bench_ring_push(&g_ring, buf[written])) {
+        written++;
+    }
+    return written;
+}
+
+static size_t ring_read_single(uint8_t *buf, size_t len) {
+    size_t read = 0;
+
+    while (read < len && bench_ring_pop(&g_ring, &buf[read])) {
+        read++;
+    }
+    return read;
+}
+
+static size_t ring_write_bulk(const uint8_t *buf, size_t len) {
+    return bench_ring_push_n(&g_ring, buf, len);
+}
+
+static size_t ring_read_bulk(uint8_t *buf, size_t len) {
+    return bench_ring_pop_n(&g_ring, buf, len);
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * Move TOTAL_BYTES through the queue in `chunk`-byte writes and reads, the
+ * pattern of a line flush into the PTY followed by the shell's drain. The
+ * read chunk is odd so the indices keep landing on the wrap point.
+ */
+static double bench_mib_per_s(size_t (*write_fn)(const uint8_t *, size_t),
+                              size_t (*read_fn)(uint8_t *, size_t), size_t chunk) {
+    static uint8_t in[QUEUE_SIZE];
+    static uint8_t out[QUEUE_SIZE];
+    uint64_t moved = 0;
+    uint64_t checksum = 0;
+    uint64_t start;
+    double seconds;
+
+    for (size_t i = 0; i < sizeof(in); i++) {
+        in[i] = (uint8_t)(i * 31U);
+    }
+
+    start = now_ns();
+    while (moved < TOTAL_BYTES) {
+        size_t got;
+
+        write_fn(in, chunk);
+        got = read_fn(out, chunk - 1);
+        moved += got;
+        checksum += out[got / 2];
+        moved += read_fn(out, 1);
+    }
+    seconds = (double)(now_ns() - start) / 1e9;
+    if (checksum == 1) {
+        printf("(checksum %llu)\n", (unsigned long long)checksum);
+    }
+    return (double)moved / (1024.0 * 1024.0) / seconds;
+}
+
+int main(void) {
+    static const size_t chunks[] = { 1, 16, 128, 1024 };
+
+    printf("ring bench: %llu MiB through a %u-byte SPSC queue\n",
+           (unsigned long long)(TOTAL_BYTES >> 20), QUEUE_SIZE);
+    printf("%-8s %14s %14s %14s %9s\n", "chunk", "legacy MiB/s", "push MiB/s", "push_n MiB/s", "speedup");
+    for (size_t i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++) {
+        double legacy;
+        double single;
+        double bulk;
+
+        bench_ring_init(&g_ring);
+        legacy = bench_mib_per_s(legacy_write, legacy_read, chunks[i]);
+        single = bench_mib_per_s(ring_write_single, ring_read_single, chunks[i]);
+        bulk = bench_mib_per_s(ring_write_bulk, ring_read_bulk, chunks[i]);
+        printf("%-8zu %14.1f %14.1f %14.1f %8.1fx\n", chunks[i], legacy, single, bulk, bulk / legacy);
+    }
+    return 0;
+}
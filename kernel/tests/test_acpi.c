@@ -0,0 +1,166 @@
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <kernel/acpi.h>
+#include <kernel/multiboot2.h>
+#include <kernel/vmm.h>
+
+#define ARENA_BYTES (2U * 1024U * 1024U)
+#define MB_INFO_PHYS 0x10000U
+#define XSDT_PHYS 0x20000U
+#define MADT_PHYS 0x21000U
+#define FACP_PHYS 0x22000U
+
+/* Host memory standing in for low physical memory. */
+static uint8_t *g_arena;
+
+void *vmm_phys_to_virt(uint64_t phys_addr) {
+    assert(phys_addr < ARENA_BYTES);
+    return g_arena + phys_addr;
+}
+
+bool vmm_is_direct_mapped(uint64_t phys_addr, uint64_t size) {
+    return phys_addr + size <= ARENA_BYTES;
+}
+
+uint64_t vmm_map_mmio(uint64_t phys_addr, uint64_t size, uint64_t flags) {
+    (void)phys_addr;
+    (void)size;
+    (void)flags;
+    return 0;
+}
+
+static void put32(uint8_t *p, uint32_t v) {
+    memcpy(p, &v, 4);
+}
+
+static void put64(uint8_t *p, uint64_t v) {
+    memcpy(p, &v, 8);
+}
+
+static void fix_checksum(uint8_t *data, size_t size, size_t checksum_offset) {
+    uint8_t sum = 0;
+    data[checksum_offset] = 0;
+    for (size_t i = 0; i < size; i++) {
+        sum = (uint8_t)(sum + data[i]);
+    }
+    data[checksum_offset] = (uint8_t)(0 - sum);
+}
+
+static void sdt_header(uint8_t *table, const char *signature, uint32_t length) {
+    memcpy(table, signature, 4);
+    put32(table + 4, length);
+    table[8] = 1;
+    memcpy(table + 10, "WALUOS", 6);
+}
+
+static uint8_t *madt_entry(uint8_t *p, uint8_t type, uint8_t length) {
+    p[0] = type;
+    p[1] = length;
+    return p + length;
+}
+
+/* Multiboot info with an ACPI_NEW tag, an XSDT listing FACP and APIC, and the MADT. */
+static void build_tables(void) {
+    uint8_t *mb = g_arena + MB_INFO_PHYS;
+    uint8_t *tag = mb + 8;
+    uint8_t *rsdp = tag + 8;
+    uint8_t *xsdt = g_arena + XSDT_PHYS;
+    uint8_t *madt = g_arena + MADT_PHYS;
+    uint8_t *facp = g_arena + FACP_PHYS;
+    uint8_t *p;
+    uint32_t madt_len;
+
+    memset(g_arena, 0, ARENA_BYTES);
+
+    memcpy(rsdp, "RSD PTR ", 8);
+    rsdp[15] = 2;
+    put32(rsdp + 20, 36);
+    put64(rsdp + 24, XSDT_PHYS);
+    fix_checksum(rsdp, 20, 8);
+    fix_checksum(rsdp, 36, 32);
+    put32(tag, MULTIBOOT_TAG_TYPE_ACPI_NEW);
+    put32(tag + 4, 8 + 36);
+    put32(tag + 48, MULTIBOOT_TAG_TYPE_END);
+    put32(tag + 52, 8);
+    put32(mb, (uint32_t)(tag + 56 - mb));
+
+    sdt_header(facp, "FACP", 36);
+    fix_checksum(facp, 36, 9);
+
+    sdt_header(xsdt, "XSDT", 36 + 16);
+    put64(xsdt + 36, FACP_PHYS);
+    put64(xsdt + 44, MADT_PHYS);
+    fix_checksum(xsdt, 36 + 16, 9);
+
+    p = madt + 44;
+    put32(madt + 36, 0xFEE00000U);
+    put32(madt + 40, 1);
+    /* CPU 0 and 1 enabled, CPU 2 disabled. */
+    p[2] = 0; p[3] = 0; put32(p + 4, 1); p = madt_entry(p, 0, 8);
+    p[2] = 1; p[3] = 2; put32(p + 4, 1); p = madt_entry(p, 0, 8);
+    p[2] = 2; p[3] = 4; put32(p + 4, 0); p = madt_entry(p, 0, 8);
+    /* x2APIC CPU with an ID that does not fit the 8-bit entry. */
+    put32(p + 4, 300); put32(p + 8, 1); put32(p + 12, 7); p = madt_entry(p, 9, 16);
+    /* IOAPIC 0 at 0xFEC00000, GSIs from 0. */
+    p[2] = 0; put32(p + 4, 0xFEC00000U); put32(p + 8, 0); p = madt_entry(p, 1, 12);
+    /* IRQ0 -> GSI2, IRQ9 -> GSI9 level/active-low. */
+    p[2] = 0; p[3] = 0; put32(p + 4, 2); p[8] = 0; p[9] = 0; p = madt_entry(p, 2, 10);
+    p[2] = 0; p[3] = 9; put32(p + 4, 9); p[8] = 0x0F; p[9] = 0; p = madt_entry(p, 2, 10);
+    madt_len = (uint32_t)(p - madt);
+    sdt_header(madt, "APIC", madt_len);
+    fix_checksum(madt, madt_len, 9);
+}
+
+static void test_madt_parse(void) {
+    const acpi_madt_info_t *madt;
+
+    build_tables();
+    assert(acpi_init(MB_INFO_PHYS));
+    assert(acpi_find_table("FACP") == g_arena + FACP_PHYS);
+    assert(acpi_find_table("HPET") == NULL);
+
+    madt = acpi_madt();
+    assert(madt != NULL);
+    assert(madt->has_8259);
+    assert(madt->lapic_addr == 0xFEE00000U);
+    assert(madt->cpu_count == 3);
+    assert(madt->cpu_apic_ids[0] == 0);
+    assert(madt->cpu_apic_ids[1] == 2);
+    assert(madt->cpu_apic_ids[2] == 300);
+    assert(madt->ioapic_count == 1);
+    assert(madt->ioapics[0].address == 0xFEC00000U);
+    assert(madt->override_count == 2);
+    assert(madt->overrides[0].source_irq == 0 && madt->overrides[0].gsi == 2);
+    assert((madt->overrides[1].flags & ACPI_POLARITY_MASK) == ACPI_POLARITY_LOW);
+    assert((madt->overrides[1].flags & ACPI_TRIGGER_MASK) == ACPI_TRIGGER_LEVEL);
+}
+
+static void test_bad_checksum_rejected(void) {
+    build_tables();
+    g_arena[MADT_PHYS + 44 + 3] ^= 1;
+    assert(acpi_init(MB_INFO_PHYS));
+    assert(acpi_find_table("APIC") == NULL);
+    assert(acpi_madt() == NULL);
+
+    build_tables();
+    g_arena[MB_INFO_PHYS + 16 + 24] ^= 1;
+    assert(!acpi_init(MB_INFO_PHYS));
+    assert(acpi_madt() == NULL);
+}
+
+int main(void) {
+    g_arena = malloc(ARENA_BYTES);
+    assert(g_arena != NULL);
+
+    test_madt_parse();
+    test_bad_checksum_rejected();
+
+    free(g_arena);
+    printf("acpi host tests passed\n");
+    return 0;
+}
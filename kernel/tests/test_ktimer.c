@@ -0,0 +1,179 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <kernel/ktimer.h>
+#include <kernel/softirq.h>
+
+#define MS 1000000ULL
+#define TIMERS 20000
+
+static uint64_t g_now_ns;
+static softirq_fn g_softirq;
+static int g_reprograms;
+
+uint64_t clock_monotonic_ns(void) {
+    return g_now_ns;
+}
+
+bool softirq_register(softirq_nr_t nr, const char *name, softirq_fn fn) {
+    (void)name;
+    assert(nr == SOFTIRQ_TIMER);
+    g_softirq = fn;
+    return true;
+}
+
+void softirq_raise(softirq_nr_t nr) {
+    (void)nr;
+}
+
+void timer_reprogram(void) {
+    g_reprograms++;
+}
+
+typedef struct {
+    ktimer_t timer;
+    uint64_t deadline_ns;
+    uint64_t fired_ns;
+    int fired;
+} probe_t;
+
+static probe_t g_probes[TIMERS];
+static uint64_t g_prev_run_ns;
+
+static void probe_fire(void *arg) {
+    probe_t *probe = arg;
+    probe->fired++;
+    probe->fired_ns = g_now_ns;
+}
+
+static void run_at(uint64_t now_ns) {
+    g_now_ns = now_ns;
+    g_softirq();
+    g_prev_run_ns = now_ns;
+}
+
+/* Fired exactly once and not before the tick its deadline rounds up to. */
+static void check_fired(const probe_t *probe) {
+    uint64_t tick_ns = ((probe->deadline_ns + MS - 1) / MS) * MS;
+
+    assert(probe->fired == 1);
+    assert(probe->fired_ns >= tick_ns);
+}
+
+static void test_many_timers(void) {
+    uint64_t seed = 42;
+    uint64_t start = g_now_ns;
+    ktimer_stats_t stats;
+    size_t remaining = TIMERS;
+
+    for (size_t i = 0; i < TIMERS; i++) {
+        uint64_t delay;
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        /* Spread from sub-tick delays to about 30 minutes, so every level is used. */
+        delay = (seed >> 20) % ((i % 4 == 0) ? 2000ULL * MS : 1800000ULL * MS);
+        ktimer_setup(&g_probes[i].timer, probe_fire, &g_probes[i]);
+        g_probes[i].deadline_ns = g_now_ns + delay;
+        g_probes[i].fired = 0;
+        assert(!ktimer_arm(&g_probes[i].timer, delay));
+    }
+    ktimer_stats(&stats);
+    assert(stats.pending == TIMERS);
+
+    /* Cancel every fifth timer; a second cancel reports it is gone. */
+    for (size_t i = 0; i < TIMERS; i += 5) {
+        assert(ktimer_cancel(&g_probes[i].timer));
+        assert(!ktimer_cancel(&g_probes[i].timer));
+        remaining--;
+    }
+
+    /* Irregular steps, including long idle gaps. */
+    while (g_now_ns < start + 1900000ULL * MS) {
+        uint64_t next_ns = ktimer_next_deadline_ns();
+        uint64_t earliest = UINT64_MAX;
+        uint64_t prev_ns;
+
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        for (size_t i = 0; i < TIMERS; i++) {
+            if (ktimer_pending(&g_probes[i].timer) && g_probes[i].deadline_ns < earliest) {
+                earliest = g_probes[i].deadline_ns;
+            }
+        }
+        /* The wheel may wake early, never after the earliest deadline's tick. */
+        assert(earliest == UINT64_MAX || next_ns <= ((earliest + MS - 1) / MS) * MS);
+
+        prev_ns = g_prev_run_ns;
+        run_at(g_now_ns + ((seed >> 60) == 0 ? (seed >> 11) % (60000ULL * MS) : (seed >> 11) % (3 * MS)));
+        for (size_t i = 0; i < TIMERS; i++) {
+            /* Anything fired now was not yet due at the previous run. */
+            if (g_probes[i].fired && g_probes[i].fired_ns == g_now_ns && g_now_ns != prev_ns) {
+                assert(((g_probes[i].deadline_ns + MS - 1) / MS) * MS > prev_ns);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < TIMERS; i++) {
+        if (i % 5 == 0) {
+            assert(g_probes[i].fired == 0);
+        } else {
+            check_fired(&g_probes[i]);
+        }
+    }
+    ktimer_stats(&stats);
+    assert(stats.pending == 0);
+    assert(stats.fired == remaining);
+    assert(stats.cascaded > 0);
+    assert(ktimer_next_deadline_ns() == UINT64_MAX);
+}
+
+static ktimer_t g_periodic;
+static int g_periodic_runs;
+
+static void periodic_fire(void *arg) {
+    (void)arg;
+    if (++g_periodic_runs < 5) {
+        assert(!ktimer_arm(&g_periodic, 10 * MS));
+    }
+}
+
+static void test_rearm_from_callback(void) {
+    ktimer_setup(&g_periodic, periodic_fire, NULL);
+    assert(!ktimer_arm(&g_periodic, 10 * MS));
+    /* Re-arming a pending timer moves it. */
+    assert(ktimer_arm(&g_periodic, 10 * MS));
+    for (int i = 0; i < 100; i++) {
+        run_at(g_now_ns + MS);
+    }
+    assert(g_periodic_runs == 5);
+    assert(!ktimer_pending(&g_periodic));
+}
+
+static void test_beyond_top_level(void) {
+    probe_t *probe = &g_probes[0];
+    uint64_t delay = 10ULL * 3600ULL * 1000ULL * MS;
+
+    ktimer_setup(&probe->timer, probe_fire, probe);
+    probe->fired = 0;
+    probe->deadline_ns = g_now_ns + delay;
+    ktimer_arm(&probe->timer, delay);
+    run_at(g_now_ns + delay / 2);
+    assert(probe->fired == 0);
+    run_at(probe->deadline_ns - MS);
+    assert(probe->fired == 0);
+    run_at(probe->deadline_ns + MS);
+    check_fired(probe);
+}
+
+int main(void) {
+    g_now_ns = 5 * MS + 123;
+    ktimer_init();
+    assert(g_softirq != NULL);
+
+    test_many_timers();
+    test_rearm_from_callback();
+    test_beyond_top_level();
+    assert(g_reprograms > 0);
+
+    printf("ktimer host tests passed\n");
+    return 0;
+}
@@ -0,0 +1,143 @@
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <kernel/lock.h>
+
+#define THREADS 4
+#define ITERATIONS 20000
+
+static spinlock_t g_spin;
+static ticketlock_t g_ticket;
+static mcslock_t g_mcs;
+/*
+ * Deliberately non-atomic: only the lock keeps increments from being lost.
+ * Workers yield after every release so FIFO locks still make progress when
+ * the host has fewer cores than threads.
+ */
+static volatile uint64_t g_counter;
+
+static void *spin_worker(void *arg) {
+    (void)arg;
+    for (int i = 0; i < ITERATIONS; i++) {
+        uint64_t flags = spin_lock_irqsave(&g_spin);
+        g_counter++;
+        spin_unlock_irqrestore(&g_spin, flags);
+        sched_yield();
+    }
+    return NULL;
+}
+
+static void *ticket_worker(void *arg) {
+    (void)arg;
+    for (int i = 0; i < ITERATIONS; i++) {
+        ticket_lock(&g_ticket);
+        g_counter++;
+        ticket_unlock(&g_ticket);
+        sched_yield();
+    }
+    return NULL;
+}
+
+static void *mcs_worker(void *arg) {
+    (void)arg;
+    for (int i = 0; i < ITERATIONS; i++) {
+        mcs_node_t node;
+        uint64_t flags = mcs_lock_irqsave(&g_mcs, &node);
+        g_counter++;
+        mcs_unlock_irqrestore(&g_mcs, &node, flags);
+        sched_yield();
+    }
+    return NULL;
+}
+
+static void find_lock(const char *name, lock_info_t *out) {
+    int matches = 0;
+    lock_info_t info;
+
+    for (size_t i = 0; lock_info(i, &info); i++) {
+        if (strcmp(info.name, name) == 0) {
+            *out = info;
+            matches++;
+        }
+    }
+    assert(matches == 1);
+}
+
+static void run_contended(void *(*worker)(void *), const char *name, lock_kind_t kind) {
+    pthread_t threads[THREADS];
+    lock_info_t info;
+
+    g_counter = 0;
+    for (int i = 0; i < THREADS; i++) {
+        assert(pthread_create(&threads[i], NULL, worker, NULL) == 0);
+    }
+    for (int i = 0; i < THREADS; i++) {
+        assert(pthread_join(threads[i], NULL) == 0);
+    }
+    assert(g_counter == (uint64_t)THREADS * ITERATIONS);
+
+    find_lock(name, &info);
+    assert(info.kind == kind);
+    assert(info.acquisitions == (uint64_t)THREADS * ITERATIONS);
+    assert(info.contended <= info.acquisitions);
+    assert((info.contended == 0) == (info.spin_cycles == 0));
+    assert(info.hold_max_cycles > 0);
+}
+
+static void test_trylock(void) {
+    mcs_node_t a;
+    mcs_node_t b;
+
+    spin_init(&g_spin, "test-spin");
+    assert(spin_trylock(&g_spin));
+    assert(!spin_trylock(&g_spin));
+    spin_unlock(&g_spin);
+    assert(spin_trylock(&g_spin));
+    spin_unlock(&g_spin);
+
+    ticket_init(&g_ticket, "test-ticket");
+    assert(ticket_trylock(&g_ticket));
+    assert(!ticket_trylock(&g_ticket));
+    ticket_unlock(&g_ticket);
+    ticket_lock(&g_ticket);
+    ticket_unlock(&g_ticket);
+    assert(ticket_trylock(&g_ticket));
+    ticket_unlock(&g_ticket);
+
+    mcs_init(&g_mcs, "test-mcs");
+    assert(mcs_trylock(&g_mcs, &a));
+    assert(!mcs_trylock(&g_mcs, &b));
+    mcs_unlock(&g_mcs, &a);
+    assert(mcs_trylock(&g_mcs, &b));
+    mcs_unlock(&g_mcs, &b);
+}
+
+static void test_reinit_keeps_one_entry(void) {
+    lock_info_t info;
+
+    /* find_lock() asserts the name is registered exactly once. */
+    spin_init(&g_spin, "test-spin");
+    ticket_init(&g_ticket, "test-ticket");
+    mcs_init(&g_mcs, "test-mcs");
+    find_lock("test-spin", &info);
+    assert(info.acquisitions == 0);
+    find_lock("test-ticket", &info);
+    find_lock("test-mcs", &info);
+    assert(strcmp(lock_kind_name(LOCK_KIND_MCS), "mcs") == 0);
+}
+
+int main(void) {
+    test_trylock();
+    test_reinit_keeps_one_entry();
+
+    run_contended(spin_worker, "test-spin", LOCK_KIND_SPIN);
+    run_contended(ticket_worker, "test-ticket", LOCK_KIND_TICKET);
+    run_contended(mcs_worker, "test-mcs", LOCK_KIND_MCS);
+
+    printf("lock host tests passed\n");
+    return 0;
+}
@@ -0,0 +1,493 @@
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <kernel/pmm.h>
+#include <kernel/vmm.h>
+
+#define MiB (1024ULL * 1024ULL)
+#define GiB (1024ULL * MiB)
+#define ARENA_BYTES (8 * MiB)
+
+/* Linker symbols for pmm.c; host addresses fall outside the test map. */
+uint8_t _kernel_start;
+uint8_t _kernel_end;
+
+/* Host memory standing in for the low physical window the PMM carves. */
+static uint8_t *g_arena;
+
+void *vmm_phys_to_virt(uint64_t phys_addr) {
+    assert(phys_addr < ARENA_BYTES);
+    return g_arena + phys_addr;
+}
+
+uint64_t vmm_direct_map_limit(void) {
+    return ARENA_BYTES;
+}
+
+/* Each host thread plays one CPU; the main thread is the boot CPU. */
+static __thread unsigned int g_cpu;
+
+unsigned int smp_cpu_id(void) {
+    return g_cpu;
+}
+
+static uint64_t meta_frames(void) {
+    return pmm_metadata_kib() / 4;
+}
+
+static void test_basic_alloc_free(void) {
+    pmm_region_t regions[] = {
+        { 0, 640 * 1024ULL },
+        { 1 * MiB, 63 * MiB },
+    };
+    uint64_t free_before;
+    uint64_t a;
+    uint64_t b;
+
+    pmm_init_regions(regions, 2);
+    assert(pmm_total_kib() == 64 * 1024ULL);
+    /* Low 1 MiB and the carved frame database are reserved. */
+    assert(meta_frames() > 0);
+    assert(pmm_free_kib() == 63 * 1024ULL - pmm_metadata_kib());
+
+    free_before = pmm_free_kib();
+    a = pmm_alloc_frame();
+    b = pmm_alloc_frame();
+    assert(a >= 1 * MiB && b >= 1 * MiB);
+    assert(a != b);
+    assert((a & 0xFFFULL) == 0 && (b & 0xFFFULL) == 0);
+    assert(pmm_free_kib() == free_before - 8);
+
+    pmm_free_frame(a);
+    pmm_free_frame(a);
+    assert(pmm_free_kib() == free_before - 4);
+    pmm_free_frame(b);
+    assert(pmm_free_kib() == free_before);
+}
+
+static void test_low_alloc_limit(void) {
+    pmm_region_t regions[] = {
+        { 1 * MiB, 31 * MiB },
+    };
+    uint64_t frame;
+    uint64_t count = 0;
+
+    pmm_init_regions(regions, 1);
+    while ((frame = pmm_alloc_frame_low(2 * MiB)) != 0) {
+        assert(frame >= 1 * MiB && frame < 2 * MiB);
+        count++;
+    }
+    assert(count == 256 - meta_frames());
+
+    frame = pmm_alloc_frame();
+    assert(frame >= 2 * MiB);
+}
+
+static void test_exhaustion_and_wrap(void) {
+    pmm_region_t regions[] = {
+        { 1 * MiB, 1 * MiB },
+        { 20 * MiB, 1 * MiB },
+    };
+    uint64_t frames[512];
+    uint64_t n = 0;
+    uint64_t frame;
+    uint64_t expected;
+
+    pmm_init_regions(regions, 2);
+    expected = 512 - meta_frames();
+    while ((frame = pmm_alloc_frame()) != 0) {
+        assert((frame >= 1 * MiB && frame < 2 * MiB) || (frame >= 20 * MiB && frame < 21 * MiB));
+        assert(n < 512);
+        frames[n++] = frame;
+    }
+    assert(n == expected);
+    assert(pmm_free_kib() == 0);
+
+    /* Next-fit must wrap around to frames released behind the hint. */
+    pmm_free_frame(frames[3]);
+    assert(pmm_alloc_frame() == frames[3]);
+    assert(pmm_alloc_frame() == 0);
+}
+
+static void test_buddy_split_and_coalesce(void) {
+    pmm_region_t regions[] = {
+        { 1 * MiB, 63 * MiB },
+    };
+    uint64_t blocks[256];
+    unsigned int orders[256];
+    uint64_t free_before;
+    uint64_t max_blocks_before;
+    uint64_t seed = 12345;
+    uint64_t huge;
+    uint64_t invalid_before;
+
+    pmm_init_regions(regions, 1);
+    free_before = pmm_free_kib();
+    max_blocks_before = pmm_free_blocks(PMM_MAX_ORDER);
+    assert(max_blocks_before > 0);
+
+    huge = pmm_alloc_pages(PMM_ORDER_2M);
+    assert(huge != 0);
+    assert((huge & (2 * MiB - 1)) == 0);
+    assert(pmm_free_kib() == free_before - 2048);
+
+    /* Random churn across orders, then release everything. */
+    for (int round = 0; round < 64; round++) {
+        for (int i = 0; i < 256; i++) {
+            seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+            orders[i] = (unsigned int)((seed >> 33) % 6);
+            blocks[i] = pmm_alloc_pages(orders[i]);
+            assert(blocks[i] != 0);
+            assert((blocks[i] & ((4096ULL << orders[i]) - 1)) == 0);
+        }
+        for (int i = 0; i < 256; i += 2) {
+            pmm_free_pages(blocks[i], orders[i]);
+        }
+        for (int i = 1; i < 256; i += 2) {
+            pmm_free_pages(blocks[i], orders[i]);
+        }
+    }
+
+    pmm_free_pages(huge, PMM_ORDER_2M);
+    assert(pmm_free_kib() == free_before);
+    pmm_cache_drain();
+    assert(pmm_free_blocks(PMM_MAX_ORDER) == max_blocks_before);
+
+    /* Double and misaligned frees are rejected and counted. */
+    invalid_before = pmm_invalid_ops();
+    pmm_free_pages(huge, 0);
+    pmm_free_pages(huge + 4096, 1);
+    assert(pmm_invalid_ops() == invalid_before + 2);
+    assert(pmm_free_kib() == free_before);
+}
+
+static void test_frame_magazines(void) {
+    pmm_region_t regions[] = {
+        { 1 * MiB, 31 * MiB },
+    };
+    pmm_cache_stats_t stats;
+    uint64_t frames[200];
+    uint64_t free_before;
+    uint64_t invalid_before;
+
+    pmm_init_regions(regions, 1);
+    free_before = pmm_free_kib();
+    pmm_cache_stats(&stats);
+    assert(stats.hits == 0 && stats.misses == 0 && stats.cached_frames == 0);
+
+    /* The first allocation refills a whole batch; the next ones hit. */
+    frames[0] = pmm_alloc_frame();
+    pmm_cache_stats(&stats);
+    assert(stats.misses == 1 && stats.refills == 1 && stats.hits == 0);
+    assert(stats.cached_frames == 31);
+    for (int i = 1; i < 32; i++) {
+        frames[i] = pmm_alloc_frame();
+        assert(frames[i] == frames[i - 1] + 4096);
+    }
+    pmm_cache_stats(&stats);
+    assert(stats.hits == 31 && stats.cached_frames == 0);
+    assert(pmm_free_kib() == free_before - 32 * 4);
+
+    for (int i = 32; i < 200; i++) {
+        frames[i] = pmm_alloc_frame();
+        assert(frames[i] != 0);
+    }
+
+    /* A cached frame freed twice is still rejected. */
+    invalid_before = pmm_invalid_ops();
+    pmm_free_frame(frames[0]);
+    pmm_free_frame(frames[0]);
+    pmm_free_pages(frames[0], 0);
+    assert(pmm_invalid_ops() == invalid_before + 2);
+
+    /* Overflowing the magazine drains a batch back to the zones. */
+    for (int i = 1; i < 200; i++) {
+        pmm_free_frame(frames[i]);
+    }
+    pmm_cache_stats(&stats);
+    assert(stats.drains > 0);
+    assert(stats.cached_frames <= 64);
+    assert(pmm_free_kib() == free_before);
+
+    pmm_cache_drain();
+    pmm_cache_stats(&stats);
+    assert(stats.cached_frames == 0);
+    assert(pmm_free_kib() == free_before);
+}
+
+static void test_zeroed_pool(void) {
+    pmm_region_t regions[] = {
+        { 1 * MiB, 7 * MiB },
+    };
+    pmm_cache_stats_t stats;
+    uint64_t free_before;
+    uint64_t frame;
+    uint8_t *page;
+
+    pmm_init_regions(regions, 1);
+    free_before = pmm_free_kib();
+
+    /* Empty pool: zeroed on demand. */
+    frame = pmm_alloc_zeroed_frame();
+    assert(frame != 0);
+    page = vmm_phys_to_virt(frame);
+    for (int i = 0; i < 4096; i++) {
+        assert(page[i] == 0);
+    }
+    memset(page, 0xA5, 4096);
+    pmm_free_frame(frame);
+    pmm_cache_stats(&stats);
+    assert(stats.zero_misses == 1 && stats.zero_hits == 0);
+
+    /* Idle refills run in budgets until the pool is full. */
+    assert(pmm_zero_pool_refill(4));
+    pmm_cache_stats(&stats);
+    assert(stats.zeroed_frames == 4);
+    while (pmm_zero_pool_refill(4)) {
+    }
+    pmm_cache_stats(&stats);
+    assert(stats.zeroed_frames == 32);
+    /* Pooled frames still count as free memory. */
+    assert(pmm_free_kib() == free_before);
+
+    for (int n = 0; n < 32; n++) {
+        frame = pmm_alloc_zeroed_frame();
+        page = vmm_phys_to_virt(frame);
+        for (int i = 0; i < 4096; i++) {
+            assert(page[i] == 0);
+        }
+        memset(page, 0xA5, 4096);
+        pmm_free_frame(frame);
+    }
+    pmm_cache_stats(&stats);
+    assert(stats.zero_hits == 32 && stats.zeroed_frames == 0);
+
+    /* Pooled frames go back to the zones under pressure. */
+    (void)pmm_zero_pool_refill(1);
+    pmm_cache_stats(&stats);
+    assert(stats.zeroed_frames == 1);
+    pmm_cache_drain();
+    pmm_cache_stats(&stats);
+    assert(stats.zeroed_frames == 0 && stats.cached_frames == 0);
+    assert(pmm_free_kib() == free_before);
+}
+
+static void test_stats(void) {
+    pmm_region_t regions[] = {
+        { 1 * MiB, 15 * MiB },
+    };
+    pmm_stats_t stats;
+    uint64_t frames[512];
+    uint64_t samples = 0;
+
+    pmm_init_regions(regions, 1);
+    pmm_stats(&stats);
+    assert(stats.allocs == 0 && stats.frees == 0);
+    /* Freshly seeded memory is almost entirely in max-order blocks. */
+    assert(stats.unusable_permille[0] == 0);
+    assert(stats.unusable_permille[PMM_MAX_ORDER] < 500);
+
+    for (int i = 0; i < 512; i++) {
+        frames[i] = pmm_alloc_frame();
+        assert(frames[i] != 0);
+    }
+    /* Free every other frame from another CPU: order-0 holes only. */
+    g_cpu = 1;
+    for (int i = 0; i < 512; i += 2) {
+        pmm_free_frame(frames[i]);
+    }
+    g_cpu = 0;
+    pmm_cache_drain();
+
+    /* Counters are kept per CPU and summed. */
+    pmm_stats(&stats);
+    assert(stats.allocs == 512);
+    assert(stats.alloc_failures == 0);
+    assert(stats.frees == 256);
+    assert(stats.free_blocks[0] >= 256);
+    assert(stats.unusable_permille[1] > 0);
+    for (unsigned int k = 1; k <= PMM_MAX_ORDER; k++) {
+        assert(stats.unusable_permille[k] >= stats.unusable_permille[k - 1]);
+    }
+    for (unsigned int b = 0; b < PMM_LATENCY_BUCKETS; b++) {
+        samples += stats.latency_hist[b];
+    }
+    assert(samples == stats.allocs);
+    assert(stats.latency_p50 <= stats.latency_p99);
+    assert(stats.latency_p99 <= stats.latency_max);
+    assert(stats.latency_max > 0);
+
+    /* Failed allocations are counted. */
+    while (pmm_alloc_pages(PMM_MAX_ORDER) != 0) {
+    }
+    pmm_stats(&stats);
+    assert(stats.alloc_failures == 1);
+}
+
+static void test_frame_database_scales(void) {
+    pmm_region_t small[] = {
+        { 1 * MiB, 31 * MiB },
+    };
+    pmm_region_t large[] = {
+        { 1 * MiB, 511 * MiB },
+        { 4 * GiB, 60 * GiB },
+    };
+    uint64_t small_meta;
+    uint64_t frame;
+
+    pmm_init_regions(small, 1);
+    small_meta = pmm_metadata_kib();
+    assert(small_meta <= 8);
+
+    /* 64 GiB of tracked memory: no ceiling, maps sized to match. */
+    pmm_init_regions(large, 2);
+    assert(pmm_total_kib() == 64 * GiB / 1024);
+    assert(pmm_metadata_kib() > small_meta);
+    assert(pmm_metadata_kib() <= 5 * 1024);
+    assert(pmm_free_kib() == (511 * MiB + 60 * GiB) / 1024 - pmm_metadata_kib());
+
+    /* Unconstrained allocations come from NORMAL first. */
+    frame = pmm_alloc_pages(PMM_MAX_ORDER);
+    assert(frame >= 4 * GiB);
+}
+
+static void test_zones(void) {
+    pmm_region_t regions[] = {
+        { 1 * MiB, 511 * MiB },
+        { 4 * GiB, 1 * GiB },
+    };
+    pmm_zone_info_t dma;
+    pmm_zone_info_t dma32;
+    pmm_zone_info_t normal;
+    pmm_zone_info_t info;
+    uint64_t frame;
+    uint64_t before;
+
+    pmm_init_regions(regions, 2);
+    assert(pmm_zone_info(PMM_ZONE_DMA, &dma));
+    assert(pmm_zone_info(PMM_ZONE_DMA32, &dma32));
+    assert(pmm_zone_info(PMM_ZONE_NORMAL, &normal));
+    assert(!pmm_zone_info(PMM_ZONE_COUNT, &info));
+
+    assert(dma.base == 0 && dma.end == 16 * MiB);
+    assert(dma32.base == 16 * MiB && dma32.end == 4 * GiB);
+    assert(normal.base == 4 * GiB && normal.end == 5 * GiB);
+    /* The frame database is carved from the lowest available RAM. */
+    assert(dma.managed_kib == 15 * 1024ULL - pmm_metadata_kib());
+    assert(dma32.managed_kib == 496 * 1024ULL);
+    assert(normal.managed_kib == 1024 * 1024ULL);
+    assert(dma.free_kib + dma32.free_kib + normal.free_kib == pmm_free_kib());
+
+    /* Constrained requests skip zones they cannot use... */
+    frame = pmm_alloc_pages_low(PMM_ORDER_2M, 4 * GiB);
+    assert(frame >= 16 * MiB && frame < 4 * GiB);
+    assert((frame & (2 * MiB - 1)) == 0);
+    pmm_free_pages(frame, PMM_ORDER_2M);
+
+    /* ...honour limits inside a zone... */
+    frame = pmm_alloc_pages_low(2, 32 * MiB);
+    assert(frame >= 16 * MiB && frame + 4 * 4096 <= 32 * MiB);
+    pmm_free_pages(frame, 2);
+    frame = pmm_alloc_frame_low(16 * MiB);
+    assert(frame >= 1 * MiB && frame < 16 * MiB);
+    pmm_free_frame(frame);
+
+    /* ...and fall back to lower zones once the preferred one is empty. */
+    pmm_cache_drain();
+    before = pmm_free_kib();
+    for (uint64_t i = 0; i < normal.managed_kib / 4096; i++) {
+        frame = pmm_alloc_pages(PMM_MAX_ORDER);
+        assert(frame >= 4 * GiB);
+    }
+    assert(pmm_zone_info(PMM_ZONE_NORMAL, &info) && info.free_kib == 0);
+    frame = pmm_alloc_frame();
+    assert(frame >= 16 * MiB && frame < 4 * GiB);
+    assert(pmm_free_kib() == before - normal.managed_kib - 4);
+    assert(pmm_alloc_pages_low(0, 1 * MiB) == 0);
+}
+
+#define REMOTE_ROUNDS 20000
+#define REMOTE_FRAMES 48
+
+static volatile int g_remote_done;
+
+/* CPU 1 churns its magazine and checks it never holds a frame twice. */
+static void *remote_owner(void *arg) {
+    uint64_t frames[REMOTE_FRAMES];
+
+    (void)arg;
+    g_cpu = 1;
+    for (int r = 0; r < REMOTE_ROUNDS; r++) {
+        for (int i = 0; i < REMOTE_FRAMES; i++) {
+            frames[i] = pmm_alloc_frame();
+            assert(frames[i] != 0);
+            *(uint64_t *)vmm_phys_to_virt(frames[i]) = (uint64_t)i;
+        }
+        for (int i = 0; i < REMOTE_FRAMES; i++) {
+            assert(*(uint64_t *)vmm_phys_to_virt(frames[i]) == (uint64_t)i);
+            pmm_free_frame(frames[i]);
+        }
+    }
+    __atomic_store_n(&g_remote_done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+static void test_remote_drain(void) {
+    pmm_region_t regions[] = {
+        { 1 * MiB, 7 * MiB },
+    };
+    pmm_cache_stats_t stats;
+    pthread_t owner;
+    uint64_t free_before;
+    uint64_t invalid_before;
+
+    pmm_init_regions(regions, 1);
+    free_before = pmm_free_kib();
+    invalid_before = pmm_invalid_ops();
+
+    /* Draining from CPU 0 empties CPU 1's magazine as well. */
+    g_remote_done = 0;
+    assert(pthread_create(&owner, NULL, remote_owner, NULL) == 0);
+    while (!__atomic_load_n(&g_remote_done, __ATOMIC_ACQUIRE)) {
+        pmm_cache_drain();
+        sched_yield();
+    }
+    assert(pthread_join(owner, NULL) == 0);
+
+    g_cpu = 1;
+    pmm_free_frame(pmm_alloc_frame());
+    g_cpu = 0;
+    pmm_cache_stats(&stats);
+    assert(stats.cached_frames != 0);
+    pmm_cache_drain();
+    pmm_cache_stats(&stats);
+    assert(stats.cached_frames == 0);
+    assert(pmm_free_kib() == free_before);
+    assert(pmm_invalid_ops() == invalid_before);
+}
+
+int main(void) {
+    g_arena = calloc(1, ARENA_BYTES);
+    assert(g_arena != NULL);
+
+    test_basic_alloc_free();
+    test_low_alloc_limit();
+    test_exhaustion_and_wrap();
+    test_buddy_split_and_coalesce();
+    test_frame_magazines();
+    test_remote_drain();
+    test_zeroed_pool();
+    test_stats();
+    test_frame_database_scales();
+    test_zones();
+
+    free(g_arena);
+    printf("pmm host tests passed\n");
+    return 0;
+}
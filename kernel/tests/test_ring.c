@@ -0,0 +1,151 @@
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <kernel/ring.h>
+
+#define STRESS_ITEMS 500000U
+
+typedef struct {
+    uint32_t seq;
+    uint16_t code;
+    uint8_t flags;
+} item_t;
+
+RING_DEFINE(byte_ring, uint8_t, 4)
+RING_DEFINE(item_ring, item_t, 3)
+RING_DEFINE(word_ring, uint32_t, 8)
+
+static byte_ring_t g_bytes;
+static item_ring_t g_items;
+static word_ring_t g_words;
+
+static void test_capacity_and_wrap(void) {
+    uint8_t in[40];
+    uint8_t out[40];
+    uint8_t value;
+
+    for (size_t i = 0; i < sizeof(in); i++) {
+        in[i] = (uint8_t)i;
+    }
+
+    byte_ring_init(&g_bytes);
+    assert(byte_ring_empty(&g_bytes));
+    assert(!byte_ring_pop(&g_bytes, &value));
+
+    /* Every slot is usable; the overflow is reported as a short push. */
+    assert(byte_ring_push_n(&g_bytes, in, sizeof(in)) == 16);
+    assert(byte_ring_count(&g_bytes) == 16);
+    assert(ring_space(&g_bytes.ring) == 0);
+    assert(!byte_ring_push(&g_bytes, 0xFF));
+
+    /* Walk the indices around the end many times with odd-sized batches. */
+    for (size_t round = 0; round < 100; round++) {
+        size_t n = 1 + round % 13;
+        size_t got = byte_ring_pop_n(&g_bytes, out, n);
+
+        assert(got == n);
+        assert(byte_ring_push_n(&g_bytes, in, n) == n);
+        assert(byte_ring_count(&g_bytes) == 16);
+    }
+
+    byte_ring_init(&g_bytes);
+    for (size_t round = 0; round < 50; round++) {
+        size_t n = 1 + round % 16;
+
+        assert(byte_ring_push_n(&g_bytes, in + round % 7, n) == n);
+        memset(out, 0, sizeof(out));
+        assert(byte_ring_pop_n(&g_bytes, out, sizeof(out)) == n);
+        assert(memcmp(out, in + round % 7, n) == 0);
+        assert(byte_ring_push(&g_bytes, (uint8_t)round));
+        assert(byte_ring_pop(&g_bytes, &value) && value == (uint8_t)round);
+    }
+    assert(byte_ring_empty(&g_bytes));
+}
+
+static void test_struct_elements(void) {
+    item_t in[6];
+    item_t out[8];
+    item_t item;
+
+    item_ring_init(&g_items);
+    for (uint32_t i = 0; i < 6; i++) {
+        in[i].seq = i;
+        in[i].code = (uint16_t)(i * 3);
+        in[i].flags = (uint8_t)(i & 1);
+    }
+    assert(item_ring_push_n(&g_items, in, 6) == 6);
+    assert(item_ring_pop(&g_items, &item) && item.seq == 0);
+    assert(item_ring_pop_n(&g_items, out, 3) == 3);
+    assert(item_ring_push_n(&g_items, in, 6) == 6);
+    assert(item_ring_pop_n(&g_items, out, 8) == 8);
+    assert(out[0].seq == 4 && out[1].seq == 5 && out[1].code == 15);
+    for (uint32_t i = 2; i < 8; i++) {
+        assert(out[i].seq == i - 2 && out[i].code == (i - 2) * 3);
+    }
+}
+
+/*
+ * The consumer must see every value, in order, fully written. Both sides
+ * yield when stalled so the test also finishes on a single-core host.
+ */
+static void *stress_producer(void *arg) {
+    uint32_t batch[7];
+    uint32_t next = 0;
+
+    (void)arg;
+    while (next < STRESS_ITEMS) {
+        if (next % 3 == 0) {
+            if (word_ring_push(&g_words, next)) {
+                next++;
+            } else {
+                sched_yield();
+            }
+            continue;
+        }
+        size_t n = 0;
+        while (n < 7 && next + n < STRESS_ITEMS) {
+            batch[n] = next + (uint32_t)n;
+            n++;
+        }
+        n = word_ring_push_n(&g_words, batch, n);
+        if (n == 0) {
+            sched_yield();
+        }
+        next += (uint32_t)n;
+    }
+    return NULL;
+}
+
+static void test_spsc_threads(void) {
+    pthread_t producer;
+    uint32_t batch[11];
+    uint32_t expect = 0;
+
+    word_ring_init(&g_words);
+    assert(pthread_create(&producer, NULL, stress_producer, NULL) == 0);
+    while (expect < STRESS_ITEMS) {
+        size_t got = word_ring_pop_n(&g_words, batch, 1 + expect % 11);
+        if (got == 0) {
+            sched_yield();
+        }
+        for (size_t i = 0; i < got; i++) {
+            assert(batch[i] == expect);
+            expect++;
+        }
+    }
+    assert(pthread_join(producer, NULL) == 0);
+    assert(word_ring_empty(&g_words));
+}
+
+int main(void) {
+    test_capacity_and_wrap();
+    test_struct_elements();
+    test_spsc_threads();
+
+    printf("ring host tests passed\n");
+    return 0;
+}
@@ -5,12 +5,19 @@
 
 #include <kernel/keyboard.h>
 #include <kernel/pty.h>
+#include <kernel/sched.h>
 #include <kernel/tty.h>
+#include <kernel/waitqueue.h>
 
 static char g_input_q[8192];
 static size_t g_input_head = 0;
 static size_t g_input_tail = 0;
 static size_t g_console_putchar_count = 0;
+static wait_queue_t g_kbd_wait;
+static int g_blocked = 0;
+static int g_cancelled = 0;
+static int g_woken = 0;
+static int g_block_pty = -1;
 
 /* Console stubs for tty.c */
 void console_write(const char *s) {
@@ -26,12 +33,48 @@ void console_backspace(void) {
 }
 
 /* Keyboard stubs for tty.c */
-bool keyboard_pop_char(char *out) {
-    if (g_input_tail == g_input_head) {
-        return false;
+size_t keyboard_read(char *buf, size_t len) {
+    size_t n = 0;
+
+    while (n < len && g_input_tail != g_input_head) {
+        buf[n++] = g_input_q[g_input_tail++];
     }
-    *out = g_input_q[g_input_tail++];
-    return true;
+    return n;
+}
+
+bool keyboard_has_input(void) {
+    return g_input_tail != g_input_head;
+}
+
+wait_queue_t *keyboard_wait_queue(void) {
+    return &g_kbd_wait;
+}
+
+/* Scheduler stubs for waitqueue.c: one fake thread, wakeups are counted. */
+thread_t *sched_current(void) {
+    return (thread_t *)&g_blocked;
+}
+
+void sched_prepare_block(void) {
+}
+
+/* Stands in for another CPU producing while the reader sleeps. */
+void sched_block(void) {
+    static const uint8_t byte = 'w';
+
+    g_blocked++;
+    if (g_block_pty >= 0) {
+        assert(pty_master_write(g_block_pty, &byte, 1) == 1);
+    }
+}
+
+void sched_cancel_block(void) {
+    g_cancelled++;
+}
+
+void sched_wake(thread_t *thread) {
+    assert(thread == (thread_t *)&g_blocked);
+    g_woken++;
 }
 
 static void feed_keyboard_bytes(const char *data, size_t len) {
@@ -72,6 +115,7 @@ int main(void) {
     size_t wrote;
     size_t read;
 
+    wait_queue_init(&g_kbd_wait, "test-keyboard-wait");
     tty_init();
     pty_init();
 
@@ -102,6 +146,21 @@ int main(void) {
     assert(n == 2);
     assert(pty_out[0] == 'z' && pty_out[1] == '\n');
 
+    /* sleepers are woken by producers and skip the sleep when input is queued */
+    g_block_pty = pty;
+    tty_wait_input();
+    assert(g_blocked == 1 && g_woken == 1 && g_cancelled == 0);
+    tty_wait_input();
+    assert(g_blocked == 1 && g_cancelled == 1);
+    n = drain_pty(pty, pty_out, sizeof(pty_out));
+    assert(n == 1 && pty_out[0] == 'w');
+    assert(!pty_slave_readable(pty));
+    /* the entry left the queue, so later writes wake nobody */
+    assert(pty_master_write(pty, pty_out, 1) == 1);
+    assert(g_woken == 1);
+    (void)drain_pty(pty, pty_out, sizeof(pty_out));
+    g_block_pty = -1;
+
     /* pty fault counters */
     wrote = pty_master_write(pty, big, sizeof(big));
     read = drain_pty(pty, pty_out, sizeof(pty_out));
@@ -90,6 +90,7 @@ set +e
 timeout 25s qemu-system-x86_64 \
   -machine q35 \
   -m 512M \
+  -smp 4 \
   -drive if=pflash,format=raw,readonly=on,file="$UEFI_CODE" \
   -drive if=pflash,format=raw,file="$UEFI_VARS_RUNTIME" \
   -cdrom build/waluos.iso \
@@ -0,0 +1,25 @@
+#!/usr/bin/env bash
+set -euo pipefail
+
+ROOT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")/.." && pwd)"
+cd "$ROOT_DIR"
+
+PMM_BENCH_BIN="/tmp/walu_kernel_pmm_bench"
+RING_BENCH_BIN="/tmp/walu_kernel_ring_bench"
+KEYBOARD_BENCH_BIN="/tmp/walu_kernel_keyboard_bench"
+
+gcc -std=gnu11 -Wall -Wextra -O2 -fno-builtin -DWALU_HOST -Ikernel/include \
+  kernel/tests/bench_pmm.c kernel/src/core/pmm.c kernel/src/core/lock.c \
+  -o "$PMM_BENCH_BIN"
+
+gcc -std=gnu11 -Wall -Wextra -O2 -fno-builtin -DWALU_HOST -Ikernel/include \
+  kernel/tests/bench_ring.c kernel/src/lib/ring.c \
+  -o "$RING_BENCH_BIN"
+
+gcc -std=gnu11 -Wall -Wextra -O2 -fno-builtin -DWALU_HOST -Ikernel/include \
+  kernel/tests/bench_keyboard.c kernel/src/core/keyboard.c kernel/src/lib/ring.c \
+  -o "$KEYBOARD_BENCH_BIN"
+
+"$PMM_BENCH_BIN"
+"$RING_BENCH_BIN"
+"$KEYBOARD_BENCH_BIN"
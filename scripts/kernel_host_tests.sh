@@ -5,11 +5,49 @@ ROOT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")/.." && pwd)"
 cd "$ROOT_DIR"
 
 OUT_BIN="/tmp/walu_kernel_host_tests"
+PMM_BIN="/tmp/walu_kernel_pmm_tests"
+SLAB_BIN="/tmp/walu_kernel_slab_tests"
+ACPI_BIN="/tmp/walu_kernel_acpi_tests"
+LOCK_BIN="/tmp/walu_kernel_lock_tests"
+KTIMER_BIN="/tmp/walu_kernel_ktimer_tests"
+RING_BIN="/tmp/walu_kernel_ring_tests"
 
 # Host tests should use libc memory primitives to avoid freestanding/builtin
 # optimization recursion that can occur with kernel string.c at -O2.
-gcc -std=gnu11 -Wall -Wextra -O2 -fno-builtin -Ikernel/include \
-  kernel/tests/test_tty_pty.c kernel/src/core/tty.c kernel/src/core/pty.c \
+# WALU_HOST turns the cli/sti in irq_save()/irq_restore() into no-ops.
+gcc -std=gnu11 -Wall -Wextra -O2 -fno-builtin -DWALU_HOST -Ikernel/include \
+  kernel/tests/test_tty_pty.c kernel/src/core/tty.c kernel/src/core/pty.c kernel/src/core/lock.c \
+  kernel/src/core/waitqueue.c kernel/src/lib/ring.c \
   -o "$OUT_BIN"
 
+gcc -std=gnu11 -Wall -Wextra -O2 -fno-builtin -DWALU_HOST -Ikernel/include -pthread \
+  kernel/tests/test_pmm.c kernel/src/core/pmm.c kernel/src/core/lock.c \
+  -o "$PMM_BIN"
+
+gcc -std=gnu11 -Wall -Wextra -O2 -fno-builtin -DWALU_HOST -Ikernel/include \
+  kernel/tests/test_slab.c kernel/src/core/slab.c kernel/src/core/pmm.c kernel/src/core/lock.c \
+  -o "$SLAB_BIN"
+
+gcc -std=gnu11 -Wall -Wextra -O2 -fno-builtin -DWALU_HOST -Ikernel/include \
+  kernel/tests/test_acpi.c kernel/src/core/acpi.c \
+  -o "$ACPI_BIN"
+
+gcc -std=gnu11 -Wall -Wextra -O2 -fno-builtin -DWALU_HOST -Ikernel/include -pthread \
+  kernel/tests/test_lock.c kernel/src/core/lock.c \
+  -o "$LOCK_BIN"
+
+gcc -std=gnu11 -Wall -Wextra -O2 -fno-builtin -DWALU_HOST -Ikernel/include \
+  kernel/tests/test_ktimer.c kernel/src/core/ktimer.c kernel/src/core/lock.c \
+  -o "$KTIMER_BIN"
+
+gcc -std=gnu11 -Wall -Wextra -O2 -fno-builtin -DWALU_HOST -Ikernel/include -pthread \
+  kernel/tests/test_ring.c kernel/src/lib/ring.c \
+  -o "$RING_BIN"
+
 "$OUT_BIN"
+"$PMM_BIN"
+"$SLAB_BIN"
+"$ACPI_BIN"
+"$LOCK_BIN"
+"$KTIMER_BIN"
+"$RING_BIN"